@@ -0,0 +1,581 @@
+// Throughput benchmarks for the normalization hot paths.
+//
+// Micro: every sample kernel variant the CPU supports, on synthetic buffers
+// of several sizes and channel counts. Macro: the audio_processor binary end
+// to end over generated WAV corpora, reported as files/s and MB/s.
+//
+// Results go to stdout as JSON (or to --json FILE) so runs can be compared
+// across releases; a readable summary goes to stderr.
+//
+// --check-loudness instead measures the EBU Tech 3341 reference signals
+// with the loudness and true-peak meters and exits non-zero on a miss.
+// --check-pack writes a --pack output with PackWriter and reads it back
+// with PackReader.
+//
+//   bench [--binary PATH] [--json FILE] [--quick] [--no-e2e]
+//   bench --check-loudness
+//   bench --check-pack
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "audio_kernels.h"
+#include "loudness.h"
+#include "audio_pack.h"
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+volatile float sink; // Keeps results alive so the timed calls are not optimized out
+
+double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Best time of `rounds` runs of `fn`, each repeated until it takes at least
+// `min_seconds`; returns seconds per call
+template <typename Fn>
+double timeBest(Fn fn, double min_seconds, int rounds) {
+    double best = INFINITY;
+    for (int r = 0; r < rounds; ++r) {
+        size_t calls = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            fn();
+            ++calls;
+            elapsed = secondsSince(start);
+        } while (elapsed < min_seconds);
+        best = min(best, elapsed / calls);
+    }
+    return best;
+}
+
+struct MicroResult {
+    string kernel;
+    string op;
+    size_t frames;
+    int channels;
+    double ns_per_sample;
+    double gb_per_s;
+};
+
+struct MacroResult {
+    string corpus;
+    string mode;
+    size_t files;
+    size_t bytes;
+    double seconds;
+    bool ok;
+};
+
+// A sine (pitch picked by seed) plus some noise, peaking around 0.8
+void fillSynthetic(vector<float>& samples, uint32_t seed) {
+    uint32_t x = seed ? seed : 1;
+    float step = 0.0031f * (1 + seed % 5);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        float noise = (x >> 8) * (1.0f / 16777216.0f) - 0.5f;
+        samples[i] = 0.7f * sinf(i * step) + 0.1f * noise;
+    }
+}
+
+vector<MicroResult> runMicro(bool quick) {
+    vector<MicroResult> results;
+    vector<size_t> frame_counts = quick ? vector<size_t>{4096, 1 << 18} : vector<size_t>{4096, 1 << 16, 1 << 20, 1 << 23};
+    vector<int> channel_counts = quick ? vector<int>{2} : vector<int>{1, 2, 6};
+    double min_seconds = quick ? 0.02 : 0.1;
+    int rounds = quick ? 2 : 5;
+
+    vector<audio_kernels::KernelTable> tables;
+    for (const char* name : {"scalar", "avx2", "avx512", "neon"}) {
+        audio_kernels::KernelTable table = audio_kernels::selectKernels(name);
+        if (strcmp(table.name, name) == 0) {
+            tables.push_back(table);
+        }
+    }
+
+    for (size_t frames : frame_counts) {
+        for (int channels : channel_counts) {
+            size_t n = frames * channels;
+            vector<float> samples(n), out(n);
+            vector<int16_t> pcm16(n);
+            fillSynthetic(samples, 12345);
+            audio_kernels::floatToPcm16Scalar(samples.data(), pcm16.data(), n, nullptr);
+
+            for (const auto& k : tables) {
+                auto record = [&](const char* op, double seconds, size_t bytes_per_sample) {
+                    MicroResult r{k.name, op, frames, channels, seconds * 1e9 / n, n * bytes_per_sample / seconds / 1e9};
+                    results.push_back(r);
+                    fprintf(stderr, "  %-7s %-13s %8zu x %d  %7.3f ns/sample  %7.2f GB/s\n",
+                            r.kernel.c_str(), op, frames, channels, r.ns_per_sample, r.gb_per_s);
+                };
+                // Peak, min/max and the RMS sum of squares come out of one pass
+                record("stats", timeBest([&] { sink = k.stats(samples.data(), n).peak; }, min_seconds, rounds), sizeof(float));
+                // Alternate the gain so repeated scaling neither overflows nor underflows
+                float gain = 1.0001f;
+                record("scale", timeBest([&] { k.scale(out.data(), n, gain); gain = 1.0f / gain; }, min_seconds, rounds), 2 * sizeof(float));
+                record("scale_copy", timeBest([&] { k.scale_copy(samples.data(), out.data(), n, 0.9f); sink = out[n / 2]; }, min_seconds, rounds), 2 * sizeof(float));
+                record("stats_pcm16", timeBest([&] { sink = k.stats_pcm16(pcm16.data(), n).peak; }, min_seconds, rounds), sizeof(int16_t));
+                record("to_pcm16", timeBest([&] { k.to_pcm16(samples.data(), pcm16.data(), n, nullptr); sink = pcm16[n / 2]; }, min_seconds, rounds), sizeof(float) + sizeof(int16_t));
+            }
+
+            // The --lufs and --true-peak meters have no kernel variants; a
+            // fresh true-peak meter per call keeps it from skipping the filter
+            auto record = [&](const char* op, double seconds) {
+                MicroResult r{"meter", op, frames, channels, seconds * 1e9 / n, n * sizeof(float) / seconds / 1e9};
+                results.push_back(r);
+                fprintf(stderr, "  %-7s %-13s %8zu x %d  %7.3f ns/sample  %7.2f GB/s\n",
+                        r.kernel.c_str(), op, frames, channels, r.ns_per_sample, r.gb_per_s);
+            };
+            LoudnessMeter loudness(channels, 48000);
+            record("loudness", timeBest([&] { loudness.process(samples.data(), frames); }, min_seconds, rounds));
+            record("true_peak", timeBest([&] {
+                TruePeakMeter true_peak(channels, 48000);
+                true_peak.process(samples.data(), frames);
+                sink = true_peak.truePeak();
+            }, min_seconds, rounds));
+        }
+    }
+    return results;
+}
+
+// 1 kHz sine segments of `seconds` at `dbfs` peak level, the same on every
+// channel unless `channel_dbfs` gives a level per channel
+struct Tone {
+    double seconds;
+    double dbfs;
+};
+
+vector<float> toneSequence(const vector<Tone>& tones, int channels, int rate, const vector<double>& channel_dbfs = {}) {
+    vector<float> samples;
+    size_t n = 0;
+    for (const Tone& tone : tones) {
+        size_t frames = static_cast<size_t>(lround(tone.seconds * rate));
+        for (size_t f = 0; f < frames; ++f, ++n) {
+            double x = sin(2.0 * M_PI * 1000.0 * n / rate);
+            for (int c = 0; c < channels; ++c) {
+                double dbfs = channel_dbfs.empty() ? tone.dbfs : channel_dbfs[c];
+                samples.push_back(static_cast<float>(pow(10.0, dbfs / 20.0) * x));
+            }
+        }
+    }
+    return samples;
+}
+
+// Integrated loudness from meters over consecutive ranges, each warmed up on
+// the frames before it and merged in order, as LevelMeters splits a file
+double lufsInRanges(const vector<float>& samples, int channels, int rate, size_t ranges) {
+    LoudnessMeter whole(channels, rate);
+    size_t frames = samples.size() / channels;
+    size_t range = frames / ranges / whole.stepFrames() * whole.stepFrames();
+    whole.process(samples.data(), range);
+    for (size_t r = 1; r < ranges; ++r) {
+        size_t first = r * range;
+        size_t count = r + 1 == ranges ? frames - first : range;
+        LoudnessMeter later(channels, rate);
+        later.warmUp(&samples[(first - whole.warmUpFrames()) * channels], whole.warmUpFrames());
+        later.process(&samples[first * channels], count);
+        whole.merge(later);
+    }
+    return whole.integratedLufs();
+}
+
+float truePeakInRanges(const vector<float>& samples, int channels, int rate, size_t ranges) {
+    TruePeakMeter whole(channels, rate);
+    size_t frames = samples.size() / channels;
+    size_t range = frames / ranges;
+    whole.process(samples.data(), range);
+    for (size_t r = 1; r < ranges; ++r) {
+        size_t first = r * range;
+        size_t count = r + 1 == ranges ? frames - first : range;
+        TruePeakMeter later(channels, rate);
+        later.warmUp(samples.data(), first);
+        later.process(&samples[first * channels], count);
+        whole.merge(later);
+    }
+    return whole.truePeak();
+}
+
+// Tech 3341 (V4) minimum requirements that can be synthesized: integrated
+// loudness cases 1-6 (48 kHz, +-0.1 LU) and the true-peak sine cases 15-19
+// (+0.2/-0.4 dB). Cases 7-8 and 20-23 need the EBU's programme files, and
+// Tech 3342 covers loudness range, which the tool does not measure. Every
+// case is also metered in ranges, which must match the in-order result.
+bool checkLoudness() {
+    const int rate = 48000;
+    bool ok = true;
+    auto report = [&](const string& name, double measured, double expected, double below, double above) {
+        bool pass = measured >= expected - below && measured <= expected + above;
+        ok = ok && pass;
+        fprintf(stderr, "  %-34s %8.3f (expected %6.1f)  %s\n", name.c_str(), measured, expected, pass ? "ok" : "FAIL");
+    };
+    auto consistent = [&](const string& name, bool same) {
+        ok = ok && same;
+        if (!same) {
+            fprintf(stderr, "  %-34s ranges differ from the in-order pass  FAIL\n", name.c_str());
+        }
+    };
+
+    struct LoudnessCase {
+        string name;
+        vector<Tone> tones;
+        int channels;
+        vector<double> channel_dbfs;
+    };
+    vector<LoudnessCase> loudness_cases = {
+        {"3341-1 -23 dBFS, 20 s", {{20, -23}}, 2, {}},
+        {"3341-2 -33 dBFS, 20 s", {{20, -33}}, 2, {}},
+        {"3341-3 -36/-23/-36 dBFS", {{10, -36}, {60, -23}, {10, -36}}, 2, {}},
+        {"3341-4 -72/-36/-23/-36/-72 dBFS", {{10, -72}, {10, -36}, {60, -23}, {10, -36}, {10, -72}}, 2, {}},
+        {"3341-5 -26/-20/-26 dBFS", {{20, -26}, {20.1, -20}, {20, -26}}, 2, {}},
+        {"3341-6 5.0, L R -28 C -24 Ls Rs -30", {{20, 0}}, 5, {-28, -28, -24, -30, -30}},
+    };
+    fprintf(stderr, "Integrated loudness (LUFS)\n");
+    for (const LoudnessCase& c : loudness_cases) {
+        vector<float> samples = toneSequence(c.tones, c.channels, rate, c.channel_dbfs);
+        LoudnessMeter meter(c.channels, rate);
+        meter.process(samples.data(), samples.size() / c.channels);
+        double lufs = meter.integratedLufs();
+        report(c.name, lufs, c.name.find("-33 dBFS") != string::npos ? -33.0 : -23.0, 0.1, 0.1);
+        consistent(c.name, fabs(lufsInRanges(samples, c.channels, rate, 4) - lufs) < 1e-9);
+    }
+
+    struct PeakCase {
+        string name;
+        double frequency; // Relative to the sample rate
+        double phase;     // Degrees
+        double amplitude;
+        double expected;  // dBTP
+    };
+    vector<PeakCase> peak_cases = {
+        {"3341-15 fs/4, 0 deg, -6 dBFS", 0.25, 0.0, 0.5, -6.0},
+        {"3341-16 fs/4, 45 deg", 0.25, 45.0, 0.5, -6.0},
+        {"3341-17 fs/6, 60 deg", 1.0 / 6.0, 60.0, 0.5, -6.0},
+        {"3341-18 fs/8, 67.5 deg", 0.125, 67.5, 0.5, -6.0},
+        {"3341-19 fs/4, 45 deg, +3 dBTP", 0.25, 45.0, 1.41, 3.0},
+    };
+    // Faded in over 10 ms: a tone starting from silence at full level would
+    // make the interpolator ring on the step, which is not what is measured
+    fprintf(stderr, "True peak (dBTP)\n");
+    for (const PeakCase& c : peak_cases) {
+        vector<float> samples;
+        const int fade = rate / 100;
+        for (int f = 0; f < rate; ++f) {
+            double envelope = f < fade ? 0.5 - 0.5 * cos(M_PI * f / fade) : 1.0;
+            float x = static_cast<float>(envelope * c.amplitude * sin(2.0 * M_PI * c.frequency * f + c.phase * M_PI / 180.0));
+            samples.push_back(x);
+            samples.push_back(x);
+        }
+        TruePeakMeter meter(2, rate);
+        meter.process(samples.data(), samples.size() / 2);
+        report(c.name, 20.0 * log10(meter.truePeak()), c.expected, 0.4, 0.2);
+        consistent(c.name, truePeakInRanges(samples, 2, rate, 4) == meter.truePeak());
+    }
+    fprintf(stderr, ok ? "All reference cases pass\n" : "Some reference cases FAILED\n");
+    return ok;
+}
+
+// Writes a pack with PackWriter, in every sample format and across a shard
+// rollover, and reads it back with PackReader: lookup by name, the index
+// fields and the sample bytes must match, and a truncated index must be
+// refused.
+bool checkPack() {
+    char tmpl[] = "/tmp/audio_pack_check.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return false;
+    }
+    string dir = tmpl;
+    bool ok = true;
+    auto report = [&](const string& name, bool pass) {
+        ok = ok && pass;
+        fprintf(stderr, "  %-34s %s\n", name.c_str(), pass ? "ok" : "FAIL");
+    };
+
+    struct PackCase {
+        string name;
+        uint16_t format;
+        uint16_t channels;
+        uint32_t rate;
+        uint64_t frames;
+        vector<uint8_t> bytes;
+    };
+    // Written out of name order; the float record is larger than one
+    // PACK_APPEND_BYTES buffer, and 64 KB shards roll over after it
+    vector<PackCase> cases = {
+        {"b/speech_pcm16.wav", PackPcm16, 2, 16000, 10007, {}},
+        {"a/music_pcm24.wav", PackPcm24, 1, 48000, 30011, {}},
+        {"c/long_float32.wav", PackFloat32, 2, 44100, 600001, {}},
+        {"a/after_rollover.wav", PackPcm16, 1, 22050, 5003, {}},
+    };
+    uint32_t seed = 12345;
+    for (PackCase& c : cases) {
+        c.bytes.resize(c.frames * c.channels * packBytesPerSample(c.format));
+        for (uint8_t& b : c.bytes) {
+            seed = seed * 1664525u + 1013904223u;
+            b = seed >> 24;
+        }
+    }
+
+    PackWriter writer;
+    writer.open(dir, 64 << 10);
+    bool written = true;
+    for (size_t k = 0; k < cases.size(); ++k) {
+        const PackCase& c = cases[k];
+        PackRecord record;
+        written = written && writer.begin(record, c.rate, c.channels, c.format);
+        // Uneven chunks, as libsndfile hands them over
+        for (size_t at = 0; written && at < c.bytes.size();) {
+            size_t chunk = min<size_t>(c.bytes.size() - at, 1000 + 777 * (at % 5));
+            written = record.write(&c.bytes[at], chunk) == (int64_t)chunk;
+            at += chunk;
+        }
+        written = written && writer.commit(record, c.name, 0.25f * (k + 1));
+    }
+    written = written && writer.finish();
+    report("write " + to_string(cases.size()) + " records", written);
+    report("shard rollover", writer.shardCount() >= 2);
+
+    PackReader reader;
+    bool opened = reader.open(dir);
+    report("open", opened && reader.size() == cases.size());
+    if (opened) {
+        bool sorted = true;
+        for (size_t i = 1; i < reader.size(); ++i) {
+            sorted = sorted && reader.name(i - 1) < reader.name(i);
+        }
+        report("index sorted by name", sorted);
+        for (size_t k = 0; k < cases.size(); ++k) {
+            const PackCase& c = cases[k];
+            size_t i = reader.find(c.name);
+            bool same = i < reader.size();
+            if (same) {
+                const PackIndexEntry& e = reader.entry(i);
+                same = e.frames == c.frames && e.channels == c.channels && e.format == c.format &&
+                       e.sample_rate == c.rate && e.bytes == c.bytes.size() && e.offset % PACK_PAGE == 0 &&
+                       e.original_peak == 0.25f * (k + 1) && memcmp(reader.samples(i), c.bytes.data(), c.bytes.size()) == 0;
+            }
+            report("read back " + c.name, same);
+        }
+        report("unknown name", reader.find("a/missing.wav") == reader.size());
+    }
+    reader.close();
+
+    string index = dir + "/pack.idx";
+    struct stat sb;
+    if (stat(index.c_str(), &sb) == 0) {
+        report("truncated names refused", truncate(index.c_str(), sb.st_size - 1) == 0 && !reader.open(dir));
+        report("truncated entries refused",
+               truncate(index.c_str(), sizeof(PackIndexHeader) + sizeof(PackIndexEntry)) == 0 && !reader.open(dir));
+        report("truncated header refused", truncate(index.c_str(), 8) == 0 && !reader.open(dir));
+    } else {
+        report("index written", false);
+    }
+
+    string cleanup = "rm -rf '" + dir + "'";
+    if (system(cleanup.c_str()) != 0) {
+        fprintf(stderr, "Could not remove %s\n", dir.c_str());
+    }
+    fprintf(stderr, ok ? "Pack round trip passes\n" : "Pack round trip FAILED\n");
+    return ok;
+}
+
+// Writes a canonical WAV file: format 1 (PCM16/PCM24) or 3 (float32)
+bool writeWav(const string& path, const vector<float>& samples, int channels, int rate, int format_tag, int bits) {
+    size_t bytes_per_sample = bits / 8;
+    size_t data_bytes = samples.size() * bytes_per_sample;
+    vector<uint8_t> buf(44 + data_bytes);
+    auto le = [&](size_t at, uint32_t v, int width) {
+        for (int b = 0; b < width; ++b) {
+            buf[at + b] = (v >> (8 * b)) & 0xFF;
+        }
+    };
+    memcpy(&buf[0], "RIFF", 4);
+    le(4, 36 + data_bytes, 4);
+    memcpy(&buf[8], "WAVEfmt ", 8);
+    le(16, 16, 4);
+    le(20, format_tag, 2);
+    le(22, channels, 2);
+    le(24, rate, 4);
+    le(28, rate * channels * bytes_per_sample, 4);
+    le(32, channels * bytes_per_sample, 2);
+    le(34, bits, 2);
+    memcpy(&buf[36], "data", 4);
+    le(40, data_bytes, 4);
+    uint8_t* p = &buf[44];
+    for (float s : samples) {
+        if (format_tag == 3) {
+            memcpy(p, &s, 4);
+        } else {
+            int32_t v = lrintf(max(-1.0f, min(s, 1.0f)) * (bits == 16 ? 32767.0f : 8388607.0f));
+            le(p - &buf[0], static_cast<uint32_t>(v), bits / 8);
+        }
+        p += bytes_per_sample;
+    }
+    ofstream out(path, ios::binary);
+    out.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    return static_cast<bool>(out);
+}
+
+struct Corpus {
+    string name;
+    size_t files;
+    double seconds_each;
+    int channels;
+    int format_tag;
+    int bits;
+};
+
+// Generates `corpus` under `dir`; returns the total bytes written
+size_t generateCorpus(const Corpus& corpus, const string& dir) {
+    const int rate = 44100;
+    mkdir(dir.c_str(), 0755);
+    vector<float> samples(static_cast<size_t>(corpus.seconds_each * rate) * corpus.channels);
+    size_t total = 0;
+    for (size_t f = 0; f < corpus.files; ++f) {
+        fillSynthetic(samples, 1000 + f);
+        float level = 0.2f + 0.6f * (f % 7) / 6.0f; // Vary the peak so every file gets a different gain
+        for (float& s : samples) {
+            s *= level;
+        }
+        string path = dir + "/file" + to_string(f) + ".wav";
+        if (writeWav(path, samples, corpus.channels, rate, corpus.format_tag, corpus.bits)) {
+            total += 44 + samples.size() * (corpus.bits / 8);
+        }
+    }
+    return total;
+}
+
+vector<MacroResult> runMacro(const string& binary, bool quick) {
+    vector<MacroResult> results;
+    if (access(binary.c_str(), X_OK) != 0) {
+        fprintf(stderr, "Skipping end-to-end runs: %s is not executable\n", binary.c_str());
+        return results;
+    }
+    char tmpl[] = "/tmp/audio_bench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        fprintf(stderr, "Skipping end-to-end runs: cannot create a temporary directory\n");
+        return results;
+    }
+    string root = tmpl;
+
+    vector<Corpus> corpora = {
+        {"short_pcm16_mono", quick ? 40u : 400u, 1.0, 1, 1, 16},
+        {"long_pcm24_stereo", quick ? 2u : 8u, quick ? 10.0 : 60.0, 2, 1, 24},
+        {"medium_float_stereo", quick ? 8u : 40u, 5.0, 2, 3, 32},
+    };
+    vector<pair<string, string>> modes = {
+        {"default", ""},
+        {"no_mmap", "--no-mmap"},
+        {"stream", "--stream"},
+        {"pipeline", "--pipeline"},
+    };
+
+    for (const Corpus& corpus : corpora) {
+        string in_dir = root + "/" + corpus.name;
+        size_t bytes = generateCorpus(corpus, in_dir);
+        for (const auto& mode : modes) {
+            string out_dir = root + "/out";
+            string cmd = "rm -rf '" + out_dir + "' && mkdir -p '" + out_dir + "' && '" + binary + "' " + mode.second +
+                         " --log '" + root + "/log.txt' '" + in_dir + "' '" + out_dir + "' 0.9 > /dev/null";
+            Clock::time_point start = Clock::now();
+            int status = system(cmd.c_str());
+            double seconds = secondsSince(start);
+            MacroResult r{corpus.name, mode.first, corpus.files, bytes, seconds, status == 0};
+            results.push_back(r);
+            fprintf(stderr, "  %-20s %-9s %5zu files  %8.3f s  %9.1f files/s  %8.1f MB/s%s\n",
+                    r.corpus.c_str(), r.mode.c_str(), r.files, seconds, r.files / seconds,
+                    r.bytes / seconds / 1e6, r.ok ? "" : "  (failed)");
+        }
+    }
+    string cleanup = "rm -rf '" + root + "'";
+    if (system(cleanup.c_str()) != 0) {
+        fprintf(stderr, "Could not remove %s\n", root.c_str());
+    }
+    return results;
+}
+
+string toJson(const vector<MicroResult>& micro, const vector<MacroResult>& macro) {
+    ostringstream js;
+    js.precision(6);
+    js << "{\n  \"selected_kernels\": \"" << activeKernelName() << "\",\n  \"micro\": [";
+    for (size_t i = 0; i < micro.size(); ++i) {
+        const MicroResult& r = micro[i];
+        js << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.kernel << "\", \"op\": \"" << r.op
+           << "\", \"frames\": " << r.frames << ", \"channels\": " << r.channels
+           << ", \"ns_per_sample\": " << r.ns_per_sample << ", \"gb_per_s\": " << r.gb_per_s << "}";
+    }
+    js << "\n  ],\n  \"e2e\": [";
+    for (size_t i = 0; i < macro.size(); ++i) {
+        const MacroResult& r = macro[i];
+        js << (i ? ",\n" : "\n") << "    {\"corpus\": \"" << r.corpus << "\", \"mode\": \"" << r.mode
+           << "\", \"files\": " << r.files << ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.seconds
+           << ", \"files_per_s\": " << r.files / r.seconds << ", \"mb_per_s\": " << r.bytes / r.seconds / 1e6
+           << ", \"ok\": " << (r.ok ? "true" : "false") << "}";
+    }
+    js << "\n  ]\n}\n";
+    return js.str();
+}
+
+int main(int argc, char* argv[]) {
+    string binary = "bin/audio_processor";
+    string json_path;
+    bool quick = false;
+    bool e2e = true;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--binary" && i + 1 < argc) {
+            binary = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--no-e2e") {
+            e2e = false;
+        } else if (arg == "--check-loudness") {
+            return checkLoudness() ? 0 : 1;
+        } else if (arg == "--check-pack") {
+            return checkPack() ? 0 : 1;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--binary PATH] [--json FILE] [--quick] [--no-e2e]" << endl;
+            cerr << "       " << argv[0] << " --check-loudness" << endl;
+            cerr << "       " << argv[0] << " --check-pack" << endl;
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Sample kernels (selected: %s)\n", activeKernelName());
+    vector<MicroResult> micro = runMicro(quick);
+    vector<MacroResult> macro;
+    if (e2e) {
+        fprintf(stderr, "End to end (%s)\n", binary.c_str());
+        macro = runMacro(binary, quick);
+    }
+
+    string json = toJson(micro, macro);
+    if (json_path.empty()) {
+        cout << json;
+    } else {
+        ofstream out(json_path);
+        out << json;
+        if (!out) {
+            cerr << "Could not write " << json_path << endl;
+            return 1;
+        }
+        fprintf(stderr, "Results written to %s\n", json_path.c_str());
+    }
+    return 0;
+}
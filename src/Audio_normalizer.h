@@ -9,26 +9,47 @@
 #include <cstring>  
 #include <dirent.h> // For directory operations (Unix-like systems)
 #include <sys/stat.h> // For checking if a path is a directory (Unix-like systems)
+#include "sample_buffer.h"
 using namespace std;
 
+struct AudioStats {
+    float min_val = 0.0f;
+    float max_val = 0.0f;
+    float peak = 0.0f;
+    float rms = 0.0f;
+    size_t sample_count = 0;
+    float gain = 1.0f;
+
+    AudioStats scaled(float factor) const;
+    AudioStats normalized() const;
+};
+
 class AudioProcessor {
 private:
-    vector<float> audio_data;
+    SampleBuffer audio_data;
+    SampleBuffer block_buffer;
     SF_INFO sf_info; 
     string filename;
-    ofstream log_file;
+    bool active;
 
 public:
-    // Constructor
-    AudioProcessor(const std::string& file_path, const std::string& log_path = "log.txt");
+    // Constructors
+    AudioProcessor();
+    explicit AudioProcessor(const std::string& file_path);
 
     // Destructor
     ~AudioProcessor();
 
+    // Reuse
+    void reset(const std::string& file_path);
+    void finish();
+
     // functions
     void log(const std::string& message);
     bool loadAudio();
-    void normalizePeak(float target_peak = 1.0f);
+    AudioStats normalizePeak(float target_peak = 1.0f);
     void printStats(const std::string& title);
+    void printStats(const std::string& title, const AudioStats& stats);
+    bool normalizeStreaming(const std::string& output_filename, float target_peak = 1.0f);
     bool saveAudio(const std::string& output_filename);
 };
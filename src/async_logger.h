@@ -0,0 +1,205 @@
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+// Log file writer fed by per-thread lock-free rings. log() only moves the
+// message into the calling thread's ring; a background thread drains every
+// ring, writes the batch with one fwrite and flushes at a fixed interval.
+// The file is opened once for the whole run.
+class AsyncLogger {
+private:
+    // Single-producer / single-consumer ring owned by one logging thread
+    struct Ring {
+        static const size_t CAPACITY = 4096;
+        std::unique_ptr<std::string[]> slots{new std::string[CAPACITY]};
+        alignas(64) std::atomic<size_t> head{0}; // Next slot the logger reads
+        alignas(64) std::atomic<size_t> tail{0}; // Next slot the producer writes
+    };
+
+    FILE* file = nullptr;
+    uint64_t id;
+    int flush_interval_ms = 200;
+    pthread_t thread;
+    bool running = false;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> full_waits{0}; // log() calls that found their ring full
+    std::atomic<uint64_t> full_wait_ns{0};
+
+    // Guard ring registration (once per thread) and the writer's sleep, never
+    // the logging fast path
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> ids{1};
+        return ids.fetch_add(1);
+    }
+
+    // Each thread caches its ring per logger, keyed by id so a destroyed
+    // logger's stale entry can never be matched by a new one
+    Ring* localRing() {
+        static thread_local std::vector<std::pair<uint64_t, Ring*>> cache;
+        for (const auto& entry : cache) {
+            if (entry.first == id) {
+                return entry.second;
+            }
+        }
+        Ring* ring = new Ring();
+        pthread_mutex_lock(&mutex);
+        rings.emplace_back(ring);
+        pthread_mutex_unlock(&mutex);
+        cache.emplace_back(id, ring);
+        return ring;
+    }
+
+    void wake() {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&wakeup);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // Moves everything queued so far into `batch`. Holding the mutex only
+    // keeps `rings` stable against a thread registering concurrently.
+    void drain(std::string& batch) {
+        pthread_mutex_lock(&mutex);
+        for (auto& owned : rings) {
+            Ring* ring = owned.get();
+            size_t head = ring->head.load(std::memory_order_relaxed);
+            size_t tail = ring->tail.load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                std::string& slot = ring->slots[head % Ring::CAPACITY];
+                batch += slot;
+                batch += '\n';
+                slot.clear();
+            }
+            ring->head.store(head, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    static void* writerMain(void* arg) {
+        static_cast<AsyncLogger*>(arg)->runWriter();
+        return nullptr;
+    }
+
+    void runWriter() {
+        std::string batch;
+        while (true) {
+            bool last_round = stopping.load(std::memory_order_acquire);
+            drain(batch);
+            if (!batch.empty()) {
+                fwrite(batch.data(), 1, batch.size(), file);
+                fflush(file);
+                batch.clear();
+            }
+            if (last_round) {
+                break;
+            }
+
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += flush_interval_ms / 1000;
+            deadline.tv_nsec += (flush_interval_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_mutex_lock(&mutex);
+            if (!stopping.load(std::memory_order_acquire)) {
+                pthread_cond_timedwait(&wakeup, &mutex, &deadline);
+            }
+            pthread_mutex_unlock(&mutex);
+        }
+    }
+
+public:
+    AsyncLogger() : id(nextId()) {}
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    ~AsyncLogger() {
+        close();
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&wakeup);
+    }
+
+    // Opens `path` for appending and starts the writer thread
+    bool open(const std::string& path, int flush_ms = 200) {
+        file = fopen(path.c_str(), "a");
+        if (file == nullptr) {
+            return false;
+        }
+        flush_interval_ms = flush_ms > 0 ? flush_ms : 1;
+        if (pthread_create(&thread, NULL, writerMain, this) != 0) {
+            fclose(file);
+            file = nullptr;
+            return false;
+        }
+        running = true;
+        return true;
+    }
+
+    bool isOpen() const {
+        return running;
+    }
+
+    // Queues one line (without trailing newline). Drops nothing: when the
+    // thread's ring is full it wakes the writer and waits for room.
+    void log(std::string message) {
+        if (!running) {
+            return;
+        }
+        Ring* ring = localRing();
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail - ring->head.load(std::memory_order_acquire) >= Ring::CAPACITY) {
+            timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            while (tail - ring->head.load(std::memory_order_acquire) >= Ring::CAPACITY) {
+                wake();
+                sched_yield();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            full_waits.fetch_add(1, std::memory_order_relaxed);
+            full_wait_ns.fetch_add((end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec, std::memory_order_relaxed);
+        }
+        ring->slots[tail % Ring::CAPACITY] = std::move(message);
+        ring->tail.store(tail + 1, std::memory_order_release);
+    }
+
+    // Times log() had to wait for the writer to make room, and for how long
+    uint64_t fullWaits() const {
+        return full_waits.load(std::memory_order_relaxed);
+    }
+
+    uint64_t fullWaitNs() const {
+        return full_wait_ns.load(std::memory_order_relaxed);
+    }
+
+    // Writes out everything queued, then stops the writer and closes the file.
+    // Callers must have stopped logging first.
+    void close() {
+        if (!running) {
+            return;
+        }
+        stopping.store(true, std::memory_order_release);
+        wake();
+        pthread_join(thread, NULL);
+        fclose(file);
+        file = nullptr;
+        running = false;
+    }
+};
+
+#endif // ASYNC_LOGGER_H
@@ -0,0 +1,565 @@
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_KERNELS_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+// The NEON kernels use A64-only across-vector reductions (vmaxvq_f32 ...),
+// FMA, and float64x2_t lanes for the blocked sums of squares; 32-bit ARM
+// builds take the scalar table
+#include <arm_neon.h>
+#define AUDIO_KERNELS_NEON 1
+#endif
+
+// Everything printStats and normalizePeak need, gathered in one pass
+struct SampleStats {
+    float min_val = INFINITY;
+    float max_val = -INFINITY;
+    float peak = 0.0f;
+    double sum_squares = 0.0;
+    size_t count = 0;
+};
+
+// Combines the stats of two disjoint ranges (e.g. consecutive stream blocks)
+inline void mergeSampleStats(SampleStats& into, const SampleStats& other) {
+    into.min_val = std::min(into.min_val, other.min_val);
+    into.max_val = std::max(into.max_val, other.max_val);
+    into.peak = std::max(into.peak, other.peak);
+    into.sum_squares += other.sum_squares;
+    into.count += other.count;
+}
+
+// State of the TPDF dither generator: eight independent xorshift32 lanes
+// so the vector kernels can draw a full register of noise per step
+struct DitherState {
+    uint32_t lanes[8];
+
+    explicit DitherState(uint32_t seed = 0x2545F491u) {
+        for (int k = 0; k < 8; ++k) {
+            uint32_t x = seed + 0x9E3779B9u * (k + 1);
+            lanes[k] = x ? x : 1;
+        }
+    }
+};
+
+namespace audio_kernels {
+
+// Sum-of-squares accuracy: the vector kernels add squares into float lanes
+// for at most this many samples, then widen the lanes into double
+// accumulators. A float lane that kept growing over a long file would stop
+// absorbing small squares; a block of 4096 keeps the relative error near
+// 1e-6 whatever the length, for one vector conversion per block.
+const size_t STATS_FLUSH_SAMPLES = 4096;
+
+inline void finishStats(SampleStats& st, size_t n) {
+    st.count = n;
+    st.peak = n ? std::max(std::fabs(st.min_val), std::fabs(st.max_val)) : 0.0f;
+}
+
+inline SampleStats statsScalar(const float* data, size_t n) {
+    SampleStats st;
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        st.min_val = std::min(st.min_val, data[i]);
+        st.max_val = std::max(st.max_val, data[i]);
+        sum += (double)data[i] * data[i];
+    }
+    st.sum_squares = sum;
+    finishStats(st, n);
+    return st;
+}
+
+inline void scaleScalar(float* data, size_t n, float gain) {
+    for (size_t i = 0; i < n; ++i) {
+        data[i] *= gain;
+    }
+}
+
+inline void scaleCopyScalar(const float* src, float* dst, size_t n, float gain) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = src[i] * gain;
+    }
+}
+
+// Integer PCM is mapped to [-1, 1) the same way libsndfile does it
+const float PCM16_SCALE = 1.0f / 32768.0f;
+const float PCM24_SCALE = 1.0f / 8388608.0f;
+
+inline int32_t pcm24At(const uint8_t* p) {
+    // Assemble in the top three bytes, then shift down to sign-extend
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+inline void scaleIntStats(SampleStats& st, float unit) {
+    st.min_val *= unit;
+    st.max_val *= unit;
+    st.sum_squares *= (double)unit * unit;
+}
+
+inline SampleStats statsPcm16Scalar(const int16_t* data, size_t n) {
+    int min_val = INT16_MAX, max_val = INT16_MIN;
+    int64_t sum = 0; // Exact: squares are at most 2^30
+    for (size_t i = 0; i < n; ++i) {
+        min_val = std::min(min_val, (int)data[i]);
+        max_val = std::max(max_val, (int)data[i]);
+        sum += (int32_t)data[i] * data[i];
+    }
+    SampleStats st;
+    if (n) {
+        st.min_val = min_val;
+        st.max_val = max_val;
+    }
+    st.sum_squares = (double)sum;
+    scaleIntStats(st, PCM16_SCALE);
+    finishStats(st, n);
+    return st;
+}
+
+// 24-bit samples straddle lane boundaries, so this stays scalar
+inline SampleStats statsPcm24(const uint8_t* data, size_t n) {
+    int32_t min_val = INT32_MAX, max_val = INT32_MIN;
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        int32_t v = pcm24At(data + 3 * i);
+        min_val = std::min(min_val, v);
+        max_val = std::max(max_val, v);
+        sum += (double)v * v;
+    }
+    SampleStats st;
+    if (n) {
+        st.min_val = min_val;
+        st.max_val = max_val;
+    }
+    st.sum_squares = sum;
+    scaleIntStats(st, PCM24_SCALE);
+    finishStats(st, n);
+    return st;
+}
+
+inline void convertPcm16Scalar(const int16_t* src, float* dst, size_t n, float gain) {
+    float unit = gain * PCM16_SCALE;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = src[i] * unit;
+    }
+}
+
+inline void convertPcm24(const uint8_t* src, float* dst, size_t n, float gain) {
+    float unit = gain * PCM24_SCALE;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = pcm24At(src + 3 * i) * unit;
+    }
+}
+
+inline uint32_t xorshift32(uint32_t& x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Triangular noise in (-1, 1) LSB: the difference of two uniform draws
+inline float tpdfNoise(DitherState& dither, int lane) {
+    const float unit = 1.0f / 16777216.0f;
+    float a = (xorshift32(dither.lanes[lane]) >> 8) * unit;
+    float b = (xorshift32(dither.lanes[lane]) >> 8) * unit;
+    return a - b;
+}
+
+// Quantizes to integers in [lo, hi] after scaling by `full_scale`, rounding
+// to nearest, with optional TPDF dither. Shared by the 16- and 24-bit paths.
+template <typename Out>
+inline void quantizeScalar(const float* src, Out* dst, size_t n, float full_scale, float lo, float hi, int shift, DitherState* dither) {
+    for (size_t i = 0; i < n; ++i) {
+        float y = src[i] * full_scale;
+        if (dither) {
+            y += tpdfNoise(*dither, i & 7);
+        }
+        y = std::min(std::max(y, lo), hi);
+        dst[i] = static_cast<Out>(static_cast<int32_t>(lrintf(y)) * (1 << shift));
+    }
+}
+
+inline void floatToPcm16Scalar(const float* src, int16_t* dst, size_t n, DitherState* dither) {
+    quantizeScalar(src, dst, n, 32768.0f, -32768.0f, 32767.0f, 0, dither);
+}
+
+// 24-bit values are returned in the top three bytes of an int32, the layout
+// libsndfile's sf_writef_int expects
+inline void floatToPcm24Scalar(const float* src, int32_t* dst, size_t n, DitherState* dither) {
+    quantizeScalar(src, dst, n, 8388608.0f, -8388608.0f, 8388607.0f, 8, dither);
+}
+
+#if defined(AUDIO_KERNELS_X86)
+
+__attribute__((target("avx2,fma")))
+inline SampleStats statsAvx2(const float* data, size_t n) {
+    __m256 vmin0 = _mm256_set1_ps(INFINITY), vmin1 = vmin0;
+    __m256 vmax0 = _mm256_set1_ps(-INFINITY), vmax1 = vmax0;
+    __m256d vsum = _mm256_setzero_pd();
+    size_t i = 0;
+    while (i + 16 <= n) {
+        // Two independent accumulator chains hide the FMA latency
+        __m256 vsq0 = _mm256_setzero_ps(), vsq1 = vsq0;
+        size_t end = std::min(n, i + STATS_FLUSH_SAMPLES);
+        for (; i + 16 <= end; i += 16) {
+            __m256 a = _mm256_loadu_ps(data + i);
+            __m256 b = _mm256_loadu_ps(data + i + 8);
+            vmin0 = _mm256_min_ps(vmin0, a);
+            vmin1 = _mm256_min_ps(vmin1, b);
+            vmax0 = _mm256_max_ps(vmax0, a);
+            vmax1 = _mm256_max_ps(vmax1, b);
+            vsq0 = _mm256_fmadd_ps(a, a, vsq0);
+            vsq1 = _mm256_fmadd_ps(b, b, vsq1);
+        }
+        __m256 sq = _mm256_add_ps(vsq0, vsq1);
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_castps256_ps128(sq)));
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_extractf128_ps(sq, 1)));
+    }
+    float mins[8], maxs[8];
+    double sums[4];
+    _mm256_storeu_ps(mins, _mm256_min_ps(vmin0, vmin1));
+    _mm256_storeu_ps(maxs, _mm256_max_ps(vmax0, vmax1));
+    _mm256_storeu_pd(sums, vsum);
+
+    SampleStats st = statsScalar(data + i, n - i);
+    for (int k = 0; k < 8; ++k) {
+        st.min_val = std::min(st.min_val, mins[k]);
+        st.max_val = std::max(st.max_val, maxs[k]);
+    }
+    st.sum_squares += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    finishStats(st, n);
+    return st;
+}
+
+__attribute__((target("avx2")))
+inline void scaleAvx2(float* data, size_t n, float gain) {
+    __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), g));
+        _mm256_storeu_ps(data + i + 8, _mm256_mul_ps(_mm256_loadu_ps(data + i + 8), g));
+    }
+    scaleScalar(data + i, n - i, gain);
+}
+
+__attribute__((target("avx2")))
+inline void scaleCopyAvx2(const float* src, float* dst, size_t n, float gain) {
+    __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), g));
+    }
+    scaleCopyScalar(src + i, dst + i, n - i, gain);
+}
+
+// Min/max stay in the int16 domain; only the squares need floats
+__attribute__((target("avx2,fma")))
+inline SampleStats statsPcm16Avx2(const int16_t* data, size_t n) {
+    __m256i vmin = _mm256_set1_epi16(INT16_MAX);
+    __m256i vmax = _mm256_set1_epi16(INT16_MIN);
+    __m256d vsum = _mm256_setzero_pd();
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m256 vsq0 = _mm256_setzero_ps(), vsq1 = vsq0;
+        size_t end = std::min(n, i + STATS_FLUSH_SAMPLES);
+        for (; i + 16 <= end; i += 16) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            vmin = _mm256_min_epi16(vmin, v);
+            vmax = _mm256_max_epi16(vmax, v);
+            __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+            __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+            vsq0 = _mm256_fmadd_ps(lo, lo, vsq0);
+            vsq1 = _mm256_fmadd_ps(hi, hi, vsq1);
+        }
+        __m256 sq = _mm256_add_ps(vsq0, vsq1);
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_castps256_ps128(sq)));
+        vsum = _mm256_add_pd(vsum, _mm256_cvtps_pd(_mm256_extractf128_ps(sq, 1)));
+    }
+    int16_t mins[16], maxs[16];
+    double sums[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+    _mm256_storeu_pd(sums, vsum);
+
+    SampleStats st = statsPcm16Scalar(data + i, n - i);
+    float min_val = st.min_val, max_val = st.max_val;
+    for (int k = 0; k < 16; ++k) {
+        min_val = std::min(min_val, mins[k] * PCM16_SCALE);
+        max_val = std::max(max_val, maxs[k] * PCM16_SCALE);
+    }
+    double sum = st.sum_squares + ((sums[0] + sums[1]) + (sums[2] + sums[3])) * ((double)PCM16_SCALE * PCM16_SCALE);
+    st.min_val = min_val;
+    st.max_val = max_val;
+    st.sum_squares = sum;
+    finishStats(st, n);
+    return st;
+}
+
+__attribute__((target("avx2")))
+inline void convertPcm16Avx2(const int16_t* src, float* dst, size_t n, float gain) {
+    __m256 unit = _mm256_set1_ps(gain * PCM16_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), unit));
+    }
+    convertPcm16Scalar(src + i, dst + i, n - i, gain);
+}
+
+__attribute__((target("avx2")))
+inline __m256 tpdfNoiseAvx2(__m256i& state) {
+    const __m256 unit = _mm256_set1_ps(1.0f / 16777216.0f);
+    __m256 draws[2];
+    for (int d = 0; d < 2; ++d) {
+        state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+        state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+        draws[d] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(state, 8)), unit);
+    }
+    return _mm256_sub_ps(draws[0], draws[1]);
+}
+
+// Scales, optionally dithers and clamps 8 samples, then rounds to int32
+__attribute__((target("avx2")))
+inline __m256i quantizeAvx2(__m256 x, __m256 full_scale, __m256 lo, __m256 hi, __m256i* dither_state) {
+    __m256 y = _mm256_mul_ps(x, full_scale);
+    if (dither_state) {
+        y = _mm256_add_ps(y, tpdfNoiseAvx2(*dither_state));
+    }
+    y = _mm256_min_ps(_mm256_max_ps(y, lo), hi);
+    return _mm256_cvtps_epi32(y); // Rounds to nearest under the default MXCSR mode
+}
+
+__attribute__((target("avx2")))
+inline void floatToPcm16Avx2(const float* src, int16_t* dst, size_t n, DitherState* dither) {
+    const __m256 full_scale = _mm256_set1_ps(32768.0f);
+    const __m256 lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f);
+    __m256i state = dither ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither->lanes)) : _mm256_setzero_si256();
+    __m256i* state_ptr = dither ? &state : nullptr;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = quantizeAvx2(_mm256_loadu_ps(src + i), full_scale, lo, hi, state_ptr);
+        __m256i b = quantizeAvx2(_mm256_loadu_ps(src + i + 8), full_scale, lo, hi, state_ptr);
+        // packs works per 128-bit lane; the permute restores sample order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    if (dither) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dither->lanes), state);
+    }
+    floatToPcm16Scalar(src + i, dst + i, n - i, dither);
+}
+
+__attribute__((target("avx2")))
+inline void floatToPcm24Avx2(const float* src, int32_t* dst, size_t n, DitherState* dither) {
+    const __m256 full_scale = _mm256_set1_ps(8388608.0f);
+    const __m256 lo = _mm256_set1_ps(-8388608.0f), hi = _mm256_set1_ps(8388607.0f);
+    __m256i state = dither ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither->lanes)) : _mm256_setzero_si256();
+    __m256i* state_ptr = dither ? &state : nullptr;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = quantizeAvx2(_mm256_loadu_ps(src + i), full_scale, lo, hi, state_ptr);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_slli_epi32(v, 8));
+    }
+    if (dither) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dither->lanes), state);
+    }
+    floatToPcm24Scalar(src + i, dst + i, n - i, dither);
+}
+
+__attribute__((target("avx512f")))
+inline SampleStats statsAvx512(const float* data, size_t n) {
+    __m512 vmin0 = _mm512_set1_ps(INFINITY), vmin1 = vmin0;
+    __m512 vmax0 = _mm512_set1_ps(-INFINITY), vmax1 = vmax0;
+    __m512d vsum = _mm512_setzero_pd();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m512 vsq0 = _mm512_setzero_ps(), vsq1 = vsq0;
+        size_t end = std::min(n, i + STATS_FLUSH_SAMPLES);
+        for (; i + 32 <= end; i += 32) {
+            __m512 a = _mm512_loadu_ps(data + i);
+            __m512 b = _mm512_loadu_ps(data + i + 16);
+            vmin0 = _mm512_min_ps(vmin0, a);
+            vmin1 = _mm512_min_ps(vmin1, b);
+            vmax0 = _mm512_max_ps(vmax0, a);
+            vmax1 = _mm512_max_ps(vmax1, b);
+            vsq0 = _mm512_fmadd_ps(a, a, vsq0);
+            vsq1 = _mm512_fmadd_ps(b, b, vsq1);
+        }
+        __m512 sq = _mm512_add_ps(vsq0, vsq1);
+        __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(sq), 1));
+        vsum = _mm512_add_pd(vsum, _mm512_cvtps_pd(_mm512_castps512_ps256(sq)));
+        vsum = _mm512_add_pd(vsum, _mm512_cvtps_pd(high));
+    }
+    float mins[16], maxs[16];
+    double sums[8];
+    _mm512_storeu_ps(mins, _mm512_min_ps(vmin0, vmin1));
+    _mm512_storeu_ps(maxs, _mm512_max_ps(vmax0, vmax1));
+    _mm512_storeu_pd(sums, vsum);
+
+    SampleStats st = statsScalar(data + i, n - i);
+    for (int k = 0; k < 16; ++k) {
+        st.min_val = std::min(st.min_val, mins[k]);
+        st.max_val = std::max(st.max_val, maxs[k]);
+    }
+    for (int k = 0; k < 8; ++k) {
+        st.sum_squares += sums[k];
+    }
+    finishStats(st, n);
+    return st;
+}
+
+__attribute__((target("avx512f")))
+inline void scaleAvx512(float* data, size_t n, float gain) {
+    __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(data + i, _mm512_mul_ps(_mm512_loadu_ps(data + i), g));
+    }
+    scaleScalar(data + i, n - i, gain);
+}
+
+#elif defined(AUDIO_KERNELS_NEON)
+
+inline SampleStats statsNeon(const float* data, size_t n) {
+    float32x4_t vmin0 = vdupq_n_f32(INFINITY), vmin1 = vmin0;
+    float32x4_t vmax0 = vdupq_n_f32(-INFINITY), vmax1 = vmax0;
+    float64x2_t vsum = vdupq_n_f64(0.0);
+    size_t i = 0;
+    while (i + 8 <= n) {
+        float32x4_t vsq0 = vdupq_n_f32(0.0f), vsq1 = vsq0;
+        size_t end = std::min(n, i + STATS_FLUSH_SAMPLES);
+        for (; i + 8 <= end; i += 8) {
+            float32x4_t a = vld1q_f32(data + i);
+            float32x4_t b = vld1q_f32(data + i + 4);
+            vmin0 = vminq_f32(vmin0, a);
+            vmin1 = vminq_f32(vmin1, b);
+            vmax0 = vmaxq_f32(vmax0, a);
+            vmax1 = vmaxq_f32(vmax1, b);
+            vsq0 = vfmaq_f32(vsq0, a, a);
+            vsq1 = vfmaq_f32(vsq1, b, b);
+        }
+        float32x4_t sq = vaddq_f32(vsq0, vsq1);
+        vsum = vaddq_f64(vsum, vcvt_f64_f32(vget_low_f32(sq)));
+        vsum = vaddq_f64(vsum, vcvt_high_f64_f32(sq));
+    }
+    SampleStats st = statsScalar(data + i, n - i);
+    st.min_val = std::min(st.min_val, vminvq_f32(vminq_f32(vmin0, vmin1)));
+    st.max_val = std::max(st.max_val, vmaxvq_f32(vmaxq_f32(vmax0, vmax1)));
+    st.sum_squares += vaddvq_f64(vsum);
+    finishStats(st, n);
+    return st;
+}
+
+inline void scaleNeon(float* data, size_t n, float gain) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(data + i, vmulq_n_f32(vld1q_f32(data + i), gain));
+    }
+    scaleScalar(data + i, n - i, gain);
+}
+
+#endif
+
+struct KernelTable {
+    const char* name;
+    SampleStats (*stats)(const float*, size_t);
+    void (*scale)(float*, size_t, float);
+    void (*scale_copy)(const float*, float*, size_t, float);
+    SampleStats (*stats_pcm16)(const int16_t*, size_t);
+    void (*convert_pcm16)(const int16_t*, float*, size_t, float);
+    void (*to_pcm16)(const float*, int16_t*, size_t, DitherState*);
+    void (*to_pcm24)(const float*, int32_t*, size_t, DitherState*);
+};
+
+// Picks the widest instruction set the CPU supports, or the variant named by
+// `forced` ("scalar", "avx2", ...) if the CPU has it; an unsupported name
+// falls through to scalar. AUDIO_NORM_KERNELS sets `forced` for the process.
+inline KernelTable selectKernels(const char* forced) {
+    auto allowed = [forced](const char* name) {
+        return forced == nullptr || strcmp(forced, name) == 0;
+    };
+    (void)allowed;
+#if defined(AUDIO_KERNELS_X86)
+    __builtin_cpu_init();
+    if (allowed("avx512") && __builtin_cpu_supports("avx512f")) {
+        // The integer kernels have no AVX-512 variant; every AVX-512 CPU has AVX2
+        return {"avx512", statsAvx512, scaleAvx512, scaleCopyAvx2, statsPcm16Avx2, convertPcm16Avx2, floatToPcm16Avx2, floatToPcm24Avx2};
+    }
+    if (allowed("avx2") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {"avx2", statsAvx2, scaleAvx2, scaleCopyAvx2, statsPcm16Avx2, convertPcm16Avx2, floatToPcm16Avx2, floatToPcm24Avx2};
+    }
+#elif defined(AUDIO_KERNELS_NEON)
+    if (allowed("neon")) {
+        return {"neon", statsNeon, scaleNeon, scaleCopyScalar, statsPcm16Scalar, convertPcm16Scalar, floatToPcm16Scalar, floatToPcm24Scalar};
+    }
+#endif
+    return {"scalar", statsScalar, scaleScalar, scaleCopyScalar, statsPcm16Scalar, convertPcm16Scalar, floatToPcm16Scalar, floatToPcm24Scalar};
+}
+
+inline const KernelTable& activeKernels() {
+    static const KernelTable table = selectKernels(getenv("AUDIO_NORM_KERNELS"));
+    return table;
+}
+
+} // namespace audio_kernels
+
+// Single pass over `n` samples returning min, max, peak and sum of squares
+inline SampleStats computeSampleStats(const float* data, size_t n) {
+    return audio_kernels::activeKernels().stats(data, n);
+}
+
+// Multiplies `n` samples in place by `gain`
+inline void scaleSamples(float* data, size_t n, float gain) {
+    audio_kernels::activeKernels().scale(data, n, gain);
+}
+
+// dst = src * gain
+inline void scaleSamplesInto(const float* src, float* dst, size_t n, float gain) {
+    audio_kernels::activeKernels().scale_copy(src, dst, n, gain);
+}
+
+// Stats of 16-bit PCM, in the same [-1, 1) units as the float kernels
+inline SampleStats computeSampleStatsPcm16(const int16_t* data, size_t n) {
+    return audio_kernels::activeKernels().stats_pcm16(data, n);
+}
+
+// Stats of packed little-endian 24-bit PCM
+inline SampleStats computeSampleStatsPcm24(const uint8_t* data, size_t n) {
+    return audio_kernels::statsPcm24(data, n);
+}
+
+// dst = src / 32768 * gain
+inline void convertPcm16ToFloat(const int16_t* src, float* dst, size_t n, float gain) {
+    audio_kernels::activeKernels().convert_pcm16(src, dst, n, gain);
+}
+
+// dst = src / 8388608 * gain
+inline void convertPcm24ToFloat(const uint8_t* src, float* dst, size_t n, float gain) {
+    audio_kernels::convertPcm24(src, dst, n, gain);
+}
+
+// Rounds [-1, 1] floats to 16-bit PCM with clipping; dither may be null
+inline void convertFloatToPcm16(const float* src, int16_t* dst, size_t n, DitherState* dither = nullptr) {
+    audio_kernels::activeKernels().to_pcm16(src, dst, n, dither);
+}
+
+// Rounds [-1, 1] floats to 24-bit PCM held in the top bytes of an int32
+inline void convertFloatToPcm24(const float* src, int32_t* dst, size_t n, DitherState* dither = nullptr) {
+    audio_kernels::activeKernels().to_pcm24(src, dst, n, dither);
+}
+
+// Name of the kernel variant chosen at startup ("avx512", "avx2", "neon" or "scalar")
+inline const char* activeKernelName() {
+    return audio_kernels::activeKernels().name;
+}
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,504 @@
+#ifndef AUDIO_PACK_H
+#define AUDIO_PACK_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Packed output (--pack) for training pipelines: instead of one file per
+// input, the normalized samples are appended to a few large shard files and
+// pack.idx says where each input's samples are. A dataloader maps the index
+// and the shards once and slices samples out of them, with no open() per
+// clip.
+//
+// Layout, all little-endian:
+//   shard-NNNNN.pack  a 4096-byte header page (PackShardHeader), then one
+//                     record per input: its interleaved samples, headerless,
+//                     each record starting on a page boundary
+//   pack.idx          PackIndexHeader, PackIndexEntry[entries] sorted by
+//                     name, then the names (not NUL-terminated)
+
+const size_t PACK_PAGE = 4096;
+const size_t PACK_APPEND_BYTES = 4 << 20; // Buffered per record, written with one pwrite
+const unsigned PACK_VERSION = 1;
+
+enum PackSampleFormat : uint16_t {
+    PackFloat32 = 1,
+    PackPcm16 = 2,
+    PackPcm24 = 3
+};
+
+inline size_t packBytesPerSample(uint16_t format) {
+    return format == PackPcm16 ? 2 : format == PackPcm24 ? 3 : 4;
+}
+
+struct PackShardHeader {
+    char magic[8]; // "AUDPACK1"
+    uint32_t version;
+    uint32_t shard;
+};
+
+struct PackIndexHeader {
+    char magic[8]; // "AUDPIDX1"
+    uint32_t version;
+    uint32_t shards;
+    uint64_t entries;
+    uint64_t names_bytes;
+    uint8_t reserved[32];
+};
+
+struct PackIndexEntry {
+    uint64_t offset;      // Of the samples in the shard, a multiple of PACK_PAGE
+    uint64_t bytes;       // Of the samples
+    uint64_t frames;
+    uint64_t name_offset; // In the names that follow the entries
+    uint32_t shard;
+    uint32_t sample_rate;
+    uint32_t name_len;
+    uint16_t channels;
+    uint16_t format;      // PackSampleFormat
+    float original_peak;  // Of the input, before normalization
+    uint8_t reserved[12];
+};
+
+static_assert(sizeof(PackShardHeader) == 16, "shard header layout");
+static_assert(sizeof(PackIndexHeader) == 64, "index header layout");
+static_assert(sizeof(PackIndexEntry) == 64, "index entry layout");
+
+inline std::string packShardName(uint32_t shard) {
+    char name[32];
+    snprintf(name, sizeof(name), "shard-%05u.pack", shard);
+    return name;
+}
+
+inline uint64_t packAlign(uint64_t offset) {
+    return (offset + PACK_PAGE - 1) / PACK_PAGE * PACK_PAGE;
+}
+
+// A shard file being filled; owned by PackWriter
+struct PackShard {
+    int fd = -1;
+    uint32_t number = 0;
+    uint64_t end = PACK_PAGE; // Where the next record starts
+};
+
+class PackWriter;
+
+// One input's samples being appended to a shard. Writes are collected into
+// PACK_APPEND_BYTES and go out as single large pwrites at the record's
+// offset; the buffer is kept from record to record.
+class PackRecord {
+private:
+    friend class PackWriter;
+    PackShard* shard = nullptr;
+    uint64_t offset = 0; // Record start in the shard
+    uint64_t length = 0; // Bytes of samples so far
+    uint64_t pos = 0;    // Write position in the record
+    std::vector<uint8_t> pending;
+    uint64_t pending_at = 0; // Record position of pending[0]
+    bool failed = false;
+    uint32_t sample_rate = 0;
+    uint16_t channels = 0;
+    uint16_t format = PackFloat32;
+
+public:
+    bool isOpen() const {
+        return shard != nullptr;
+    }
+
+    int64_t write(const void* data, int64_t count);
+
+    bool flush();
+
+    int64_t seek(int64_t to, int whence) {
+        int64_t target = whence == SEEK_SET ? to : whence == SEEK_CUR ? pos + to : length + to;
+        if (target < 0) {
+            return -1;
+        }
+        pos = target;
+        return target;
+    }
+
+    int64_t tell() const {
+        return pos;
+    }
+
+    int64_t size() const {
+        return length;
+    }
+
+    // Frees the append buffer, for a caller that must not hold it between records
+    void releaseBuffer() {
+        std::vector<uint8_t>().swap(pending);
+    }
+};
+
+inline int64_t PackRecord::write(const void* data, int64_t count) {
+    if (failed || count < 0) {
+        return -1;
+    }
+    if (pos != pending_at + pending.size() && !flush()) {
+        return -1;
+    }
+    if (pending.empty()) {
+        pending_at = pos;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    pending.insert(pending.end(), bytes, bytes + count);
+    pos += count;
+    length = std::max(length, pos);
+    if (pending.size() >= PACK_APPEND_BYTES && !flush()) {
+        return -1;
+    }
+    return count;
+}
+
+inline bool PackRecord::flush() {
+    size_t done = 0;
+    while (!failed && done < pending.size()) {
+        ssize_t n = pwrite(shard->fd, pending.data() + done, pending.size() - done, offset + pending_at + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            failed = true;
+            break;
+        }
+        done += n;
+    }
+    pending.clear();
+    pending_at = pos;
+    return !failed;
+}
+
+// The shards and index of one --pack run. Each record checks out a shard no
+// other record is writing, so records are appended sequentially without
+// holding the lock, and concurrent writers each fill their own shard. A
+// shard past the size limit takes no further records. Thread-safe.
+class PackWriter {
+private:
+    std::string dir;
+    uint64_t shard_limit = 0;
+    std::vector<std::unique_ptr<PackShard>> shards;
+    std::vector<PackShard*> idle; // Open and below the limit, not being written
+    std::vector<PackIndexEntry> entries;
+    std::vector<std::string> names;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    // Shard for the next record; called with the lock held
+    PackShard* checkout() {
+        if (!idle.empty()) {
+            PackShard* shard = idle.back();
+            idle.pop_back();
+            return shard;
+        }
+        std::unique_ptr<PackShard> shard(new PackShard());
+        shard->number = shards.size();
+        std::string path = dir + "/" + packShardName(shard->number);
+        shard->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (shard->fd < 0) {
+            return nullptr;
+        }
+        PackShardHeader header = {};
+        memcpy(header.magic, "AUDPACK1", 8);
+        header.version = PACK_VERSION;
+        header.shard = shard->number;
+        if (pwrite(shard->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            ::close(shard->fd);
+            return nullptr;
+        }
+        shards.push_back(std::move(shard));
+        return shards.back().get();
+    }
+
+    // Returns the record's shard for the next record, or seals it once it
+    // reached the limit; called with the lock held
+    bool release(PackRecord& record) {
+        PackShard* shard = record.shard;
+        record.shard = nullptr;
+        if (shard->end >= shard_limit) {
+            return seal(*shard);
+        }
+        idle.push_back(shard);
+        return true;
+    }
+
+    // Pads a full shard to a whole page and closes it
+    static bool seal(PackShard& shard) {
+        bool ok = ftruncate(shard.fd, shard.end) == 0;
+        ok = ::close(shard.fd) == 0 && ok;
+        shard.fd = -1;
+        return ok;
+    }
+
+public:
+    PackWriter() = default;
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    ~PackWriter() {
+        for (auto& shard : shards) {
+            if (shard->fd >= 0) {
+                ::close(shard->fd);
+            }
+        }
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Shards go to `directory`, which must exist; a shard takes no more
+    // records once it holds `shard_bytes`
+    void open(const std::string& directory, uint64_t shard_bytes) {
+        dir = directory;
+        shard_limit = std::max<uint64_t>(shard_bytes, PACK_PAGE);
+    }
+
+    const std::string& directory() const {
+        return dir;
+    }
+
+    // Starts appending a record of `channels` x `format` samples. False if
+    // no shard could be created.
+    bool begin(PackRecord& record, uint32_t sample_rate, uint16_t channels, uint16_t format) {
+        pthread_mutex_lock(&mutex);
+        PackShard* shard = checkout();
+        pthread_mutex_unlock(&mutex);
+        if (shard == nullptr) {
+            return false;
+        }
+        record.shard = shard;
+        record.offset = shard->end;
+        record.length = record.pos = record.pending_at = 0;
+        record.pending.clear();
+        record.pending.reserve(PACK_APPEND_BYTES + PACK_PAGE);
+        record.failed = false;
+        record.sample_rate = sample_rate;
+        record.channels = channels;
+        record.format = format;
+        return true;
+    }
+
+    // Ends the record and indexes it as `name`. A failed record is not
+    // indexed and its space is reused by the shard's next record.
+    bool commit(PackRecord& record, const std::string& name, float original_peak) {
+        bool ok = record.flush();
+        pthread_mutex_lock(&mutex);
+        if (ok) {
+            PackIndexEntry entry = {};
+            entry.offset = record.offset;
+            entry.bytes = record.length;
+            entry.frames = record.length / (record.channels * packBytesPerSample(record.format));
+            entry.shard = record.shard->number;
+            entry.sample_rate = record.sample_rate;
+            entry.channels = record.channels;
+            entry.format = record.format;
+            entry.original_peak = original_peak;
+            entries.push_back(entry);
+            names.push_back(name);
+            record.shard->end = packAlign(record.offset + record.length);
+        }
+        ok = release(record) && ok;
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    // Drops a record that was begun but not written in full; its space is
+    // reused by the shard's next record
+    void abandon(PackRecord& record) {
+        record.pending.clear();
+        pthread_mutex_lock(&mutex);
+        release(record);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    size_t shardCount() const {
+        return shards.size();
+    }
+
+    size_t recordCount() const {
+        return entries.size();
+    }
+
+    // Seals the open shards and writes pack.idx, through a temporary file
+    // renamed into place. Call once every record was committed.
+    bool finish() {
+        pthread_mutex_lock(&mutex);
+        bool ok = true;
+        for (PackShard* shard : idle) {
+            ok = seal(*shard) && ok;
+        }
+        idle.clear();
+
+        std::vector<size_t> order(entries.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return names[a] < names[b]; });
+        std::vector<PackIndexEntry> sorted;
+        std::string blob;
+        for (size_t i : order) {
+            PackIndexEntry entry = entries[i];
+            entry.name_offset = blob.size();
+            entry.name_len = names[i].size();
+            blob += names[i];
+            sorted.push_back(entry);
+        }
+        PackIndexHeader header = {};
+        memcpy(header.magic, "AUDPIDX1", 8);
+        header.version = PACK_VERSION;
+        header.shards = shards.size();
+        header.entries = sorted.size();
+        header.names_bytes = blob.size();
+
+        std::string path = dir + "/pack.idx";
+        std::string tmp = path + ".tmp";
+        FILE* out = fopen(tmp.c_str(), "wb");
+        if (out == nullptr) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        ok = fwrite(&header, sizeof(header), 1, out) == 1 && ok;
+        ok = (sorted.empty() || fwrite(sorted.data(), sizeof(PackIndexEntry), sorted.size(), out) == sorted.size()) && ok;
+        ok = fwrite(blob.data(), 1, blob.size(), out) == blob.size() && ok;
+        ok = fclose(out) == 0 && ok;
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+};
+
+// Read side, for tools and dataloaders: maps pack.idx and every shard, and
+// hands out pointers to a record's samples without copying
+class PackReader {
+private:
+    struct Mapping {
+        void* base = MAP_FAILED;
+        size_t size = 0;
+    };
+    Mapping index;
+    std::vector<Mapping> shard_maps;
+    const PackIndexHeader* header = nullptr;
+    const PackIndexEntry* table = nullptr;
+    const char* name_data = nullptr;
+
+    static bool mapFile(const std::string& path, Mapping& m) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat sb;
+        bool ok = fstat(fd, &sb) == 0 && sb.st_size > 0;
+        if (ok) {
+            m.size = sb.st_size;
+            m.base = mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+            ok = m.base != MAP_FAILED;
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    static void unmap(Mapping& m) {
+        if (m.base != MAP_FAILED) {
+            munmap(m.base, m.size);
+        }
+        m = Mapping();
+    }
+
+public:
+    PackReader() = default;
+    PackReader(const PackReader&) = delete;
+    PackReader& operator=(const PackReader&) = delete;
+
+    ~PackReader() {
+        close();
+    }
+
+    void close() {
+        unmap(index);
+        for (Mapping& m : shard_maps) {
+            unmap(m);
+        }
+        shard_maps.clear();
+        header = nullptr;
+        table = nullptr;
+        name_data = nullptr;
+    }
+
+    // Maps the pack in `dir`; false if the index is missing or malformed
+    bool open(const std::string& dir) {
+        close();
+        if (!mapFile(dir + "/pack.idx", index) || index.size < sizeof(PackIndexHeader)) {
+            close();
+            return false;
+        }
+        header = static_cast<const PackIndexHeader*>(index.base);
+        uint64_t table_bytes = header->entries * sizeof(PackIndexEntry);
+        if (memcmp(header->magic, "AUDPIDX1", 8) != 0 || header->version != PACK_VERSION ||
+            index.size < sizeof(PackIndexHeader) + table_bytes + header->names_bytes) {
+            close();
+            return false;
+        }
+        table = reinterpret_cast<const PackIndexEntry*>(header + 1);
+        name_data = reinterpret_cast<const char*>(table) + table_bytes;
+        shard_maps.resize(header->shards);
+        for (uint32_t s = 0; s < header->shards; ++s) {
+            if (!mapFile(dir + "/" + packShardName(s), shard_maps[s]) ||
+                memcmp(shard_maps[s].base, "AUDPACK1", 8) != 0) {
+                close();
+                return false;
+            }
+        }
+        for (size_t i = 0; i < size(); ++i) {
+            const PackIndexEntry& e = table[i];
+            if (e.shard >= shard_maps.size() || e.offset + e.bytes > shard_maps[e.shard].size ||
+                e.name_offset + e.name_len > header->names_bytes) {
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t size() const {
+        return header ? header->entries : 0;
+    }
+
+    const PackIndexEntry& entry(size_t i) const {
+        return table[i];
+    }
+
+    std::string name(size_t i) const {
+        return std::string(name_data + table[i].name_offset, table[i].name_len);
+    }
+
+    // Index of the record named `record`, or size() if there is none
+    size_t find(const std::string& record) const {
+        size_t lo = 0, hi = size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (name(mid) < record) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo < size() && name(lo) == record ? lo : size();
+    }
+
+    // First sample byte of record `i`, on the shard's mapped pages
+    const uint8_t* samples(size_t i) const {
+        const PackIndexEntry& e = table[i];
+        return static_cast<const uint8_t*>(shard_maps[e.shard].base) + e.offset;
+    }
+};
+
+#endif // AUDIO_PACK_H
@@ -0,0 +1,136 @@
+#include "audionorm.h"
+
+#include <cmath>
+#include "audio_kernels.h"
+
+namespace audionorm {
+
+namespace {
+
+// Int16 samples are scaled through a small float block on the stack
+const size_t CONVERT_BLOCK = 4096;
+
+Stats toStats(const SampleStats& samples) {
+    Stats stats;
+    if (samples.count == 0) {
+        return stats;
+    }
+    stats.min_val = samples.min_val;
+    stats.max_val = samples.max_val;
+    stats.peak = samples.peak;
+    stats.rms = static_cast<float>(std::sqrt(samples.sum_squares / samples.count));
+    stats.sample_count = samples.count;
+    return stats;
+}
+
+float gainFor(const Stats& stats, float target_peak) {
+    if (stats.peak == 0.0f || !(target_peak > 0.0f) || !std::isfinite(target_peak)) {
+        return 1.0f;
+    }
+    return target_peak / stats.peak;
+}
+
+SampleStats rawStats(const float* samples, size_t count) {
+    return computeSampleStats(samples, count);
+}
+
+SampleStats rawStats(const int16_t* samples, size_t count) {
+    return computeSampleStatsPcm16(samples, count);
+}
+
+template <typename Sample>
+SampleStats planarStats(const Sample* const* channels, int channel_count, size_t frames) {
+    SampleStats total;
+    for (int c = 0; c < channel_count; ++c) {
+        mergeSampleStats(total, rawStats(channels[c], frames));
+    }
+    return total;
+}
+
+void scalePcm16(int16_t* samples, size_t count, float gain, DitherState* dither) {
+    float block[CONVERT_BLOCK];
+    for (size_t i = 0; i < count; i += CONVERT_BLOCK) {
+        size_t n = std::min(CONVERT_BLOCK, count - i);
+        convertPcm16ToFloat(samples + i, block, n, gain);
+        convertFloatToPcm16(block, samples + i, n, dither);
+    }
+}
+
+} // namespace
+
+Stats analyze(const float* samples, size_t count) {
+    return toStats(rawStats(samples, count));
+}
+
+Stats analyze(const int16_t* samples, size_t count) {
+    return toStats(rawStats(samples, count));
+}
+
+Stats analyzePlanar(const float* const* channels, int channel_count, size_t frames) {
+    return toStats(planarStats(channels, channel_count, frames));
+}
+
+Stats analyzePlanar(const int16_t* const* channels, int channel_count, size_t frames) {
+    return toStats(planarStats(channels, channel_count, frames));
+}
+
+Result normalize(float* samples, size_t count, float target_peak) {
+    Result result;
+    result.original = analyze(samples, count);
+    result.gain = gainFor(result.original, target_peak);
+    if (result.gain != 1.0f) {
+        scaleSamples(samples, count, result.gain);
+    }
+    return result;
+}
+
+Result normalize(int16_t* samples, size_t count, float target_peak, bool dither) {
+    Result result;
+    result.original = analyze(samples, count);
+    result.gain = gainFor(result.original, target_peak);
+    if (result.gain != 1.0f) {
+        applyGain(samples, count, result.gain, dither);
+    }
+    return result;
+}
+
+Result normalizePlanar(float* const* channels, int channel_count, size_t frames, float target_peak) {
+    Result result;
+    result.original = analyzePlanar(channels, channel_count, frames);
+    result.gain = gainFor(result.original, target_peak);
+    if (result.gain != 1.0f) {
+        for (int c = 0; c < channel_count; ++c) {
+            scaleSamples(channels[c], frames, result.gain);
+        }
+    }
+    return result;
+}
+
+Result normalizePlanar(int16_t* const* channels, int channel_count, size_t frames, float target_peak, bool dither) {
+    Result result;
+    result.original = analyzePlanar(channels, channel_count, frames);
+    result.gain = gainFor(result.original, target_peak);
+    if (result.gain != 1.0f) {
+        // One generator across channels, so they do not get identical noise
+        DitherState state;
+        for (int c = 0; c < channel_count; ++c) {
+            scalePcm16(channels[c], frames, result.gain, dither ? &state : nullptr);
+        }
+    }
+    return result;
+}
+
+void applyGain(float* samples, size_t count, float gain) {
+    scaleSamples(samples, count, gain);
+}
+
+void applyGain(int16_t* samples, size_t count, float gain, bool dither) {
+    DitherState state;
+    scalePcm16(samples, count, gain, dither ? &state : nullptr);
+}
+
+const char* kernelName() {
+    return activeKernelName();
+}
+
+} // namespace audionorm
@@ -0,0 +1,66 @@
+#ifndef AUDIONORM_H
+#define AUDIONORM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// libaudionorm: peak normalization of caller-owned sample buffers, built by
+// `make lib`. Nothing here opens files, logs or allocates on the heap; every
+// call works in place on the memory it is given and is safe to run from any
+// number of threads at once.
+//
+// Interleaved buffers are passed as one pointer and the total sample count
+// (frames * channels). Planar buffers are passed as one pointer per channel.
+// Float samples use [-1, 1] full scale; int16 samples are read as
+// value / 32768, like the command-line tool does. All channels share one
+// gain, so the balance between them is kept.
+
+#if defined(__GNUC__)
+#define AUDIONORM_API __attribute__((visibility("default")))
+#else
+#define AUDIONORM_API
+#endif
+
+namespace audionorm {
+
+// The same statistics the tool logs for each file
+struct Stats {
+    float min_val = 0.0f;
+    float max_val = 0.0f;
+    float peak = 0.0f; // Largest absolute sample value
+    float rms = 0.0f;
+    size_t sample_count = 0;
+};
+
+struct Result {
+    Stats original; // Of the input, before the gain was applied
+    float gain = 1.0f; // 1 when the input is silent or the target is invalid
+};
+
+AUDIONORM_API Stats analyze(const float* samples, size_t count);
+AUDIONORM_API Stats analyze(const int16_t* samples, size_t count);
+AUDIONORM_API Stats analyzePlanar(const float* const* channels, int channel_count, size_t frames);
+AUDIONORM_API Stats analyzePlanar(const int16_t* const* channels, int channel_count, size_t frames);
+
+// Scales the samples so their peak reaches `target_peak` (> 0). Int16
+// results are rounded to nearest and clipped at full scale; `dither` adds
+// TPDF dither first, with a fixed seed so results are reproducible.
+AUDIONORM_API Result normalize(float* samples, size_t count, float target_peak = 1.0f);
+AUDIONORM_API Result normalize(int16_t* samples, size_t count, float target_peak = 1.0f, bool dither = false);
+AUDIONORM_API Result normalizePlanar(float* const* channels, int channel_count, size_t frames,
+                                     float target_peak = 1.0f);
+AUDIONORM_API Result normalizePlanar(int16_t* const* channels, int channel_count, size_t frames,
+                                     float target_peak = 1.0f, bool dither = false);
+
+// Multiplies the samples by `gain`, e.g. one computed from analyze() over
+// several buffers that must stay level-matched
+AUDIONORM_API void applyGain(float* samples, size_t count, float gain);
+AUDIONORM_API void applyGain(int16_t* samples, size_t count, float gain, bool dither = false);
+
+// Name of the SIMD kernels in use ("avx512", "avx2", "neon" or "scalar");
+// AUDIO_NORM_KERNELS overrides the choice as it does for the tool
+AUDIONORM_API const char* kernelName();
+
+} // namespace audionorm
+
+#endif // AUDIONORM_H
@@ -0,0 +1,113 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <utility>
+#include <pthread.h>
+
+// Blocking FIFO between pipeline stages, bounded both by item count and by
+// the bytes its items hold. A push that would exceed the byte budget waits
+// for consumers, except into an empty queue, so one oversized item can still
+// pass instead of deadlocking the pipeline.
+template <typename T>
+class BoundedQueue {
+private:
+    struct Entry {
+        T item;
+        size_t bytes;
+    };
+
+    std::deque<Entry> entries;
+    size_t max_items;
+    size_t max_bytes;
+    size_t queued_bytes = 0;
+    bool closed = false;
+
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+
+    bool hasRoom(size_t bytes) const {
+        if (entries.empty()) {
+            return true;
+        }
+        return entries.size() < max_items && queued_bytes + bytes <= max_bytes;
+    }
+
+public:
+    BoundedQueue(size_t item_limit, size_t byte_limit)
+        : max_items(item_limit ? item_limit : 1), max_bytes(byte_limit) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    ~BoundedQueue() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&not_full);
+        pthread_cond_destroy(&not_empty);
+    }
+
+    // Blocks until there is room. Returns false if the queue was closed.
+    bool push(T item, size_t bytes = 0) {
+        pthread_mutex_lock(&mutex);
+        while (!closed && !hasRoom(bytes)) {
+            pthread_cond_wait(&not_full, &mutex);
+        }
+        if (closed) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        entries.push_back({std::move(item), bytes});
+        queued_bytes += bytes;
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+
+    // Blocks until an item is available. Returns false once the queue is
+    // closed and drained.
+    bool pop(T& item) {
+        pthread_mutex_lock(&mutex);
+        while (entries.empty() && !closed) {
+            pthread_cond_wait(&not_empty, &mutex);
+        }
+        if (entries.empty()) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        item = std::move(entries.front().item);
+        queued_bytes -= entries.front().bytes;
+        entries.pop_front();
+        // Several small pushes may fit in the space one large item freed
+        pthread_cond_broadcast(&not_full);
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+
+    // Takes an item only if one is queued right now; for gathering batches
+    bool tryPop(T& item) {
+        pthread_mutex_lock(&mutex);
+        if (entries.empty()) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        item = std::move(entries.front().item);
+        queued_bytes -= entries.front().bytes;
+        entries.pop_front();
+        pthread_cond_broadcast(&not_full);
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+
+    // No more pushes; consumers drain what is left
+    void close() {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&not_full);
+        pthread_cond_broadcast(&not_empty);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,233 @@
+#ifndef CHANNEL_KERNELS_H
+#define CHANNEL_KERNELS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "audio_kernels.h"
+#include "wav_mmap.h"
+
+// Per-channel stats and gains on interleaved frames. Each kernel is a
+// template over the source encoding and the channel count (1, 2 or any),
+// and channelKernelsFor() picks the instantiation once per file. With the
+// channel count fixed at compile time the frame loop walks GROUP frames at
+// a time through accumulators laid out like the frames themselves (lane l
+// holds channel l % C), so the inner loops have constant trip counts that
+// the compiler unrolls and vectorizes. Mono reuses the flat SIMD kernels.
+
+namespace channel_kernels {
+
+// Frames per accumulator group, and per flush of the float sums to double
+const size_t GROUP = 8;
+const size_t FLUSH_FRAMES = 4096;
+
+// Source encodings: load one sample as float in [-1, 1), as libsndfile does
+struct Pcm16In {
+    static const size_t BYTES = 2;
+    static float load(const uint8_t* p) {
+        int16_t v;
+        memcpy(&v, p, sizeof(v));
+        return v * audio_kernels::PCM16_SCALE;
+    }
+    static SampleStats flatStats(const uint8_t* src, size_t n) {
+        return computeSampleStatsPcm16(reinterpret_cast<const int16_t*>(src), n);
+    }
+    static void flatConvert(const uint8_t* src, float* dst, size_t n, float gain) {
+        convertPcm16ToFloat(reinterpret_cast<const int16_t*>(src), dst, n, gain);
+    }
+};
+
+struct Pcm24In {
+    static const size_t BYTES = 3;
+    static float load(const uint8_t* p) {
+        return audio_kernels::pcm24At(p) * audio_kernels::PCM24_SCALE;
+    }
+    static SampleStats flatStats(const uint8_t* src, size_t n) {
+        return computeSampleStatsPcm24(src, n);
+    }
+    static void flatConvert(const uint8_t* src, float* dst, size_t n, float gain) {
+        convertPcm24ToFloat(src, dst, n, gain);
+    }
+};
+
+struct FloatIn {
+    static const size_t BYTES = 4;
+    static float load(const uint8_t* p) {
+        float v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static SampleStats flatStats(const uint8_t* src, size_t n) {
+        return computeSampleStats(reinterpret_cast<const float*>(src), n);
+    }
+    static void flatConvert(const uint8_t* src, float* dst, size_t n, float gain) {
+        scaleSamplesInto(reinterpret_cast<const float*>(src), dst, n, gain);
+    }
+};
+
+// Runtime channel count, one channel at a time per frame
+template <class In>
+void statsAny(const uint8_t* src, size_t frames, int channels, SampleStats* out) {
+    for (int c = 0; c < channels; ++c) {
+        out[c] = SampleStats();
+    }
+    for (size_t f = 0; f < frames; ++f) {
+        const uint8_t* frame = src + f * channels * In::BYTES;
+        for (int c = 0; c < channels; ++c) {
+            float x = In::load(frame + c * In::BYTES);
+            out[c].min_val = std::min(out[c].min_val, x);
+            out[c].max_val = std::max(out[c].max_val, x);
+            out[c].sum_squares += (double)x * x;
+        }
+    }
+    for (int c = 0; c < channels; ++c) {
+        audio_kernels::finishStats(out[c], frames);
+    }
+}
+
+template <class In, int C>
+void statsFixed(const uint8_t* src, size_t frames, SampleStats* out) {
+    const size_t LANES = GROUP * C;
+    float mins[LANES], maxs[LANES], sums[LANES];
+    double squares[C];
+    std::fill(mins, mins + LANES, INFINITY);
+    std::fill(maxs, maxs + LANES, -INFINITY);
+    std::fill(squares, squares + C, 0.0);
+    size_t f = 0;
+    while (f + GROUP <= frames) {
+        std::fill(sums, sums + LANES, 0.0f);
+        size_t end = std::min(frames, f + FLUSH_FRAMES);
+        for (; f + GROUP <= end; f += GROUP) {
+            const uint8_t* group = src + f * C * In::BYTES;
+            for (size_t l = 0; l < LANES; ++l) {
+                float x = In::load(group + l * In::BYTES);
+                mins[l] = std::min(mins[l], x);
+                maxs[l] = std::max(maxs[l], x);
+                sums[l] += x * x;
+            }
+        }
+        for (size_t l = 0; l < LANES; ++l) {
+            squares[l % C] += sums[l];
+        }
+    }
+    for (; f < frames; ++f) {
+        for (int c = 0; c < C; ++c) {
+            float x = In::load(src + (f * C + c) * In::BYTES);
+            mins[c] = std::min(mins[c], x);
+            maxs[c] = std::max(maxs[c], x);
+            squares[c] += (double)x * x;
+        }
+    }
+    for (int c = 0; c < C; ++c) {
+        out[c] = SampleStats();
+        for (size_t l = c; l < LANES; l += C) {
+            out[c].min_val = std::min(out[c].min_val, mins[l]);
+            out[c].max_val = std::max(out[c].max_val, maxs[l]);
+        }
+        out[c].sum_squares = squares[c];
+        audio_kernels::finishStats(out[c], frames);
+    }
+}
+
+template <class In, int C>
+void stats(const uint8_t* src, size_t frames, int channels, SampleStats* out) {
+    if constexpr (C == 0) {
+        statsAny<In>(src, frames, channels, out);
+    } else if constexpr (C == 1) {
+        out[0] = In::flatStats(src, frames);
+    } else {
+        statsFixed<In, C>(src, frames, out);
+    }
+}
+
+// dst = src * gains[channel], converted to float
+template <class In, int C>
+void convert(const uint8_t* __restrict src, float* __restrict dst, size_t frames, int channels, const float* gains) {
+    size_t f = 0;
+    if constexpr (C == 1) {
+        In::flatConvert(src, dst, frames, gains[0]);
+        return;
+    } else if constexpr (C > 1) {
+        const size_t LANES = GROUP * C;
+        float pattern[LANES];
+        for (size_t l = 0; l < LANES; ++l) {
+            pattern[l] = gains[l % C];
+        }
+        for (; f + GROUP <= frames; f += GROUP) {
+            const uint8_t* group = src + f * C * In::BYTES;
+            float* out = dst + f * C;
+            for (size_t l = 0; l < LANES; ++l) {
+                out[l] = In::load(group + l * In::BYTES) * pattern[l];
+            }
+        }
+    }
+    for (; f < frames; ++f) {
+        for (int c = 0; c < channels; ++c) {
+            size_t i = f * channels + c;
+            dst[i] = In::load(src + i * In::BYTES) * gains[c];
+        }
+    }
+}
+
+// data *= gains[channel], in place
+template <int C>
+void scale(float* data, size_t frames, int channels, const float* gains) {
+    size_t f = 0;
+    if constexpr (C == 1) {
+        scaleSamples(data, frames, gains[0]);
+        return;
+    } else if constexpr (C > 1) {
+        const size_t LANES = GROUP * C;
+        float pattern[LANES];
+        for (size_t l = 0; l < LANES; ++l) {
+            pattern[l] = gains[l % C];
+        }
+        for (; f + GROUP <= frames; f += GROUP) {
+            float* group = data + f * C;
+            for (size_t l = 0; l < LANES; ++l) {
+                group[l] *= pattern[l];
+            }
+        }
+    }
+    for (; f < frames; ++f) {
+        for (int c = 0; c < channels; ++c) {
+            data[f * channels + c] *= gains[c];
+        }
+    }
+}
+
+} // namespace channel_kernels
+
+// The per-channel kernels for one file's layout
+struct ChannelKernels {
+    // out[c] = stats of channel c over `frames` frames
+    void (*stats)(const uint8_t* src, size_t frames, int channels, SampleStats* out);
+    // dst = src * gains[c], as float
+    void (*convert)(const uint8_t* src, float* dst, size_t frames, int channels, const float* gains);
+    // Float data *= gains[c] in place
+    void (*scale)(float* data, size_t frames, int channels, const float* gains);
+};
+
+// Instantiation for a source encoding and channel count; decoded (float)
+// buffers use WavSampleFormat::Float32
+inline ChannelKernels channelKernelsFor(WavSampleFormat format, int channels) {
+    using namespace channel_kernels;
+    switch (format) {
+        case WavSampleFormat::Pcm16:
+            if (channels == 1) return {stats<Pcm16In, 1>, convert<Pcm16In, 1>, scale<1>};
+            if (channels == 2) return {stats<Pcm16In, 2>, convert<Pcm16In, 2>, scale<2>};
+            return {stats<Pcm16In, 0>, convert<Pcm16In, 0>, scale<0>};
+        case WavSampleFormat::Pcm24:
+            if (channels == 1) return {stats<Pcm24In, 1>, convert<Pcm24In, 1>, scale<1>};
+            if (channels == 2) return {stats<Pcm24In, 2>, convert<Pcm24In, 2>, scale<2>};
+            return {stats<Pcm24In, 0>, convert<Pcm24In, 0>, scale<0>};
+        case WavSampleFormat::Float32:
+            break;
+    }
+    if (channels == 1) return {stats<FloatIn, 1>, convert<FloatIn, 1>, scale<1>};
+    if (channels == 2) return {stats<FloatIn, 2>, convert<FloatIn, 2>, scale<2>};
+    return {stats<FloatIn, 0>, convert<FloatIn, 0>, scale<0>};
+}
+
+#endif // CHANNEL_KERNELS_H
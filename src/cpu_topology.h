@@ -0,0 +1,217 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+// How worker threads are placed on CPUs
+enum class PinMode {
+    None,  // Let the scheduler decide
+    Cores, // One worker per physical core, hyperthread siblings only once every core has one
+    Numa   // Spread workers round robin across NUMA nodes, free to move within a node
+};
+
+namespace cpu_topology {
+
+inline bool readFirstLine(const std::string& path, std::string& line) {
+    std::ifstream in(path);
+    return in && std::getline(in, line);
+}
+
+inline int readInt(const std::string& path, int fallback) {
+    std::string line;
+    if (!readFirstLine(path, line)) {
+        return fallback;
+    }
+    try {
+        return std::stoi(line);
+    } catch (...) {
+        return fallback;
+    }
+}
+
+// Parses a kernel CPU list such as "0-3,8,10-11"
+inline std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (...) {
+            // Ignore malformed entries
+        }
+    }
+    return cpus;
+}
+
+// CPUs this process is allowed to run on
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < n; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// CPU limit imposed by a container's cgroup quota, or 0 when unlimited
+inline int cgroupCpuLimit() {
+    std::string line;
+    double quota = -1.0, period = 0.0;
+    // cgroup v2: "<quota> <period>" or "max <period>"
+    if (readFirstLine("/sys/fs/cgroup/cpu.max", line)) {
+        std::stringstream ss(line);
+        std::string q;
+        ss >> q >> period;
+        if (q != "max") {
+            try {
+                quota = std::stod(q);
+            } catch (...) {
+                quota = -1.0;
+            }
+        }
+    } else {
+        // cgroup v1
+        quota = readInt("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", -1);
+        period = readInt("/sys/fs/cgroup/cpu/cpu.cfs_period_us", 0);
+    }
+    if (quota <= 0.0 || period <= 0.0) {
+        return 0;
+    }
+    return std::max(1, static_cast<int>(std::ceil(quota / period)));
+}
+
+} // namespace cpu_topology
+
+// Default worker count: the CPUs we may run on, capped by any cgroup quota
+inline int defaultWorkerCount() {
+    int cpus = static_cast<int>(cpu_topology::allowedCpus().size());
+    int limit = cpu_topology::cgroupCpuLimit();
+    if (limit > 0) {
+        cpus = std::min(cpus, limit);
+    }
+    return std::max(1, cpus);
+}
+
+// CPU set for each of `num_workers` workers under `mode`, or an empty vector
+// when pinning is off. Missing sysfs topology degrades to one core per CPU.
+inline std::vector<std::vector<int>> workerCpuPlan(int num_workers, PinMode mode) {
+    std::vector<std::vector<int>> plan;
+    if (mode == PinMode::None || num_workers < 1) {
+        return plan;
+    }
+    std::vector<int> allowed = cpu_topology::allowedCpus();
+    const std::string sys = "/sys/devices/system/";
+
+    if (mode == PinMode::Numa) {
+        std::vector<std::vector<int>> nodes;
+        if (DIR* dir = opendir((sys + "node").c_str())) {
+            std::vector<int> ids;
+            while (dirent* ent = readdir(dir)) {
+                std::string name = ent->d_name;
+                if (name.rfind("node", 0) == 0 && name.size() > 4 && isdigit(static_cast<unsigned char>(name[4]))) {
+                    ids.push_back(std::stoi(name.substr(4)));
+                }
+            }
+            closedir(dir);
+            std::sort(ids.begin(), ids.end());
+            for (int id : ids) {
+                std::string line;
+                if (!cpu_topology::readFirstLine(sys + "node/node" + std::to_string(id) + "/cpulist", line)) {
+                    continue;
+                }
+                std::vector<int> cpus;
+                for (int cpu : cpu_topology::parseCpuList(line)) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty()) {
+                    nodes.push_back(cpus);
+                }
+            }
+        }
+        if (nodes.empty()) {
+            nodes.push_back(allowed); // Not a NUMA system: a single node
+        }
+        for (int i = 0; i < num_workers; ++i) {
+            plan.push_back(nodes[i % nodes.size()]);
+        }
+        return plan;
+    }
+
+    // Group logical CPUs by (package, core); the first sibling of every core
+    // comes before any second sibling, so workers land on distinct cores first.
+    std::map<std::pair<int, int>, std::vector<int>> cores;
+    for (int cpu : allowed) {
+        std::string topo = sys + "cpu/cpu" + std::to_string(cpu) + "/topology/";
+        int package = cpu_topology::readInt(topo + "physical_package_id", 0);
+        int core = cpu_topology::readInt(topo + "core_id", cpu);
+        cores[{package, core}].push_back(cpu);
+    }
+    std::vector<int> order;
+    for (size_t sibling = 0; order.size() < allowed.size(); ++sibling) {
+        for (const auto& entry : cores) {
+            if (sibling < entry.second.size()) {
+                order.push_back(entry.second[sibling]);
+            }
+        }
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        plan.push_back({order[i % order.size()]});
+    }
+    return plan;
+}
+
+// Restricts the calling thread to `cpus`; a no-op for an empty set
+inline bool pinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return true;
+#endif
+}
+
+#endif // CPU_TOPOLOGY_H
@@ -0,0 +1,594 @@
+#ifndef GPU_OFFLOAD_H
+#define GPU_OFFLOAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include "audio_kernels.h"
+
+// OpenCL through dlopen, so neither the CL headers nor libOpenCL are needed
+// to build, and a machine without them simply keeps the CPU kernels. Only
+// the handful of OpenCL 1.2 entry points used below are declared.
+namespace ocl {
+
+typedef int32_t cl_int;
+typedef uint32_t cl_uint;
+typedef uint64_t cl_ulong;
+typedef cl_ulong cl_bitfield;
+typedef cl_bitfield cl_device_type;
+typedef cl_bitfield cl_mem_flags;
+typedef cl_bitfield cl_map_flags;
+typedef cl_bitfield cl_command_queue_properties;
+typedef struct _cl_platform_id* cl_platform_id;
+typedef struct _cl_device_id* cl_device_id;
+typedef struct _cl_context* cl_context;
+typedef struct _cl_command_queue* cl_command_queue;
+typedef struct _cl_mem* cl_mem;
+typedef struct _cl_program* cl_program;
+typedef struct _cl_kernel* cl_kernel;
+typedef struct _cl_event* cl_event;
+
+const cl_int CL_SUCCESS = 0;
+const cl_uint CL_TRUE = 1;
+const cl_uint CL_FALSE = 0;
+const cl_device_type CL_DEVICE_TYPE_GPU = 1 << 2;
+const cl_device_type CL_DEVICE_TYPE_ACCELERATOR = 1 << 3;
+const cl_uint CL_DEVICE_MAX_MEM_ALLOC_SIZE = 0x1010;
+const cl_uint CL_DEVICE_NAME = 0x102B;
+const cl_uint CL_PROGRAM_BUILD_LOG = 0x1183;
+const cl_mem_flags CL_MEM_READ_WRITE = 1 << 0;
+const cl_mem_flags CL_MEM_READ_ONLY = 1 << 2;
+const cl_mem_flags CL_MEM_ALLOC_HOST_PTR = 1 << 4;
+const cl_map_flags CL_MAP_READ = 1 << 0;
+const cl_map_flags CL_MAP_WRITE = 1 << 1;
+
+struct Api {
+    cl_int (*GetPlatformIDs)(cl_uint, cl_platform_id*, cl_uint*);
+    cl_int (*GetDeviceIDs)(cl_platform_id, cl_device_type, cl_uint, cl_device_id*, cl_uint*);
+    cl_int (*GetDeviceInfo)(cl_device_id, cl_uint, size_t, void*, size_t*);
+    cl_context (*CreateContext)(const intptr_t*, cl_uint, const cl_device_id*, void (*)(const char*, const void*, size_t, void*),
+                                void*, cl_int*);
+    cl_command_queue (*CreateCommandQueue)(cl_context, cl_device_id, cl_command_queue_properties, cl_int*);
+    cl_program (*CreateProgramWithSource)(cl_context, cl_uint, const char**, const size_t*, cl_int*);
+    cl_int (*BuildProgram)(cl_program, cl_uint, const cl_device_id*, const char*, void (*)(cl_program, void*), void*);
+    cl_int (*GetProgramBuildInfo)(cl_program, cl_device_id, cl_uint, size_t, void*, size_t*);
+    cl_kernel (*CreateKernel)(cl_program, const char*, cl_int*);
+    cl_int (*SetKernelArg)(cl_kernel, cl_uint, size_t, const void*);
+    cl_mem (*CreateBuffer)(cl_context, cl_mem_flags, size_t, void*, cl_int*);
+    void* (*EnqueueMapBuffer)(cl_command_queue, cl_mem, cl_uint, cl_map_flags, size_t, size_t, cl_uint, const cl_event*,
+                              cl_event*, cl_int*);
+    cl_int (*EnqueueUnmapMemObject)(cl_command_queue, cl_mem, void*, cl_uint, const cl_event*, cl_event*);
+    cl_int (*EnqueueWriteBuffer)(cl_command_queue, cl_mem, cl_uint, size_t, size_t, const void*, cl_uint, const cl_event*,
+                                 cl_event*);
+    cl_int (*EnqueueReadBuffer)(cl_command_queue, cl_mem, cl_uint, size_t, size_t, void*, cl_uint, const cl_event*,
+                                cl_event*);
+    cl_int (*EnqueueNDRangeKernel)(cl_command_queue, cl_kernel, cl_uint, const size_t*, const size_t*, const size_t*,
+                                   cl_uint, const cl_event*, cl_event*);
+    cl_int (*Flush)(cl_command_queue);
+    cl_int (*Finish)(cl_command_queue);
+    cl_int (*WaitForEvents)(cl_uint, const cl_event*);
+    cl_int (*ReleaseEvent)(cl_event);
+    cl_int (*ReleaseMemObject)(cl_mem);
+    cl_int (*ReleaseKernel)(cl_kernel);
+    cl_int (*ReleaseProgram)(cl_program);
+    cl_int (*ReleaseCommandQueue)(cl_command_queue);
+    cl_int (*ReleaseContext)(cl_context);
+};
+
+} // namespace ocl
+
+// One decoded buffer of a GPU batch. analyze() fills `stats`; the caller
+// sets `gain`, and scale() multiplies the samples by it in place. `written`
+// counts the samples at the front that scale() has already copied back
+// scaled, so after a failure only the rest needs scaling on the CPU.
+struct GpuSegment {
+    float* samples = nullptr;
+    size_t count = 0;
+    SampleStats stats;
+    float gain = 1.0f;
+    size_t written = 0;
+    size_t base = 0; // Device position, a multiple of CHUNK_SAMPLES
+};
+
+// Peak-and-scale for batches of decoded buffers on an OpenCL GPU. A batch
+// is laid out back to back in one device buffer, each buffer padded to a
+// whole number of chunks, and a chunk table drives both kernels: one
+// work-group per chunk, so a single launch covers any mix of file lengths.
+//
+// Host data moves through two pinned staging slices. While one slice is in
+// flight to (or from) the device the next is being copied on the host, and
+// the kernels of a slice are queued behind its upload on a second queue, so
+// transfers, kernels and host copies overlap.
+//
+// Per-chunk min, max and sum of squares come back to the host and are
+// merged in double. Scaling is a plain float multiply, like scaleSamples,
+// so the written samples match the CPU path exactly. Any OpenCL error makes
+// analyze() or scale() return false with error() set; the caller then
+// finishes the batch on the CPU. Not thread-safe: one thread drives it.
+class GpuOffload {
+public:
+    static constexpr size_t GROUP_SIZE = 256;
+    static constexpr size_t CHUNK_SAMPLES = 16384;    // Per work-group
+    static constexpr size_t SLICE_SAMPLES = 2u << 20; // Per staging slice, 8 MB
+    static_assert(SLICE_SAMPLES % CHUNK_SAMPLES == 0, "slices hold whole chunks");
+
+private:
+    void* library = nullptr;
+    ocl::Api cl;
+    ocl::cl_device_id device = nullptr;
+    ocl::cl_context context = nullptr;
+    ocl::cl_command_queue compute = nullptr;
+    ocl::cl_command_queue transfer = nullptr;
+    ocl::cl_program program = nullptr;
+    ocl::cl_kernel stats_kernel = nullptr;
+    ocl::cl_kernel scale_kernel = nullptr;
+    ocl::cl_mem samples_mem = nullptr;  // The batch, capacity floats
+    ocl::cl_mem chunks_mem = nullptr;   // Per chunk: first sample, sample count
+    ocl::cl_mem partials_mem = nullptr; // Per chunk: min, max, sum of squares, unused
+    ocl::cl_mem gains_mem = nullptr;    // Per chunk: gain of its segment
+    ocl::cl_mem staging_mem = nullptr;  // Pinned, two slices
+    float* staging = nullptr;           // staging_mem, mapped for the whole run
+    size_t capacity = 0;                // Samples the batch buffer holds
+    std::string device_name;
+    std::string last_error;
+
+    // Chunk table of the batch being worked on
+    std::vector<ocl::cl_uint> chunk_table;
+    std::vector<float> chunk_partials;
+    std::vector<float> chunk_gains;
+    size_t batch_end = 0; // Device samples the batch spans, padding included
+
+    std::atomic<uint64_t> batch_count{0};
+    std::atomic<uint64_t> segment_count{0};
+    std::atomic<uint64_t> byte_count{0};
+
+    static const char* kernelSource() {
+        return R"CL(
+#define GROUP_SIZE 256
+__kernel void segment_stats(__global const float* samples, __global const uint2* chunks, uint first_chunk,
+                            __global float4* partials) {
+    __local float lmin[GROUP_SIZE], lmax[GROUP_SIZE], lsq[GROUP_SIZE];
+    uint chunk = first_chunk + get_group_id(0);
+    uint2 c = chunks[chunk];
+    uint lid = get_local_id(0);
+    float mn = INFINITY, mx = -INFINITY, sq = 0.0f;
+    for (uint i = lid; i < c.y; i += GROUP_SIZE) {
+        float x = samples[c.x + i];
+        mn = fmin(mn, x);
+        mx = fmax(mx, x);
+        sq = fma(x, x, sq);
+    }
+    lmin[lid] = mn;
+    lmax[lid] = mx;
+    lsq[lid] = sq;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint stride = GROUP_SIZE / 2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            lmin[lid] = fmin(lmin[lid], lmin[lid + stride]);
+            lmax[lid] = fmax(lmax[lid], lmax[lid + stride]);
+            lsq[lid] += lsq[lid + stride];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        partials[chunk] = (float4)(lmin[0], lmax[0], lsq[0], 0.0f);
+    }
+}
+
+__kernel void segment_scale(__global float* samples, __global const uint2* chunks, uint first_chunk,
+                            __global const float* gains) {
+    uint chunk = first_chunk + get_group_id(0);
+    uint2 c = chunks[chunk];
+    float gain = gains[chunk];
+    for (uint i = get_local_id(0); i < c.y; i += GROUP_SIZE) {
+        samples[c.x + i] *= gain;
+    }
+}
+)CL";
+    }
+
+    template <typename F>
+    bool symbol(F& fn, const char* name) {
+        fn = reinterpret_cast<F>(dlsym(library, name));
+        if (fn == nullptr) {
+            last_error = std::string("missing ") + name;
+        }
+        return fn != nullptr;
+    }
+
+    bool loadApi() {
+        library = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (library == nullptr) {
+            library = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+        }
+        if (library == nullptr) {
+            last_error = "libOpenCL not found";
+            return false;
+        }
+        return symbol(cl.GetPlatformIDs, "clGetPlatformIDs") && symbol(cl.GetDeviceIDs, "clGetDeviceIDs") &&
+               symbol(cl.GetDeviceInfo, "clGetDeviceInfo") && symbol(cl.CreateContext, "clCreateContext") &&
+               symbol(cl.CreateCommandQueue, "clCreateCommandQueue") &&
+               symbol(cl.CreateProgramWithSource, "clCreateProgramWithSource") &&
+               symbol(cl.BuildProgram, "clBuildProgram") && symbol(cl.GetProgramBuildInfo, "clGetProgramBuildInfo") &&
+               symbol(cl.CreateKernel, "clCreateKernel") && symbol(cl.SetKernelArg, "clSetKernelArg") &&
+               symbol(cl.CreateBuffer, "clCreateBuffer") && symbol(cl.EnqueueMapBuffer, "clEnqueueMapBuffer") &&
+               symbol(cl.EnqueueUnmapMemObject, "clEnqueueUnmapMemObject") &&
+               symbol(cl.EnqueueWriteBuffer, "clEnqueueWriteBuffer") &&
+               symbol(cl.EnqueueReadBuffer, "clEnqueueReadBuffer") &&
+               symbol(cl.EnqueueNDRangeKernel, "clEnqueueNDRangeKernel") && symbol(cl.Flush, "clFlush") &&
+               symbol(cl.Finish, "clFinish") && symbol(cl.WaitForEvents, "clWaitForEvents") &&
+               symbol(cl.ReleaseEvent, "clReleaseEvent") && symbol(cl.ReleaseMemObject, "clReleaseMemObject") &&
+               symbol(cl.ReleaseKernel, "clReleaseKernel") && symbol(cl.ReleaseProgram, "clReleaseProgram") &&
+               symbol(cl.ReleaseCommandQueue, "clReleaseCommandQueue") && symbol(cl.ReleaseContext, "clReleaseContext");
+    }
+
+    bool ok(ocl::cl_int err, const char* what) {
+        if (err != ocl::CL_SUCCESS) {
+            last_error = std::string(what) + " failed (" + std::to_string(err) + ")";
+            return false;
+        }
+        return true;
+    }
+
+    // First GPU, or failing that accelerator, of any platform
+    bool pickDevice() {
+        ocl::cl_uint platform_count = 0;
+        if (!ok(cl.GetPlatformIDs(0, nullptr, &platform_count), "clGetPlatformIDs") || platform_count == 0) {
+            last_error = "no OpenCL platform";
+            return false;
+        }
+        std::vector<ocl::cl_platform_id> platforms(platform_count);
+        if (!ok(cl.GetPlatformIDs(platform_count, platforms.data(), nullptr), "clGetPlatformIDs")) {
+            return false;
+        }
+        for (ocl::cl_device_type type : {ocl::CL_DEVICE_TYPE_GPU, ocl::CL_DEVICE_TYPE_ACCELERATOR}) {
+            for (ocl::cl_platform_id platform : platforms) {
+                ocl::cl_uint n = 0;
+                if (cl.GetDeviceIDs(platform, type, 1, &device, &n) == ocl::CL_SUCCESS && n > 0) {
+                    char name[256] = {0};
+                    cl.GetDeviceInfo(device, ocl::CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+                    device_name = name;
+                    return true;
+                }
+            }
+        }
+        device = nullptr;
+        last_error = "no OpenCL GPU";
+        return false;
+    }
+
+    bool buildProgram() {
+        ocl::cl_int err;
+        const char* source = kernelSource();
+        program = cl.CreateProgramWithSource(context, 1, &source, nullptr, &err);
+        if (!ok(err, "clCreateProgramWithSource")) {
+            return false;
+        }
+        if (cl.BuildProgram(program, 1, &device, "", nullptr, nullptr) != ocl::CL_SUCCESS) {
+            char log[1024] = {0};
+            cl.GetProgramBuildInfo(program, device, ocl::CL_PROGRAM_BUILD_LOG, sizeof(log) - 1, log, nullptr);
+            last_error = std::string("kernel build failed: ") + log;
+            return false;
+        }
+        stats_kernel = cl.CreateKernel(program, "segment_stats", &err);
+        if (!ok(err, "clCreateKernel")) {
+            return false;
+        }
+        scale_kernel = cl.CreateKernel(program, "segment_scale", &err);
+        return ok(err, "clCreateKernel");
+    }
+
+    bool createBuffers(size_t batch_bytes) {
+        ocl::cl_ulong max_alloc = 0;
+        if (!ok(cl.GetDeviceInfo(device, ocl::CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr),
+                "clGetDeviceInfo")) {
+            return false;
+        }
+        size_t bytes = std::min<size_t>(batch_bytes, max_alloc);
+        // Chunk offsets are 32-bit on the device
+        capacity = std::min<size_t>(bytes / sizeof(float), UINT32_MAX) / CHUNK_SAMPLES * CHUNK_SAMPLES;
+        if (capacity == 0) {
+            last_error = "batch smaller than one chunk";
+            return false;
+        }
+        size_t chunks = capacity / CHUNK_SAMPLES;
+        ocl::cl_int err;
+        samples_mem = cl.CreateBuffer(context, ocl::CL_MEM_READ_WRITE, capacity * sizeof(float), nullptr, &err);
+        if (!ok(err, "clCreateBuffer")) {
+            return false;
+        }
+        chunks_mem = cl.CreateBuffer(context, ocl::CL_MEM_READ_ONLY, chunks * 2 * sizeof(ocl::cl_uint), nullptr, &err);
+        if (!ok(err, "clCreateBuffer")) {
+            return false;
+        }
+        partials_mem = cl.CreateBuffer(context, ocl::CL_MEM_READ_WRITE, chunks * 4 * sizeof(float), nullptr, &err);
+        if (!ok(err, "clCreateBuffer")) {
+            return false;
+        }
+        gains_mem = cl.CreateBuffer(context, ocl::CL_MEM_READ_ONLY, chunks * sizeof(float), nullptr, &err);
+        if (!ok(err, "clCreateBuffer")) {
+            return false;
+        }
+        size_t staging_bytes = 2 * SLICE_SAMPLES * sizeof(float);
+        staging_mem = cl.CreateBuffer(context, ocl::CL_MEM_READ_WRITE | ocl::CL_MEM_ALLOC_HOST_PTR, staging_bytes, nullptr, &err);
+        if (!ok(err, "clCreateBuffer")) {
+            return false;
+        }
+        staging = static_cast<float*>(cl.EnqueueMapBuffer(transfer, staging_mem, ocl::CL_TRUE, ocl::CL_MAP_READ | ocl::CL_MAP_WRITE,
+                                                          0, staging_bytes, 0, nullptr, nullptr, &err));
+        return ok(err, "clEnqueueMapBuffer");
+    }
+
+    // Calls fn(segment, first sample, device position, count) for each
+    // part of a segment inside device positions [lo, hi)
+    template <typename Fn>
+    static void forEachPiece(std::vector<GpuSegment>& batch, size_t lo, size_t hi, Fn fn) {
+        for (GpuSegment& seg : batch) {
+            size_t first = std::max(lo, seg.base);
+            size_t last = std::min(hi, seg.base + seg.count);
+            if (first < last) {
+                fn(seg, first - seg.base, first, last - first);
+            }
+        }
+    }
+
+    size_t sliceCount() const {
+        return (batch_end + SLICE_SAMPLES - 1) / SLICE_SAMPLES;
+    }
+
+    // Queues `kernel` over the chunks of slice `s` on the compute queue,
+    // after `wait` when it is set
+    bool launch(ocl::cl_kernel kernel, size_t s, ocl::cl_event wait, ocl::cl_event* done) {
+        size_t first_chunk = s * (SLICE_SAMPLES / CHUNK_SAMPLES);
+        size_t end_chunk = std::min(batch_end, (s + 1) * SLICE_SAMPLES) / CHUNK_SAMPLES;
+        ocl::cl_uint first = static_cast<ocl::cl_uint>(first_chunk);
+        size_t global = (end_chunk - first_chunk) * GROUP_SIZE;
+        size_t local = GROUP_SIZE;
+        return ok(cl.SetKernelArg(kernel, 2, sizeof(first), &first), "clSetKernelArg") &&
+               ok(cl.EnqueueNDRangeKernel(compute, kernel, 1, nullptr, &global, &local, wait ? 1 : 0,
+                                          wait ? &wait : nullptr, done),
+                  "clEnqueueNDRangeKernel");
+    }
+
+    // Lets queued work drain before events or host memory it uses go away
+    bool drain(std::vector<ocl::cl_event>& events, bool result) {
+        cl.Finish(transfer);
+        cl.Finish(compute);
+        for (ocl::cl_event e : events) {
+            if (e != nullptr) {
+                cl.ReleaseEvent(e);
+            }
+        }
+        return result;
+    }
+
+public:
+    GpuOffload() = default;
+    GpuOffload(const GpuOffload&) = delete;
+    GpuOffload& operator=(const GpuOffload&) = delete;
+
+    ~GpuOffload() {
+        close();
+    }
+
+    // Opens the first GPU and sizes the batch buffer to `batch_bytes` (or
+    // the device's largest allocation). False, with error() set, when there
+    // is no usable device.
+    bool init(size_t batch_bytes) {
+        close();
+        if (!loadApi() || !pickDevice()) {
+            return false;
+        }
+        ocl::cl_int err;
+        context = cl.CreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+        if (!ok(err, "clCreateContext")) {
+            return false;
+        }
+        compute = cl.CreateCommandQueue(context, device, 0, &err);
+        if (!ok(err, "clCreateCommandQueue")) {
+            return false;
+        }
+        transfer = cl.CreateCommandQueue(context, device, 0, &err);
+        if (!ok(err, "clCreateCommandQueue")) {
+            return false;
+        }
+        if (!buildProgram() || !createBuffers(batch_bytes)) {
+            return false;
+        }
+        for (ocl::cl_kernel kernel : {stats_kernel, scale_kernel}) {
+            if (!ok(cl.SetKernelArg(kernel, 0, sizeof(samples_mem), &samples_mem), "clSetKernelArg") ||
+                !ok(cl.SetKernelArg(kernel, 1, sizeof(chunks_mem), &chunks_mem), "clSetKernelArg")) {
+                return false;
+            }
+        }
+        return ok(cl.SetKernelArg(stats_kernel, 3, sizeof(partials_mem), &partials_mem), "clSetKernelArg") &&
+               ok(cl.SetKernelArg(scale_kernel, 3, sizeof(gains_mem), &gains_mem), "clSetKernelArg");
+    }
+
+    void close() {
+        if (library == nullptr) {
+            return;
+        }
+        if (staging != nullptr) {
+            cl.EnqueueUnmapMemObject(transfer, staging_mem, staging, 0, nullptr, nullptr);
+            cl.Finish(transfer);
+            staging = nullptr;
+        }
+        for (ocl::cl_mem* mem : {&samples_mem, &chunks_mem, &partials_mem, &gains_mem, &staging_mem}) {
+            if (*mem != nullptr) {
+                cl.ReleaseMemObject(*mem);
+                *mem = nullptr;
+            }
+        }
+        for (ocl::cl_kernel* kernel : {&stats_kernel, &scale_kernel}) {
+            if (*kernel != nullptr) {
+                cl.ReleaseKernel(*kernel);
+                *kernel = nullptr;
+            }
+        }
+        if (program != nullptr) {
+            cl.ReleaseProgram(program);
+            program = nullptr;
+        }
+        for (ocl::cl_command_queue* queue : {&compute, &transfer}) {
+            if (*queue != nullptr) {
+                cl.ReleaseCommandQueue(*queue);
+                *queue = nullptr;
+            }
+        }
+        if (context != nullptr) {
+            cl.ReleaseContext(context);
+            context = nullptr;
+        }
+        dlclose(library);
+        library = nullptr;
+        device = nullptr;
+        capacity = 0;
+    }
+
+    const std::string& deviceName() const { return device_name; }
+    const std::string& error() const { return last_error; }
+    size_t capacitySamples() const { return capacity; }
+
+    // Device samples a buffer of `count` samples takes up in a batch
+    static size_t footprint(size_t count) {
+        return (count + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES * CHUNK_SAMPLES;
+    }
+
+    uint64_t batches() const { return batch_count.load(); }
+    uint64_t segments() const { return segment_count.load(); }
+    uint64_t bytes() const { return byte_count.load(); }
+
+    // Uploads the batch and computes the stats of every segment. The
+    // samples stay on the device for scale(); the host copies are not
+    // changed. The footprints must add up to at most capacitySamples().
+    bool analyze(std::vector<GpuSegment>& batch) {
+        chunk_table.clear();
+        batch_end = 0;
+        for (GpuSegment& seg : batch) {
+            seg.base = batch_end;
+            seg.written = 0;
+            for (size_t first = 0; first < seg.count; first += CHUNK_SAMPLES) {
+                chunk_table.push_back(static_cast<ocl::cl_uint>(seg.base + first));
+                chunk_table.push_back(static_cast<ocl::cl_uint>(std::min(CHUNK_SAMPLES, seg.count - first)));
+            }
+            batch_end += footprint(seg.count);
+        }
+        if (batch_end == 0 || batch_end > capacity) {
+            last_error = "batch does not fit the device buffer";
+            return false;
+        }
+        size_t chunks = batch_end / CHUNK_SAMPLES;
+        std::vector<ocl::cl_event> events;
+        if (!ok(cl.EnqueueWriteBuffer(compute, chunks_mem, ocl::CL_TRUE, 0, chunks * 2 * sizeof(ocl::cl_uint),
+                                      chunk_table.data(), 0, nullptr, nullptr),
+                "clEnqueueWriteBuffer")) {
+            return drain(events, false);
+        }
+
+        // Slice s is staged in half s % 2 once the upload of slice s - 2 is done
+        size_t slices = sliceCount();
+        events.assign(slices, nullptr);
+        for (size_t s = 0; s < slices; ++s) {
+            if (s >= 2 && !ok(cl.WaitForEvents(1, &events[s - 2]), "clWaitForEvents")) {
+                return drain(events, false);
+            }
+            float* half = staging + (s % 2) * SLICE_SAMPLES;
+            size_t lo = s * SLICE_SAMPLES, hi = std::min(batch_end, lo + SLICE_SAMPLES);
+            forEachPiece(batch, lo, hi, [half, lo](GpuSegment& seg, size_t first, size_t pos, size_t n) {
+                memcpy(half + (pos - lo), seg.samples + first, n * sizeof(float));
+            });
+            if (!ok(cl.EnqueueWriteBuffer(transfer, samples_mem, ocl::CL_FALSE, lo * sizeof(float), (hi - lo) * sizeof(float),
+                                          half, 0, nullptr, &events[s]),
+                    "clEnqueueWriteBuffer") ||
+                !ok(cl.Flush(transfer), "clFlush") || !launch(stats_kernel, s, events[s], nullptr)) {
+                return drain(events, false);
+            }
+            cl.Flush(compute);
+        }
+
+        chunk_partials.resize(chunks * 4);
+        if (!ok(cl.EnqueueReadBuffer(compute, partials_mem, ocl::CL_TRUE, 0, chunks * 4 * sizeof(float),
+                                     chunk_partials.data(), 0, nullptr, nullptr),
+                "clEnqueueReadBuffer")) {
+            return drain(events, false);
+        }
+        for (GpuSegment& seg : batch) {
+            SampleStats st;
+            size_t first_chunk = seg.base / CHUNK_SAMPLES;
+            for (size_t c = first_chunk; c < first_chunk + footprint(seg.count) / CHUNK_SAMPLES; ++c) {
+                st.min_val = std::min(st.min_val, chunk_partials[c * 4]);
+                st.max_val = std::max(st.max_val, chunk_partials[c * 4 + 1]);
+                st.sum_squares += chunk_partials[c * 4 + 2];
+            }
+            audio_kernels::finishStats(st, seg.count);
+            seg.stats = st;
+        }
+        return drain(events, true);
+    }
+
+    // Multiplies every segment of the batch analyze() uploaded by its gain
+    // and copies the result back over the host samples
+    bool scale(std::vector<GpuSegment>& batch) {
+        size_t chunks = batch_end / CHUNK_SAMPLES;
+        chunk_gains.resize(chunks);
+        for (const GpuSegment& seg : batch) {
+            size_t first_chunk = seg.base / CHUNK_SAMPLES;
+            std::fill_n(chunk_gains.begin() + first_chunk, footprint(seg.count) / CHUNK_SAMPLES, seg.gain);
+        }
+        size_t slices = sliceCount();
+        std::vector<ocl::cl_event> events(2 * slices, nullptr); // Kernels, then reads
+        if (!ok(cl.EnqueueWriteBuffer(compute, gains_mem, ocl::CL_TRUE, 0, chunks * sizeof(float), chunk_gains.data(), 0,
+                                      nullptr, nullptr),
+                "clEnqueueWriteBuffer")) {
+            return drain(events, false);
+        }
+        for (size_t s = 0; s < slices; ++s) {
+            if (!launch(scale_kernel, s, nullptr, &events[s])) {
+                return drain(events, false);
+            }
+        }
+        cl.Flush(compute);
+
+        // Slice s comes back into half s % 2 as soon as its kernel is done;
+        // the host copies one half out while the other is being read
+        auto read = [&](size_t s) {
+            size_t lo = s * SLICE_SAMPLES, hi = std::min(batch_end, lo + SLICE_SAMPLES);
+            return ok(cl.EnqueueReadBuffer(transfer, samples_mem, ocl::CL_FALSE, lo * sizeof(float), (hi - lo) * sizeof(float),
+                                           staging + (s % 2) * SLICE_SAMPLES, 1, &events[s], &events[slices + s]),
+                      "clEnqueueReadBuffer") &&
+                   ok(cl.Flush(transfer), "clFlush");
+        };
+        for (size_t s = 0; s < std::min<size_t>(slices, 2); ++s) {
+            if (!read(s)) {
+                return drain(events, false);
+            }
+        }
+        for (size_t s = 0; s < slices; ++s) {
+            if (!ok(cl.WaitForEvents(1, &events[slices + s]), "clWaitForEvents")) {
+                return drain(events, false);
+            }
+            float* half = staging + (s % 2) * SLICE_SAMPLES;
+            size_t lo = s * SLICE_SAMPLES, hi = std::min(batch_end, lo + SLICE_SAMPLES);
+            forEachPiece(batch, lo, hi, [half, lo](GpuSegment& seg, size_t first, size_t pos, size_t n) {
+                memcpy(seg.samples + first, half + (pos - lo), n * sizeof(float));
+                seg.written = first + n;
+            });
+            if (s + 2 < slices && !read(s + 2)) {
+                return drain(events, false);
+            }
+        }
+        batch_count++;
+        segment_count += batch.size();
+        for (const GpuSegment& seg : batch) {
+            byte_count += seg.count * sizeof(float);
+        }
+        return drain(events, true);
+    }
+};
+
+#endif // GPU_OFFLOAD_H
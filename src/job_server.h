@@ -0,0 +1,222 @@
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// One client of the JobServer. Jobs keep a reference while they run, so the
+// socket stays open until the client hung up and its last reply was sent.
+class JobConnection {
+private:
+    int fd;
+    pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+public:
+    explicit JobConnection(int socket_fd) : fd(socket_fd) {}
+    JobConnection(const JobConnection&) = delete;
+    JobConnection& operator=(const JobConnection&) = delete;
+
+    ~JobConnection() {
+        close(fd);
+        pthread_mutex_destroy(&send_mutex);
+    }
+
+    // Sends one reply line; safe to call from any thread. A client that
+    // stopped reading only loses its own replies.
+    void reply(const std::string& line) {
+        std::string msg = line + "\n";
+        pthread_mutex_lock(&send_mutex);
+        for (size_t sent = 0; sent < msg.size();) {
+            ssize_t w = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0) {
+                break;
+            }
+            sent += w;
+        }
+        pthread_mutex_unlock(&send_mutex);
+    }
+};
+
+// Line-oriented request server on a Unix domain socket. One thread polls the
+// listening socket and every client, splits what arrives into lines and
+// hands each line to the handler, which normally queues a job and replies
+// later through the connection. Clients may pipeline any number of lines.
+class JobServer {
+public:
+    using Handler = std::function<void(const std::shared_ptr<JobConnection>& conn, const std::string& line)>;
+
+private:
+    static const size_t MAX_LINE = 64 * 1024;
+
+    struct Client {
+        std::shared_ptr<JobConnection> conn;
+        int fd;
+        std::string pending; // Bytes after the last complete line
+    };
+
+    int listen_fd = -1;
+    std::string socket_path;
+    pthread_t thread;
+    bool running = false;
+    std::atomic<bool> stopping{false};
+    Handler handler;
+
+    static void* serverMain(void* arg) {
+        static_cast<JobServer*>(arg)->serve();
+        return nullptr;
+    }
+
+    // False when the client hung up or sent a line that is too long
+    bool readClient(Client& client) {
+        char buf[4096];
+        ssize_t n = recv(client.fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return false;
+        }
+        client.pending.append(buf, n);
+        size_t start = 0, end;
+        while ((end = client.pending.find('\n', start)) != std::string::npos) {
+            std::string line = client.pending.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                handler(client.conn, line);
+            }
+            start = end + 1;
+        }
+        client.pending.erase(0, start);
+        return client.pending.size() <= MAX_LINE;
+    }
+
+    void serve() {
+        std::vector<Client> clients;
+        std::vector<pollfd> fds;
+        while (!stopping.load(std::memory_order_acquire)) {
+            fds.assign(1, pollfd{listen_fd, POLLIN, 0});
+            for (const Client& c : clients) {
+                fds.push_back(pollfd{c.fd, POLLIN, 0});
+            }
+            // Wake up regularly to notice stop()
+            if (poll(fds.data(), fds.size(), 200) <= 0) {
+                continue;
+            }
+            // Clients first: accepting appends to `clients`, which fds mirrors
+            size_t kept = 0;
+            for (size_t i = 0; i < clients.size(); ++i) {
+                bool open = !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) || readClient(clients[i]);
+                if (open && kept != i) {
+                    clients[kept] = std::move(clients[i]);
+                }
+                kept += open ? 1 : 0;
+            }
+            clients.resize(kept);
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0) {
+                    // A reply never blocks a worker for long on a stalled client
+                    timeval timeout = {5, 0};
+                    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                    clients.push_back(Client{std::make_shared<JobConnection>(fd), fd, std::string()});
+                }
+            }
+        }
+    }
+
+    // Makes room for binding `addr`: true if nothing is there, or if it is a
+    // socket nobody listens on any more (then it is removed). Anything else,
+    // a live server or a file that is not a socket, is left alone, with
+    // errno set to EADDRINUSE or EEXIST.
+    static bool clearStale(const sockaddr_un& addr) {
+        struct stat st;
+        if (lstat(addr.sun_path, &st) != 0) {
+            return errno == ENOENT;
+        }
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            return false;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            return false;
+        }
+        bool stale = connect(probe, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 &&
+                     errno == ECONNREFUSED;
+        close(probe);
+        if (!stale) {
+            errno = EADDRINUSE;
+            return false;
+        }
+        return unlink(addr.sun_path) == 0;
+    }
+
+public:
+    JobServer() = default;
+    JobServer(const JobServer&) = delete;
+    JobServer& operator=(const JobServer&) = delete;
+
+    ~JobServer() {
+        stop();
+    }
+
+    // Listens on `path`, replacing a stale socket file left by an earlier run.
+    // Fails, with errno set, if another server is live there or the path is
+    // not a socket.
+    bool start(const std::string& path, Handler on_line) {
+        sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        if (!clearStale(addr)) {
+            return false;
+        }
+        handler = std::move(on_line);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 64) != 0 ||
+            pthread_create(&thread, NULL, serverMain, this) != 0) {
+            int err = errno;
+            close(listen_fd);
+            listen_fd = -1;
+            errno = err;
+            return false;
+        }
+        socket_path = path;
+        running = true;
+        return true;
+    }
+
+    // Stops accepting and reading. Connections with jobs still running stay
+    // open until those jobs have replied.
+    void stop() {
+        if (!running) {
+            return;
+        }
+        stopping.store(true, std::memory_order_release);
+        pthread_join(thread, NULL);
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        listen_fd = -1;
+        running = false;
+    }
+};
+
+#endif // JOB_SERVER_H
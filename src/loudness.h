@@ -0,0 +1,441 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ITU-R BS.1770 measurements, fed block by block in the same pass that
+// gathers the sample stats, so loudness costs one read of the file. Both
+// meters can also measure a file in ranges at once: a meter for a later
+// range is warmed up on the frames just before it, and merge() appends it
+// to the meter of the range before. bench --check-loudness compares them
+// with in-order runs and with the EBU Tech 3341 cases.
+
+// Second-order IIR section, transposed direct form II, in double precision
+// so the 38 Hz high-pass stays stable at high sample rates
+struct Biquad {
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    double z1 = 0.0, z2 = 0.0;
+
+    double process(double x) {
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+// Integrated loudness (LUFS) with the BS.1770 K-weighting filter and the
+// EBU R128 gates: 400 ms blocks every 100 ms, an absolute gate at -70 LUFS
+// and a relative gate 10 LU below the loudness of the blocks that passed.
+// Only the weighted energy of each 100 ms step is kept, so memory grows by
+// one double per 100 ms of audio.
+class LoudnessMeter {
+private:
+    int channels;
+    std::vector<Biquad> shelf;    // Per channel: +4 dB high shelf (head effects)
+    std::vector<Biquad> highpass; // Per channel: RLB high-pass
+    std::vector<double> weights;  // Per channel: G_i (1.41 for surrounds, 0 for LFE)
+    size_t step_frames;           // Frames per 100 ms step
+    size_t step_filled = 0;
+    double step_energy = 0.0;
+    std::vector<double> steps; // Weighted energy of each complete step
+    double total_energy = 0.0; // Whole file, for clips shorter than one block
+    size_t total_frames = 0;
+
+    // Block loudness from its mean weighted energy
+    static double toLufs(double power) {
+        return -0.691 + 10.0 * std::log10(power);
+    }
+
+    static double fromLufs(double lufs) {
+        return std::pow(10.0, (lufs + 0.691) / 10.0);
+    }
+
+    // Runs channel c's filters over `frames` frames of `samples`; returns the
+    // sum of the squared outputs. The state stays in locals for the run, so
+    // the recurrences do not wait on stores and reloads of it.
+    double filterChannel(int c, const float* samples, size_t frames) {
+        Biquad s = shelf[c];
+        Biquad h = highpass[c];
+        double sum = 0.0;
+        for (size_t f = 0; f < frames; ++f) {
+            double y = h.process(s.process(samples[f * channels + c]));
+            sum += y * y;
+        }
+        shelf[c] = s;
+        highpass[c] = h;
+        return sum;
+    }
+
+public:
+    LoudnessMeter(int channel_count, int sample_rate)
+        : channels(channel_count), shelf(channel_count), highpass(channel_count), weights(channel_count, 1.0),
+          step_frames(std::max<size_t>(1, static_cast<size_t>(std::lround(sample_rate * 0.1)))) {
+        // Filter coefficients for any rate, from the analog prototypes of the
+        // 48 kHz values in BS.1770 (as libebur128 derives them)
+        double fs = sample_rate;
+        double k = std::tan(M_PI * 1681.974450955533 / fs);
+        double q = 0.7071752369554196;
+        double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        double vb = std::pow(vh, 0.4996667741545416);
+        double a0 = 1.0 + k / q + k * k;
+        Biquad s;
+        s.b0 = (vh + vb * k / q + k * k) / a0;
+        s.b1 = 2.0 * (k * k - vh) / a0;
+        s.b2 = (vh - vb * k / q + k * k) / a0;
+        s.a1 = 2.0 * (k * k - 1.0) / a0;
+        s.a2 = (1.0 - k / q + k * k) / a0;
+
+        k = std::tan(M_PI * 38.13547087602444 / fs);
+        q = 0.5003270373238773;
+        a0 = 1.0 + k / q + k * k;
+        Biquad h;
+        h.b0 = 1.0;
+        h.b1 = -2.0;
+        h.b2 = 1.0;
+        h.a1 = 2.0 * (k * k - 1.0) / a0;
+        h.a2 = (1.0 - k / q + k * k) / a0;
+
+        std::fill(shelf.begin(), shelf.end(), s);
+        std::fill(highpass.begin(), highpass.end(), h);
+        // 5.0 is L R C Ls Rs; 5.1 is L R C LFE Ls Rs
+        if (channels == 5) {
+            weights[3] = weights[4] = 1.41;
+        } else if (channels == 6) {
+            weights[3] = 0.0;
+            weights[4] = weights[5] = 1.41;
+        }
+    }
+
+#if defined(__SSE2__)
+    // filterChannel for channels c and c + 1 at once, one per SSE2 lane. The
+    // operations are those of Biquad::process, so each lane's result is
+    // the same as filterChannel's.
+    void filterPair(int c, const float* samples, size_t frames, double& sum0, double& sum1) {
+        const Biquad& s = shelf[c];
+        const Biquad& h = highpass[c];
+        __m128d sb0 = _mm_set1_pd(s.b0), sb1 = _mm_set1_pd(s.b1), sb2 = _mm_set1_pd(s.b2);
+        __m128d sa1 = _mm_set1_pd(s.a1), sa2 = _mm_set1_pd(s.a2);
+        __m128d hb0 = _mm_set1_pd(h.b0), hb1 = _mm_set1_pd(h.b1), hb2 = _mm_set1_pd(h.b2);
+        __m128d ha1 = _mm_set1_pd(h.a1), ha2 = _mm_set1_pd(h.a2);
+        __m128d s1 = _mm_set_pd(shelf[c + 1].z1, s.z1), s2 = _mm_set_pd(shelf[c + 1].z2, s.z2);
+        __m128d h1 = _mm_set_pd(highpass[c + 1].z1, h.z1), h2 = _mm_set_pd(highpass[c + 1].z2, h.z2);
+        __m128d sum = _mm_setzero_pd();
+        for (size_t f = 0; f < frames; ++f) {
+            __m128i pair = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples + f * channels + c));
+            __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(pair));
+            __m128d y = _mm_add_pd(_mm_mul_pd(sb0, x), s1);
+            s1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(sb1, x), _mm_mul_pd(sa1, y)), s2);
+            s2 = _mm_sub_pd(_mm_mul_pd(sb2, x), _mm_mul_pd(sa2, y));
+            __m128d z = _mm_add_pd(_mm_mul_pd(hb0, y), h1);
+            h1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(hb1, y), _mm_mul_pd(ha1, z)), h2);
+            h2 = _mm_sub_pd(_mm_mul_pd(hb2, y), _mm_mul_pd(ha2, z));
+            sum = _mm_add_pd(sum, _mm_mul_pd(z, z));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, s1);
+        shelf[c].z1 = lanes[0];
+        shelf[c + 1].z1 = lanes[1];
+        _mm_storeu_pd(lanes, s2);
+        shelf[c].z2 = lanes[0];
+        shelf[c + 1].z2 = lanes[1];
+        _mm_storeu_pd(lanes, h1);
+        highpass[c].z1 = lanes[0];
+        highpass[c + 1].z1 = lanes[1];
+        _mm_storeu_pd(lanes, h2);
+        highpass[c].z2 = lanes[0];
+        highpass[c + 1].z2 = lanes[1];
+        _mm_storeu_pd(lanes, sum);
+        sum0 = lanes[0];
+        sum1 = lanes[1];
+    }
+#endif
+
+    // Weighted energy of `frames` frames, channel by channel (two at a time
+    // with SSE2). The LFE, weighted 0, is not filtered at all.
+    double filterFrames(const float* samples, size_t frames) {
+        double energy = 0.0;
+        int c = 0;
+#if defined(__SSE2__)
+        for (; c + 1 < channels && weights[c] != 0.0 && weights[c + 1] != 0.0; c += 2) {
+            double sum0, sum1;
+            filterPair(c, samples, frames, sum0, sum1);
+            energy += weights[c] * sum0;
+            energy += weights[c + 1] * sum1;
+        }
+#endif
+        for (; c < channels; ++c) {
+            if (weights[c] != 0.0) {
+                energy += weights[c] * filterChannel(c, samples, frames);
+            }
+        }
+        return energy;
+    }
+
+    // Feeds `frames` interleaved frames, one step's worth at a time
+    void process(const float* samples, size_t frames) {
+        while (frames > 0) {
+            size_t n = std::min(frames, step_frames - step_filled);
+            step_energy += filterFrames(samples, n);
+            step_filled += n;
+            if (step_filled == step_frames) {
+                steps.push_back(step_energy);
+                total_energy += step_energy;
+                total_frames += step_frames;
+                step_filled = 0;
+                step_energy = 0.0;
+            }
+            samples += n * channels;
+            frames -= n;
+        }
+    }
+
+    size_t stepFrames() const {
+        return step_frames;
+    }
+
+    // Frames left until the current 100 ms step is complete
+    size_t framesToStep() const {
+        return step_frames - step_filled;
+    }
+
+    // Frames a range meter is warmed up on. The slowest pole, the 38 Hz
+    // high-pass's, decays below double precision within 300 ms at any
+    // rate, so the filter state then matches that of an in-order run.
+    size_t warmUpFrames() const {
+        return 3 * step_frames;
+    }
+
+    // Runs the filters over the frames before this meter's range; nothing
+    // is measured
+    void warmUp(const float* samples, size_t frames) {
+        filterFrames(samples, frames);
+    }
+
+    // Appends the meter of the range that follows this one. This meter must
+    // end on a step boundary, where `later` started.
+    void merge(const LoudnessMeter& later) {
+        steps.insert(steps.end(), later.steps.begin(), later.steps.end());
+        total_energy += later.total_energy;
+        total_frames += later.total_frames;
+        step_filled = later.step_filled;
+        step_energy = later.step_energy;
+        shelf = later.shelf;
+        highpass = later.highpass;
+    }
+
+    // Gated integrated loudness; -inf for silence or audio below the
+    // absolute gate. A clip shorter than one 400 ms block is measured whole.
+    double integratedLufs() const {
+        double block_frames = 4.0 * step_frames;
+        std::vector<double> blocks;
+        for (size_t j = 0; j + 4 <= steps.size(); ++j) {
+            blocks.push_back((steps[j] + steps[j + 1] + steps[j + 2] + steps[j + 3]) / block_frames);
+        }
+        if (blocks.empty()) {
+            size_t frames = total_frames + step_filled;
+            double power = frames ? (total_energy + step_energy) / frames : 0.0;
+            return power > 0.0 ? toLufs(power) : -INFINITY;
+        }
+
+        const double absolute_gate = fromLufs(-70.0);
+        double sum = 0.0;
+        size_t count = 0;
+        for (double p : blocks) {
+            if (p > absolute_gate) {
+                sum += p;
+                count++;
+            }
+        }
+        if (count == 0) {
+            return -INFINITY;
+        }
+        double relative_gate = std::max(absolute_gate, sum / count * 0.1); // -10 LU
+        sum = 0.0;
+        count = 0;
+        for (double p : blocks) {
+            if (p > relative_gate) {
+                sum += p;
+                count++;
+            }
+        }
+        return count ? toLufs(sum / count) : -INFINITY;
+    }
+};
+
+// True peak per BS.1770 Annex 2: the signal is oversampled (4x below
+// 96 kHz, 2x below 192 kHz) with a polyphase windowed-sinc interpolator and
+// the largest absolute value of any phase is reported. Each input sample
+// costs TAPS multiply-adds per phase. A channel's samples are gathered one
+// run at a time into a contiguous buffer, so one SSE multiply-add per tap
+// computes a phase for four consecutive samples.
+class TruePeakMeter {
+private:
+    static const int TAPS = 12;   // Per phase
+    static const size_t RUN = 256; // Frames checked against the bound at once
+
+    int channels;
+    int factor;
+    std::vector<float> coeffs;  // [tap][phase]
+    std::vector<float> splat;   // coeffs with every value repeated 4 times
+    std::vector<float> history; // Per channel 2*TAPS floats, newest sample last
+    std::vector<int> pos;       // Per channel write position in its history
+    std::vector<float> run;     // TAPS - 1 samples of history, then one run of one channel
+    float gain_bound = 0.0f;    // Largest sum of |coefficients| over the phases
+    float peak = 0.0f;
+
+    // Largest interpolated magnitude at the `count` samples from x, where
+    // x[-TAPS + 1] to x[-1] are the samples before them. With 4 phases each
+    // SSE register holds one phase of four consecutive samples, so a tap's
+    // samples are loaded once and the phases accumulate independently.
+    static float maxMagnitude(const float* x, size_t count) {
+        float best = 0.0f;
+        size_t n = 0;
+#if defined(__SSE2__)
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 best4 = _mm_setzero_ps();
+        for (; n + 4 <= count; n += 4) {
+            best4 = _mm_max_ps(best4, _mm_andnot_ps(sign, _mm_loadu_ps(x + n)));
+        }
+        best4 = _mm_max_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(1, 0, 3, 2)));
+        best4 = _mm_max_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(2, 3, 0, 1)));
+        best = _mm_cvtss_f32(best4);
+#endif
+        for (; n < count; ++n) {
+            best = std::max(best, std::fabs(x[n]));
+        }
+        return best;
+    }
+
+    float filterRun(const float* x, size_t count) const {
+        float best = 0.0f;
+        size_t n = 0;
+#if defined(__SSE2__)
+        if (factor == 4) {
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            __m128 best4 = _mm_setzero_ps();
+            for (; n + 4 <= count; n += 4) {
+                __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0;
+                for (int t = 0; t < TAPS; ++t) {
+                    __m128 in = _mm_loadu_ps(x + n - t);
+                    const float* k = &splat[t * 16];
+                    a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(k), in));
+                    a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(k + 4), in));
+                    a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(k + 8), in));
+                    a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(k + 12), in));
+                }
+                a0 = _mm_max_ps(_mm_andnot_ps(sign, a0), _mm_andnot_ps(sign, a1));
+                a2 = _mm_max_ps(_mm_andnot_ps(sign, a2), _mm_andnot_ps(sign, a3));
+                best4 = _mm_max_ps(best4, _mm_max_ps(a0, a2));
+            }
+            best4 = _mm_max_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(1, 0, 3, 2)));
+            best4 = _mm_max_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(2, 3, 0, 1)));
+            best = _mm_cvtss_f32(best4);
+        }
+#endif
+        for (; n < count; ++n) {
+            for (int p = 0; p < factor; ++p) {
+                float acc = 0.0f;
+                for (int t = 0; t < TAPS; ++t) {
+                    acc += coeffs[t * factor + p] * x[n - t];
+                }
+                best = std::max(best, std::fabs(acc));
+            }
+        }
+        return best;
+    }
+
+public:
+    TruePeakMeter(int channel_count, int sample_rate)
+        : channels(channel_count), factor(sample_rate < 96000 ? 4 : sample_rate < 192000 ? 2 : 1),
+          history(channel_count * 2 * TAPS, 0.0f), pos(channel_count, 0), run(TAPS - 1 + RUN) {
+        // Hann-windowed sinc cut off at the original Nyquist frequency; each
+        // phase is normalized to unity DC gain
+        int length = TAPS * factor;
+        double centre = (length - 1) / 2.0;
+        coeffs.assign(length, 0.0f);
+        for (int p = 0; p < factor; ++p) {
+            double sum = 0.0;
+            std::vector<double> phase(TAPS);
+            for (int t = 0; t < TAPS; ++t) {
+                double n = t * factor + p - centre;
+                double x = n / factor;
+                double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                double window = 0.5 + 0.5 * std::cos(M_PI * n / (centre + 1.0));
+                phase[t] = sinc * window;
+                sum += phase[t];
+            }
+            double l1 = 0.0;
+            for (int t = 0; t < TAPS; ++t) {
+                coeffs[t * factor + p] = static_cast<float>(phase[t] / sum);
+                l1 += std::fabs(phase[t] / sum);
+            }
+            gain_bound = std::max(gain_bound, static_cast<float>(l1) * 1.0001f);
+        }
+        for (float c : coeffs) {
+            splat.insert(splat.end(), 4, c);
+        }
+    }
+
+    void process(const float* samples, size_t frames) {
+        for (int c = 0; c < channels; ++c) {
+            float* hist = &history[c * 2 * TAPS];
+            for (size_t first = 0; first < frames; first += RUN) {
+                size_t count = std::min(RUN, frames - first);
+                // hist + pos[c] holds the last TAPS samples, oldest first
+                std::copy(hist + pos[c] + 1, hist + pos[c] + TAPS, run.begin());
+                for (size_t f = 0; f < count; ++f) {
+                    run[TAPS - 1 + f] = samples[(first + f) * channels + c];
+                }
+                // No interpolated value exceeds gain_bound times the largest
+                // input in its window, so runs that cannot raise the peak
+                // (most of them, once the loud parts were seen) skip the filter
+                float run_max = maxMagnitude(run.data(), TAPS - 1 + count);
+                if (run_max * gain_bound > peak) {
+                    peak = std::max(peak, filterRun(&run[TAPS - 1], count));
+                }
+                peak = std::max(peak, run_max);
+                // Every sample is stored twice so the last TAPS are always contiguous
+                std::copy(run.begin() + count - 1, run.begin() + count - 1 + TAPS, hist);
+                std::copy(run.begin() + count - 1, run.begin() + count - 1 + TAPS, hist + TAPS);
+                pos[c] = 0;
+            }
+        }
+    }
+
+    // Fills the history with the frames before this meter's range. Only the
+    // last TAPS matter, so the interpolated values match an in-order run.
+    void warmUp(const float* samples, size_t frames) {
+        size_t first = frames > static_cast<size_t>(TAPS) ? frames - TAPS : 0;
+        for (int c = 0; c < channels; ++c) {
+            float* hist = &history[c * 2 * TAPS];
+            int at = pos[c];
+            for (size_t f = first; f < frames; ++f) {
+                hist[at] = hist[at + TAPS] = samples[f * channels + c];
+                at = at + 1 == TAPS ? 0 : at + 1;
+            }
+            pos[c] = at;
+        }
+    }
+
+    // Takes in the meter of the range that follows this one
+    void merge(const TruePeakMeter& later) {
+        peak = std::max(peak, later.peak);
+        history = later.history;
+        pos = later.pos;
+    }
+
+    // Linear true peak so far; never below the sample peak
+    float truePeak() const {
+        return peak;
+    }
+};
+
+#endif // LOUDNESS_H
@@ -1,8 +1,10 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 #include <algorithm> 
-#include <queue>     
 #include <cmath>     
 #include <fstream>
 #include <ctime>
@@ -11,323 +13,3332 @@
 #include <dirent.h>   
 #include <sys/stat.h> 
 #include <pthread.h> 
+#include <cerrno>
+#include <functional>
+#include <queue>
+#include <csignal>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include "audio_kernels.h"
+#include "thread_pool.h"
+#include "cpu_topology.h"
+#include "async_logger.h"
+#include "bounded_queue.h"
+#include "wav_mmap.h"
+#include "sample_buffer.h"
+#include "metrics.h"
+#include "manifest.h"
+#include "stats_cache.h"
+#include "job_server.h"
+#include "uring_io.h"
+#include "loudness.h"
+#include "channel_kernels.h"
+#include "audio_pack.h"
+#include "run_journal.h"
+#include "memory_budget.h"
+#include "gpu_offload.h"
+#include "shard_plan.h"
 using namespace std; 
 
 
-pthread_mutex_t global_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t new_task = PTHREAD_COND_INITIALIZER;     
-pthread_cond_t task_done = PTHREAD_COND_INITIALIZER;      
-volatile bool stop_threads = false;                     
-int active_task_cnt = 0;                             
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER; // Console output only
+AsyncLogger app_log; // log.txt, opened once in main
+bool use_mmap_input = true; // Map canonical PCM16/PCM24/float WAV files instead of decoding them
+bool use_uring = false;     // Read those files and write every output through io_uring
+
+// Requests each thread's ring keeps in flight: 1 MB reads, 512 KB writes
+const unsigned URING_DEPTH = 16;
+
+// This thread's io_uring, set up on first use; null when the kernel refuses
+IoUring* threadRing() {
+    static thread_local IoUring ring;
+    static thread_local bool tried = false;
+    if (!tried) {
+        tried = true;
+        ring.init(URING_DEPTH);
+    }
+    return ring.isOpen() ? &ring : nullptr;
+}
+
+// libsndfile virtual I/O over a UringSink, for output files
+sf_count_t sinkLength(void* user) {
+    return static_cast<UringSink*>(user)->size();
+}
+
+sf_count_t sinkSeek(sf_count_t offset, int whence, void* user) {
+    return static_cast<UringSink*>(user)->seek(offset, whence);
+}
+
+sf_count_t sinkRead(void*, sf_count_t, void*) {
+    return 0; // Outputs are write-only
+}
+
+sf_count_t sinkWrite(const void* data, sf_count_t count, void* user) {
+    return static_cast<UringSink*>(user)->write(data, count);
+}
+
+sf_count_t sinkTell(void* user) {
+    return static_cast<UringSink*>(user)->tell();
+}
+
+SF_VIRTUAL_IO uring_vio = {sinkLength, sinkSeek, sinkRead, sinkWrite, sinkTell};
+
+// The same over a record of the output pack
+sf_count_t recordLength(void* user) {
+    return static_cast<PackRecord*>(user)->size();
+}
+
+sf_count_t recordSeek(sf_count_t offset, int whence, void* user) {
+    return static_cast<PackRecord*>(user)->seek(offset, whence);
+}
+
+sf_count_t recordWrite(const void* data, sf_count_t count, void* user) {
+    return static_cast<PackRecord*>(user)->write(data, count);
+}
+
+sf_count_t recordTell(void* user) {
+    return static_cast<PackRecord*>(user)->tell();
+}
+
+SF_VIRTUAL_IO pack_vio = {recordLength, recordSeek, sinkRead, recordWrite, recordTell};
+bool use_pack = false; // Append outputs to the shards of output_pack instead of writing files
+PackWriter output_pack;
+int output_subtype = 0; // SF_FORMAT_* subtype for outputs, or 0 to keep each input's own
+bool use_dither = false; // TPDF dither when quantizing to 16- or 24-bit PCM
+bool incremental = false; // Skip inputs whose output the manifest shows is up to date
+Manifest output_manifest;
+bool journaling = false; // Note each finished input in run_journal, for --resume
+RunJournal run_journal;
+bool reporting = false; // --node: note each output and its stats in node_report
+NodeReport node_report;
+bool use_stats_cache = false; // Reuse earlier analysis results for inputs with a known content hash
+StatsCache stats_cache;
+bool loudness_mode = false;     // Normalize integrated loudness (EBU R128) instead of the peak
+float target_lufs = -23.0f;
+float true_peak_ceiling = 0.0f; // Linear true-peak limit for the gain, or 0 for none
+bool per_channel = false;       // Measure each channel; --channel-gain linked|unlinked
+bool unlinked_gain = false;     // Give each channel its own gain to the target peak
+
+// Loudness and true peak need their meters run over the whole signal
+bool measureLevels() {
+    return loudness_mode || true_peak_ceiling > 0.0f;
+}
+
+// Settings besides the target peak that change the output bytes; the
+// manifest reprocesses a file when they differ from the last run
+string outputOptions() {
+    string options = "format=" + to_string(output_subtype) + ";dither=" + (use_dither ? "1" : "0");
+    if (loudness_mode) {
+        options += ";lufs=" + to_string(target_lufs);
+    }
+    if (true_peak_ceiling > 0.0f) {
+        options += ";true_peak=" + to_string(true_peak_ceiling);
+    }
+    if (unlinked_gain) {
+        options += ";channels=unlinked";
+    }
+    return options;
+}
+
+// Per-stage timings and wait counters, exported by --metrics and --metrics-port
+MetricsRegistry app_metrics("audio_norm_");
+Histogram& load_timer = app_metrics.histogram("load", "Time spent in loadAudio per file");
+Histogram& normalize_timer = app_metrics.histogram("normalize", "Time spent in normalizePeak per file");
+Histogram& print_stats_timer = app_metrics.histogram("print_stats", "Time spent in printStats per file");
+Histogram& save_timer = app_metrics.histogram("save", "Time spent in saveAudio per file");
+Histogram& stream_timer = app_metrics.histogram("stream", "Time spent in normalizeStreaming per file");
+Histogram& gpu_batch_timer = app_metrics.histogram("gpu_batch", "Time spent on the device per --gpu batch");
+atomic<uint64_t> console_waits{0}; // Contended log_mutex acquisitions
+atomic<uint64_t> console_wait_ns{0};
+
+// An output at its own target peak, written from the same analysis as the
+// task's first output when several target peaks were given
+struct OutputTarget {
+    string output_filepath;
+    float peak_level;
+};
 
 struct AudioTask {
     string input_filepath;
     string output_filepath;
     string filename;
     float peak_level;
+    bool streaming; // Read the file twice in blocks instead of loading it whole
+    vector<OutputTarget> more_targets = {};
 };
 
-queue<AudioTask> task_queue;
+// Summary of a signal as written to the log by printStats. Min, max, peak and
+// RMS all scale linearly with gain, so the normalized stats are derived from
+// the original ones instead of rescanning the buffer.
+struct AudioStats {
+    float min_val = 0.0f;
+    float max_val = 0.0f;
+    float peak = 0.0f;
+    float rms = 0.0f;
+    size_t sample_count = 0;
+    float loudness = NAN;  // Integrated LUFS; NAN unless measured, -inf below the gate
+    float true_peak = NAN; // Linear; NAN unless measured
+    float gain = 1.0f; // Factor normalizePeak applied (1 when nothing was scaled)
+    vector<SampleStats> channels; // Per channel, with --channel-gain
+    vector<float> channel_gains;  // Per channel factors, instead of `gain`, when unlinked
 
+    static AudioStats fromSamples(const SampleStats& samples) {
+        AudioStats stats;
+        if (samples.count == 0) {
+            return stats;
+        }
+        stats.min_val = samples.min_val;
+        stats.max_val = samples.max_val;
+        stats.peak = samples.peak;
+        stats.rms = sqrt(samples.sum_squares / samples.count);
+        stats.sample_count = samples.count;
+        return stats;
+    }
 
-class AudioProcessor {
-private:
-    vector<float> audio_data;
-    SF_INFO sf_info;
-    string filename;
-    ofstream logs; 
+    // Overall stats merged from per-channel ones, which are kept
+    static AudioStats fromChannels(const vector<SampleStats>& per_channel) {
+        SampleStats total;
+        for (const SampleStats& c : per_channel) {
+            mergeSampleStats(total, c);
+        }
+        AudioStats stats = fromSamples(total);
+        stats.channels = per_channel;
+        return stats;
+    }
 
-public:
-    // Constructor 
-    AudioProcessor(const string& file_path, const string& log_path = "log.txt") : filename(file_path) {
-        memset(&sf_info, 0, sizeof(sf_info));
-        
-        // Acquire log lock to prevent race conditions
-        pthread_mutex_lock(&log_mutex);
-        logs.open(log_path, ios::app);
-        if (!logs.is_open()) {
-            cerr << "Could not open the log file " << log_path << endl; // Output if log file fails
-        } else {
-            auto now = time(nullptr);
-            logs << "\n========================================\n";
-            logs << "Processing started for " << filename << ": " << ctime(&now);
-            logs << "==========================================\n";
+    static AudioStats fromCache(const CachedStats& cached) {
+        AudioStats stats;
+        stats.min_val = cached.min_val;
+        stats.max_val = cached.max_val;
+        stats.peak = cached.peak;
+        stats.rms = cached.rms;
+        stats.sample_count = cached.sample_count;
+        return stats;
+    }
+
+    CachedStats toCache() const {
+        return CachedStats{min_val, max_val, peak, rms, sample_count};
+    }
+
+    static SampleStats scaledChannel(SampleStats channel, float factor) {
+        channel.min_val *= factor;
+        channel.max_val *= factor;
+        if (factor < 0.0f) {
+            swap(channel.min_val, channel.max_val);
         }
-        pthread_mutex_unlock(&log_mutex);
+        channel.peak *= abs(factor);
+        channel.sum_squares *= (double)factor * factor;
+        return channel;
     }
 
-    // Destructor ensures the log file is closed when the object is destroyed
-    ~AudioProcessor() {
-        pthread_mutex_lock(&log_mutex);
-        if (logs.is_open()) {
-            auto now = time(nullptr);
-            logs << "\n========================================\n";
-            logs << "Processing Ended for " << filename << ": " << ctime(&now);
-            logs << "\n========================================\n";
-            logs.close();
+    // Stats of the same signal multiplied by `factor`
+    AudioStats scaled(float factor) const {
+        AudioStats stats = *this;
+        stats.min_val = min_val * factor;
+        stats.max_val = max_val * factor;
+        if (factor < 0.0f) {
+            swap(stats.min_val, stats.max_val);
         }
-        pthread_mutex_unlock(&log_mutex);
+        stats.peak = peak * abs(factor);
+        stats.rms = rms * abs(factor);
+        stats.loudness = loudness + 20.0f * log10(abs(factor));
+        stats.true_peak = true_peak * abs(factor);
+        stats.gain = 1.0f;
+        for (SampleStats& c : stats.channels) {
+            c = scaledChannel(c, factor);
+        }
+        return stats;
     }
-    
 
-    void log(const string& message) {
+    // Stats after normalizePeak applied `gain`, or `channel_gains`
+    AudioStats normalized() const {
+        if (channel_gains.empty()) {
+            return scaled(gain);
+        }
+        vector<SampleStats> result(channels.size());
+        for (size_t c = 0; c < channels.size(); ++c) {
+            result[c] = scaledChannel(channels[c], channel_gains[c]);
+        }
+        return fromChannels(result);
+    }
+};
 
-        pthread_mutex_lock(&log_mutex);
-        if (logs.is_open()) {
-            logs << message << endl;
-            logs.flush(); 
+// Gain that brings a file to the target: its integrated loudness to
+// target_lufs in loudness mode, else its peak to target_peak. With a
+// true-peak ceiling the gain is lowered until the true peak stays under it.
+float targetGain(const AudioStats& stats, float target_peak) {
+    if (stats.peak == 0.0f) {
+        return 1.0f;
+    }
+    float gain = target_peak / stats.peak;
+    if (loudness_mode) {
+        if (!isfinite(stats.loudness)) {
+            return 1.0f; // Below the absolute gate
         }
-        pthread_mutex_unlock(&log_mutex); 
+        gain = pow(10.0f, (target_lufs - stats.loudness) / 20.0f);
+    }
+    if (true_peak_ceiling > 0.0f && stats.true_peak > 0.0f) {
+        gain = min(gain, true_peak_ceiling / stats.true_peak);
     }
+    return gain;
+}
 
-    // Loads audio data from the specified file
-    bool loadAudio() {
-        SNDFILE* infile = sf_open(filename.c_str(), SFM_READ, &sf_info);
-        if (!infile) {
-            log("Error: Cannot open file " + filename);
-            log("libsndfile error: " + string(sf_strerror(nullptr)));
-            return false;
+// Unlinked gains: each channel's peak to target_peak; silent channels keep 1
+vector<float> channelGains(const AudioStats& stats, float target_peak) {
+    vector<float> gains(stats.channels.size(), 1.0f);
+    for (size_t c = 0; c < gains.size(); ++c) {
+        if (stats.channels[c].peak > 0.0f) {
+            gains[c] = target_peak / stats.channels[c].peak;
         }
+    }
+    return gains;
+}
 
-        // Calculate total samples (frames * channels) and resize audio_data vector
-        sf_count_t total_samples = sf_info.frames * sf_info.channels;
-        audio_data.resize(total_samples);
+// `original` with the gain normalizePeak would choose for target_peak: one
+// factor, or one per channel when unlinked; 1 for silence
+AudioStats withTargetGain(AudioStats original, float target_peak) {
+    if (original.peak == 0.0f || (loudness_mode && !isfinite(original.loudness))) {
+        return original;
+    }
+    if (unlinked_gain) {
+        original.channel_gains = channelGains(original, target_peak);
+    } else {
+        original.gain = targetGain(original, target_peak);
+    }
+    return original;
+}
 
-        // Read audio frames into the vector.
-        sf_count_t read_count = sf_readf_float(infile, audio_data.data(), sf_info.frames);
-        if (read_count != sf_info.frames) {
-            log("Warning: Read " + to_string(read_count) + " frames, expected " + to_string(sf_info.frames));
+// The gain normalizing `original` to target_peak applies, as serve replies
+// and node reports give it: one factor, or one per channel comma-separated
+string gainText(const AudioStats& original, float target_peak) {
+    ostringstream out;
+    out.precision(9);
+    if (unlinked_gain) {
+        vector<float> gains = channelGains(original, target_peak);
+        for (size_t c = 0; c < gains.size(); ++c) {
+            out << (c ? "," : "") << gains[c];
         }
-        sf_close(infile);
-        return true;
+    } else {
+        out << targetGain(original, target_peak);
     }
+    return out.str();
+}
 
-    void normalizePeak(float target_peak = 1.0f) {
-        if (audio_data.empty()) {
-            log("Error: No audio data loaded, cannot normalize.");
+// Frames per sf_readf_float/sf_writef_float call in streaming mode
+const sf_count_t STREAM_BLOCK_FRAMES = 65536;
+
+// A reused AudioProcessor keeps its sample buffer between files, up to this
+// size; anything larger (a one-off long recording) is given back on finish()
+const size_t KEEP_BUFFER_BYTES = 256u << 20;
+
+// Intra-file parallelism: buffers of at least PARALLEL_MIN_SAMPLES are split
+// into PARALLEL_CHUNK_SAMPLES chunks that the workers of block_pool share.
+// Set in pool mode only; the pipeline already keeps its compute threads busy.
+const size_t PARALLEL_CHUNK_SAMPLES = 1 << 20;
+const size_t PARALLEL_MIN_SAMPLES = 4 * PARALLEL_CHUNK_SAMPLES;
+ThreadPool* block_pool = nullptr;
+
+// --max-mem: whole-file buffers are reserved against it before they are
+// allocated; null when there is no limit
+MemoryBudget* memory_budget = nullptr;
+
+// --gpu: the pipeline's peak-and-scale batches run on this device; null
+// when not asked for or no device could be opened
+GpuOffload* gpu_offload = nullptr;
+
+// Files at least this big are submitted ahead of the queue, so they do not
+// start last and leave one worker finishing them long after the rest
+const uint64_t PRIORITY_FILE_BYTES = 16u << 20;
+
+bool splitAcrossWorkers(size_t n) {
+    return block_pool != nullptr && block_pool->size() > 1 && n >= PARALLEL_MIN_SAMPLES;
+}
+
+// Calls fn(first, count) for consecutive chunks covering [0, n), in
+// parallel on block_pool when n is large enough to be worth it
+void forEachChunk(size_t n, const function<void(size_t, size_t)>& fn) {
+    if (!splitAcrossWorkers(n)) {
+        fn(0, n);
+        return;
+    }
+    size_t chunks = (n + PARALLEL_CHUNK_SAMPLES - 1) / PARALLEL_CHUNK_SAMPLES;
+    block_pool->parallelFor(chunks, [&](size_t c) {
+        size_t first = c * PARALLEL_CHUNK_SAMPLES;
+        fn(first, min(PARALLEL_CHUNK_SAMPLES, n - first));
+    });
+}
+
+// Stats of [0, n) from per-chunk partial stats, merged in chunk order
+SampleStats parallelStats(size_t n, const function<SampleStats(size_t, size_t)>& scan) {
+    if (!splitAcrossWorkers(n)) {
+        return scan(0, n);
+    }
+    vector<SampleStats> parts((n + PARALLEL_CHUNK_SAMPLES - 1) / PARALLEL_CHUNK_SAMPLES);
+    forEachChunk(n, [&](size_t first, size_t count) {
+        parts[first / PARALLEL_CHUNK_SAMPLES] = scan(first, count);
+    });
+    SampleStats total;
+    for (const SampleStats& part : parts) {
+        mergeSampleStats(total, part);
+    }
+    return total;
+}
+
+// Frames per chunk when per-channel work is split: about
+// PARALLEL_CHUNK_SAMPLES samples, never cutting a frame in two
+size_t frameChunk(int channels) {
+    return max<size_t>(1, PARALLEL_CHUNK_SAMPLES / channels);
+}
+
+// forEachChunk over whole frames, for kernels that track channels
+void forEachFrameChunk(size_t frames, int channels, const function<void(size_t, size_t)>& fn) {
+    if (!splitAcrossWorkers(frames * channels)) {
+        fn(0, frames);
+        return;
+    }
+    size_t chunk = frameChunk(channels);
+    block_pool->parallelFor((frames + chunk - 1) / chunk, [&](size_t c) {
+        size_t first = c * chunk;
+        fn(first, min(chunk, frames - first));
+    });
+}
+
+// Per-channel stats of `frames` interleaved frames of `frame_bytes` each
+vector<SampleStats> parallelChannelStats(const ChannelKernels& kernels, const uint8_t* src, size_t frame_bytes,
+                                         size_t frames, int channels) {
+    size_t chunk = frameChunk(channels);
+    vector<SampleStats> parts(max<size_t>(1, (frames + chunk - 1) / chunk) * channels);
+    forEachFrameChunk(frames, channels, [&](size_t first, size_t count) {
+        kernels.stats(src + first * frame_bytes, count, channels, &parts[first / chunk * channels]);
+    });
+    vector<SampleStats> total(channels);
+    for (size_t i = 0; i < parts.size(); ++i) {
+        mergeSampleStats(total[i % channels], parts[i]);
+    }
+    return total;
+}
+
+// The loudness and true-peak meters a run needs, fed the same float blocks
+// as the stats kernel
+struct LevelMeters {
+    int channels;
+    int sample_rate;
+    bool split; // A file splitAcrossWorkers accepts: blocks are metered in ranges
+    LoudnessMeter loudness;
+    TruePeakMeter true_peak;
+
+    LevelMeters(int channel_count, int rate, bool split_ranges = false)
+        : channels(channel_count), sample_rate(rate), split(split_ranges), loudness(channel_count, rate),
+          true_peak(channel_count, rate) {}
+
+    explicit LevelMeters(const SF_INFO& info)
+        : LevelMeters(info.channels, info.samplerate, splitAcrossWorkers(info.frames * info.channels)) {}
+
+    // Blocks of a large file are split into ranges that block_pool meters at
+    // once. A range after the first starts on a 100 ms step boundary with
+    // meters of its own, warmed up on the frames before it, and is merged in
+    // order; the result matches an in-order pass to double rounding.
+    void process(const float* block, size_t frames) {
+        size_t workers = split ? block_pool->size() : 1;
+        size_t step = loudness.stepFrames();
+        size_t warm = loudness.warmUpFrames();
+        size_t range = max(frames / workers, 4 * warm) / step * step;
+        size_t head = loudness.framesToStep() % step + range; // Frames the meters themselves take
+        if (workers == 1 || head >= frames) {
+            processInOrder(block, frames);
             return;
         }
+        size_t count = 1 + (frames - head + range - 1) / range;
+        vector<unique_ptr<LevelMeters>> later(count - 1);
+        block_pool->parallelFor(count, [&](size_t r) {
+            if (r == 0) {
+                processInOrder(block, head);
+                return;
+            }
+            size_t first = head + (r - 1) * range;
+            later[r - 1].reset(new LevelMeters(channels, sample_rate));
+            later[r - 1]->warmUp(block + (first - warm) * channels, warm);
+            later[r - 1]->processInOrder(block + first * channels, min(range, frames - first));
+        });
+        for (const unique_ptr<LevelMeters>& meters : later) {
+            merge(*meters);
+        }
+    }
 
-        // Find the absolute peak magnitude in the audio data
-        float peak_magnitude = 0.0f;
-        for (const float& sample : audio_data) {
-            peak_magnitude = max(peak_magnitude, abs(sample));
+    void processInOrder(const float* block, size_t frames) {
+        if (loudness_mode) {
+            loudness.process(block, frames);
         }
+        if (true_peak_ceiling > 0.0f) {
+            true_peak.process(block, frames);
+        }
+    }
 
-        if (peak_magnitude == 0.0f) {
-            log("Warning: Audio contains only silence.");
-            return;
+    void warmUp(const float* block, size_t frames) {
+        if (loudness_mode) {
+            loudness.warmUp(block, frames);
+        }
+        if (true_peak_ceiling > 0.0f) {
+            true_peak.warmUp(block, frames);
         }
+    }
 
-        // Calculate the normalization factor and apply it to all samples
-        float normalization_factor = target_peak / peak_magnitude;
-        
-        log("Original peak magnitude: " + to_string(peak_magnitude));
-        log("Normalization factor: " + to_string(normalization_factor));
+    void merge(const LevelMeters& later) {
+        loudness.merge(later.loudness);
+        true_peak.merge(later.true_peak);
+    }
 
-        for (float& sample : audio_data) {
-            sample *= normalization_factor;
+    void finish(AudioStats& stats) const {
+        if (loudness_mode) {
+            stats.loudness = loudness.integratedLufs();
+        }
+        if (true_peak_ceiling > 0.0f) {
+            stats.true_peak = true_peak.truePeak();
         }
-
-        log("Peak normalized to " + to_string(target_peak));
     }
+};
 
-    // Prints various statistics about the audio data to the log file
-    void printStats(const string& title) {
-        if (audio_data.empty()) {
-            log("No audio data to print statistics for.");
+// FLAC decodes several times slower than the kernels consume samples, so
+// one large FLAC file would leave the other workers idle. Its frames are
+// split into ranges of about PARALLEL_CHUNK_SAMPLES samples that block_pool
+// decodes at once, each range through a libsndfile handle of its own seeked
+// to its first frame; libFLAC finds it from the file's seek table, or by
+// bisection without one. Other compressed formats decode in order.
+bool splitDecode(const SF_INFO& info) {
+    return (info.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_FLAC && info.seekable &&
+           splitAcrossWorkers(info.frames * info.channels);
+}
+
+size_t decodeRangeCount(const SF_INFO& info) {
+    size_t chunk = frameChunk(info.channels);
+    return (info.frames + chunk - 1) / chunk;
+}
+
+// Calls read(handle, range, first, count) for every range on block_pool,
+// with `handle` positioned at frame `first`; read must consume all `count`
+// frames. False if any range failed, which leaves the caller to decode the
+// file in order instead.
+bool decodeRanges(const string& path, const SF_INFO& info,
+                  const function<bool(SNDFILE*, size_t, sf_count_t, sf_count_t)>& read) {
+    sf_count_t chunk = frameChunk(info.channels);
+    atomic<bool> ok(true);
+    block_pool->parallelFor(decodeRangeCount(info), [&](size_t r) {
+        if (!ok.load(memory_order_relaxed)) {
             return;
         }
-
-        // Find min, max, and overall peak magnitude
-        float min_val = *min_element(audio_data.begin(), audio_data.end());
-        float max_val = *max_element(audio_data.begin(), audio_data.end());
-        float peak = max(abs(min_val), abs(max_val));
-        
-        // Calculate RMS (Root Mean Square)
-        float sum_squares = 0.0f;
-        for (const float& sample : audio_data) {
-            sum_squares += sample * sample;
+        SF_INFO range_info;
+        memset(&range_info, 0, sizeof(range_info));
+        SNDFILE* in = sf_open(path.c_str(), SFM_READ, &range_info);
+        sf_count_t first = r * chunk;
+        sf_count_t count = min(chunk, info.frames - first);
+        bool done = in != nullptr && range_info.frames == info.frames && range_info.channels == info.channels &&
+                    sf_seek(in, first, SEEK_SET) == first && read(in, r, first, count);
+        if (in != nullptr) {
+            sf_close(in);
+        }
+        if (!done) {
+            ok.store(false, memory_order_relaxed);
         }
-        float rms = sqrt(sum_squares / audio_data.size());
+    });
+    return ok.load();
+}
 
-        log("\n--- " + title + " ---");
-        log("Min value: " + to_string(min_val));
-        log("Max value: + " + to_string(max_val));
-        log("Peak magnitude: " + to_string(peak));
-        log("RMS: " + to_string(rms));
-        // Avoiding division by zero
-        log("Peak-to-RMS ratio: " + to_string(rms > 0 ? peak / rms : 0.0f));
+// Output format for a file whose input was `input`: the same container and
+// sample subtype, unless --format chose another subtype. Combinations
+// libsndfile cannot write fall back to 32-bit float WAV. Pack records are
+// headerless little-endian PCM16, PCM24 or float.
+int outputFormatFor(const SF_INFO& input) {
+    if (use_pack) {
+        int subtype = output_subtype ? output_subtype : (input.format & SF_FORMAT_SUBMASK);
+        if (subtype != SF_FORMAT_PCM_16 && subtype != SF_FORMAT_PCM_24) {
+            subtype = SF_FORMAT_FLOAT;
+        }
+        return SF_FORMAT_RAW | SF_ENDIAN_LITTLE | subtype;
     }
+    SF_INFO probe = input;
+    int subtype = output_subtype ? output_subtype : (input.format & SF_FORMAT_SUBMASK);
+    probe.format = (input.format & SF_FORMAT_TYPEMASK) | subtype;
+    if (sf_format_check(&probe)) {
+        return probe.format;
+    }
+    probe.format = SF_FORMAT_WAV | subtype;
+    if (sf_format_check(&probe)) {
+        return probe.format;
+    }
+    return SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+}
 
+// Where an output that falls back to WAV goes instead of `path`: ".wav" is
+// appended (x.flac -> x.flac.wav), so the name says what the file holds and
+// cannot collide with the output of an x.wav next to the input
+string wavFallbackPath(const string& path) {
+    return path + ".wav";
+}
 
-    bool saveAudio(const string& output_filename) {
-        SF_INFO output_info = sf_info; 
-        output_info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+// The path an output of `format` for `input` is written to: `path`, unless
+// outputFormatFor had to leave the input's container (e.g. --format float
+// on FLAC, or MP3 with a libsndfile built without LAME)
+string outputPathFor(const string& path, const SF_INFO& input, int format) {
+    if (use_pack || (format & SF_FORMAT_TYPEMASK) == (input.format & SF_FORMAT_TYPEMASK)) {
+        return path;
+    }
+    return wavFallbackPath(path);
+}
 
+// The output of an earlier run for `path`, under the name it was given
+string existingOutputPath(const string& path) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0 && stat(wavFallbackPath(path).c_str(), &sb) == 0) {
+        return wavFallbackPath(path);
+    }
+    return path;
+}
 
-        SNDFILE* outfile = sf_open(output_filename.c_str(), SFM_WRITE, &output_info);
-        if (!outfile) {
-            log("Error: Cannot create output file " + output_filename);
-            log("libsndfile error: " + string(sf_strerror(nullptr)));
-            return false;
-        }
+// Writes float samples to an output file in its own sample format. 16- and
+// 24-bit PCM are rounded, clipped and optionally dithered here with the
+// vector kernels; other subtypes are left to libsndfile, with clipping on.
+class SampleWriter {
+private:
+    SNDFILE* file;
+    int channels;
+    int subtype;
+    DitherState dither;
+    vector<int16_t> pcm16;
+    vector<int32_t> pcm24;
 
-        sf_count_t written = sf_writef_float(outfile, audio_data.data(), sf_info.frames);
-        if (written != sf_info.frames) {
-            log("Warning: Wrote " + to_string(written) + " frames, expected " + to_string(sf_info.frames));
+public:
+    SampleWriter(SNDFILE* outfile, const SF_INFO& info)
+        : file(outfile), channels(info.channels), subtype(info.format & SF_FORMAT_SUBMASK) {
+        if (subtype == SF_FORMAT_PCM_16) {
+            pcm16.resize(STREAM_BLOCK_FRAMES * channels);
+        } else if (subtype == SF_FORMAT_PCM_24) {
+            pcm24.resize(STREAM_BLOCK_FRAMES * channels);
+        } else {
+            sf_command(file, SFC_SET_CLIPPING, NULL, SF_TRUE);
         }
+    }
 
-        sf_close(outfile);
-        log("Saved to: " + output_filename);
-        return true;
+    // Returns the number of frames written
+    sf_count_t write(const float* samples, sf_count_t frames) {
+        if (subtype != SF_FORMAT_PCM_16 && subtype != SF_FORMAT_PCM_24) {
+            return sf_writef_float(file, samples, frames);
+        }
+        DitherState* noise = use_dither ? &dither : nullptr;
+        sf_count_t written = 0;
+        for (sf_count_t frame = 0; frame < frames; frame += STREAM_BLOCK_FRAMES) {
+            sf_count_t count = min(STREAM_BLOCK_FRAMES, frames - frame);
+            const float* src = samples + frame * channels;
+            if (subtype == SF_FORMAT_PCM_16) {
+                convertFloatToPcm16(src, pcm16.data(), count * channels, noise);
+                written += sf_writef_short(file, pcm16.data(), count);
+            } else {
+                convertFloatToPcm24(src, pcm24.data(), count * channels, noise);
+                written += sf_writef_int(file, pcm24.data(), count);
+            }
+        }
+        return written;
     }
 };
 
-bool isAudioFile(const string& filename) {
-    string lower_filename = filename;
-    transform(lower_filename.begin(), lower_filename.end(), lower_filename.begin(), ::tolower);
-    return lower_filename.rfind(".wav") != string::npos;
-}
 
-//thread function
-void* thread_function(void* arg) {
-    while (true) {
-        AudioTask task;
-        pthread_mutex_lock(&global_queue_mutex); 
+// Normalizes one file at a time. A processor can be reused: reset() starts
+// the next file and finish() ends the current one, so the sample and block
+// buffers are allocated once per worker instead of once per file.
+class AudioProcessor {
+private:
+    SampleBuffer audio_data;
+    SampleBuffer block_buffer; // Streaming and mapped-save scratch, STREAM_BLOCK_FRAMES frames
+    SampleBuffer target_block; // Scaled copy of block_buffer when streaming to several targets
+    SF_INFO sf_info;
+    string filename;
+    bool active = false;
+    // Zero-copy input: when the file is mapped, audio_data stays empty and the
+    // gain is applied while converting blocks for saveAudio
+    MappedWav mapped;
+    IoBuffer file_bytes;    // Whole input read by io_uring, parsed in place by `mapped`
+    // Outputs open at the same time (several with more than one target), each
+    // with its own io_uring sink and staging blocks, or its own pack record.
+    // Slot 0 uses the thread's ring; the others get their own, as completions
+    // are not tagged by sink.
+    struct OutputSlot {
+        IoBuffer staging;
+        unique_ptr<UringSink> sink;
+        IoUring ring;
+        PackRecord record;
+        string path; // Of the open output, after outputPathFor
+    };
+    vector<unique_ptr<OutputSlot>> output_slots;
+    vector<string> saved_outputs; // Paths of the outputs written for this file
+    float pending_gain = 1.0f;
+    vector<float> pending_gains; // Per channel, instead of pending_gain, when unlinked
+    // Per-channel kernels picked for this file's layout: for the samples as
+    // stored (mapped encoding, or float) and for decoded float blocks
+    ChannelKernels source_kernels;
+    ChannelKernels block_kernels;
+    AudioStats original_stats; // Of the input, set by normalizePeak / normalizeStreaming
+    size_t charged = 0;        // Bytes of memory_budget reserved for this file
+
+    static size_t roundToHugePage(size_t bytes) {
+        const size_t HUGE_PAGE = 2u << 20;
+        return (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    }
 
+    bool hasSamples() const {
+        return mapped.isOpen() ? mapped.sampleCount() > 0 : !audio_data.empty();
+    }
 
-        while (task_queue.empty() && !stop_threads) {
-            pthread_cond_wait(&new_task, &global_queue_mutex);
+    // Stats of `count` source samples from `first`, on the mapped pages if mapped
+    SampleStats scanRange(size_t first, size_t count) const {
+        if (!mapped.isOpen()) {
+            return computeSampleStats(audio_data.data() + first, count);
         }
+        const uint8_t* src = mapped.samples + first * wavBytesPerSample(mapped.format);
+        switch (mapped.format) {
+            case WavSampleFormat::Pcm16:
+                return computeSampleStatsPcm16(reinterpret_cast<const int16_t*>(src), count);
+            case WavSampleFormat::Pcm24:
+                return computeSampleStatsPcm24(src, count);
+            case WavSampleFormat::Float32:
+                break;
+        }
+        return computeSampleStats(reinterpret_cast<const float*>(src), count);
+    }
 
+    // One stats pass over the source samples, split across workers for large files
+    SampleStats scanSamples() const {
+        size_t n = mapped.isOpen() ? mapped.sampleCount() : audio_data.size();
+        return parallelStats(n, [this](size_t first, size_t count) { return scanRange(first, count); });
+    }
+
+    // Per-channel stats of the source samples, with the kernels for its layout
+    AudioStats scanChannels() const {
+        size_t sample_bytes = mapped.isOpen() ? wavBytesPerSample(mapped.format) : sizeof(float);
+        const uint8_t* src = mapped.isOpen() ? mapped.samples : reinterpret_cast<const uint8_t*>(audio_data.data());
+        return AudioStats::fromChannels(parallelChannelStats(source_kernels, src, sample_bytes * sf_info.channels,
+                                                             sf_info.frames, sf_info.channels));
+    }
+
+    // Picks the per-channel kernels once sf_info describes the file
+    void selectChannelKernels() {
+        WavSampleFormat stored = mapped.isOpen() ? mapped.format : WavSampleFormat::Float32;
+        source_kernels = channelKernelsFor(stored, sf_info.channels);
+        block_kernels = channelKernelsFor(WavSampleFormat::Float32, sf_info.channels);
+    }
+
+    // Converts `count` mapped samples starting at `first` to float, times gain
+    void convertMapped(size_t first, size_t count, float* dst, float gain) const {
+        const uint8_t* src = mapped.samples + first * wavBytesPerSample(mapped.format);
+        switch (mapped.format) {
+            case WavSampleFormat::Pcm16:
+                convertPcm16ToFloat(reinterpret_cast<const int16_t*>(src), dst, count, gain);
+                break;
+            case WavSampleFormat::Pcm24:
+                convertPcm24ToFloat(src, dst, count, gain);
+                break;
+            case WavSampleFormat::Float32:
+                scaleSamplesInto(reinterpret_cast<const float*>(src), dst, count, gain);
+                break;
+        }
+    }
 
-        if (stop_threads && task_queue.empty()) {
-            pthread_mutex_unlock(&global_queue_mutex);
-            break;
+    // Converts `frames` source frames from `first_frame` (mapped, or the
+    // unscaled sample buffer) to float times `gain`, or times each channel's
+    // entry in `gains` when that is not empty
+    void convertSource(size_t first_frame, size_t frames, float* dst, float gain, const vector<float>& gains) const {
+        int channels = sf_info.channels;
+        if (!gains.empty()) {
+            size_t frame_bytes = channels * (mapped.isOpen() ? wavBytesPerSample(mapped.format) : sizeof(float));
+            const uint8_t* src = (mapped.isOpen() ? mapped.samples : reinterpret_cast<const uint8_t*>(audio_data.data())) +
+                                 first_frame * frame_bytes;
+            forEachFrameChunk(frames, channels, [&](size_t first, size_t count) {
+                source_kernels.convert(src + first * frame_bytes, dst + first * channels, count, channels, gains.data());
+            });
+            return;
         }
+        size_t base = first_frame * channels;
+        forEachChunk(frames * channels, [this, base, dst, gain](size_t first, size_t count) {
+            if (mapped.isOpen()) {
+                convertMapped(base + first, count, dst + first, gain);
+            } else {
+                scaleSamplesInto(audio_data.data() + base + first, dst + first, count, gain);
+            }
+        });
+    }
 
-        task = task_queue.front();
-        task_queue.pop();
-        pthread_mutex_unlock(&global_queue_mutex); /
+    // ctime_r keeps the timestamps safe to build on several workers at once
+    static string timestamp() {
+        char buf[32];
+        time_t now = time(nullptr);
+        return ctime_r(&now, buf) ? string(buf) : string("\n");
+    }
+
+    // Frames per streaming read or mapped conversion batch: one block, or one
+    // block per worker when a large file is split across the pool
+    sf_count_t batchFrames() const {
+        bool split = splitAcrossWorkers(sf_info.frames * sf_info.channels);
+        return STREAM_BLOCK_FRAMES * (split ? block_pool->size() : 1);
+    }
 
+    float* blockBuffer(sf_count_t frames) {
+        block_buffer.resize(frames * sf_info.channels);
+        return block_buffer.data();
+    }
 
-        AudioProcessor processor(task.input_filepath, "log.txt"); 
-        
-        if (processor.loadAudio()) {
-            processor.printStats("Original Stats for " + task.filename);
-            processor.normalizePeak(task.peak_level);
-            processor.printStats("Normalized Stats for " + task.filename);
-            if (processor.saveAudio(task.output_filepath)) {
-                pthread_mutex_lock(&log_mutex);
-                cout << "Successfully processed and saved: " << task.output_filepath << endl;
-                pthread_mutex_unlock(&log_mutex);
+    // Sample stats plus loudness and true peak in one pass. Decoded samples
+    // are metered whole, mapped ones one batch at a time after converting
+    // them into the block buffer, which both the kernel and the meters read.
+    // LevelMeters splits a large file or batch across the pool.
+    AudioStats measureSamples() {
+        LevelMeters meters(sf_info);
+        SampleStats total;
+        vector<SampleStats> channels(per_channel ? sf_info.channels : 0);
+        vector<SampleStats> block_channels(channels.size());
+        sf_count_t batch = mapped.isOpen() ? batchFrames() : max<sf_count_t>(sf_info.frames, 1);
+        float* block = mapped.isOpen() ? blockBuffer(batch) : nullptr;
+        for (sf_count_t frame = 0; frame < sf_info.frames; frame += batch) {
+            sf_count_t frames = min(batch, sf_info.frames - frame);
+            size_t first = frame * sf_info.channels;
+            const float* src = audio_data.data() + first;
+            if (mapped.isOpen()) {
+                convertMapped(first, frames * sf_info.channels, block, 1.0f);
+                src = block;
+            }
+            if (per_channel) {
+                block_kernels.stats(reinterpret_cast<const uint8_t*>(src), frames, sf_info.channels,
+                                    block_channels.data());
+                for (size_t c = 0; c < channels.size(); ++c) {
+                    mergeSampleStats(channels[c], block_channels[c]);
+                }
             } else {
-                pthread_mutex_lock(&log_mutex);
-                cerr << "Failed to save: " << task.output_filepath << endl;
-                pthread_mutex_unlock(&log_mutex);
+                mergeSampleStats(total, computeSampleStats(src, frames * sf_info.channels));
             }
-        } else {
-            pthread_mutex_lock(&log_mutex);
-            cerr << "Failed to load audio" << task.input_filepath << endl;
-            pthread_mutex_unlock(&log_mutex);
+            meters.process(src, frames);
         }
+        AudioStats stats = per_channel ? AudioStats::fromChannels(channels) : AudioStats::fromSamples(total);
+        meters.finish(stats);
+        return stats;
+    }
 
-        pthread_mutex_lock(&global_queue_mutex);
-        active_task_cnt--;
-        if (active_task_cnt == 0 && task_queue.empty()) {
-            pthread_cond_signal(&task_done); 
+    // Logs the level the gain was computed from and the gain itself
+    void logGain(const AudioStats& stats, float normalization_factor) {
+        if (loudness_mode) {
+            log("Original loudness: " + to_string(stats.loudness) + " LUFS");
+        } else {
+            log("Original peak magnitude: " + to_string(stats.peak));
         }
-        pthread_mutex_unlock(&global_queue_mutex);
+        log("Normalization factor: " + to_string(normalization_factor));
     }
-    return nullptr;
-}
 
+    void logChannelGains(const vector<float>& gains) {
+        string line = "Channel normalization factors:";
+        for (float g : gains) {
+            line += " " + to_string(g);
+        }
+        log(line);
+    }
 
-int main(int argc, char* argv[]) {
+    void logTargetReached(float target_peak) {
+        if (loudness_mode) {
+            log("Loudness normalized to " + to_string(target_lufs) + " LUFS");
+        } else {
+            log("Peak normalized to " + to_string(target_peak));
+        }
+    }
 
-    string input_dir_path = argv[1];
-    string output_dir_path = argv[2];
-    float peak_level = (argc > 3) ? stof(argv[3]) : 1.0f;
+public:
+    AudioProcessor() {
+        memset(&sf_info, 0, sizeof(sf_info));
+    }
 
-    cout << "Processing audio files from: " << input_dir_path << endl;
-    cout << "Saving normalized files to: " << output_dir_path << endl;
-    cout << "Target peak level: " << peak_level << endl;
+    explicit AudioProcessor(const string& file_path) : AudioProcessor() {
+        reset(file_path);
+    }
 
-    // Check if input_dir_path is a directory
-    struct stat sb;
-    if (stat(input_dir_path.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode)) {
-        cerr << "Error: Input path '" << input_dir_path << "' is not a valid directory." << endl;
-        return 1;
+    // Destructor writes the closing banner for the current file
+    ~AudioProcessor() {
+        finish();
     }
 
- 
- 
-    int num_threads = 4; // Number of threads
-    vector<pthread_t> threads(num_threads);
+    // Starts processing `file_path`, ending the previous file if there was one
+    void reset(const string& file_path) {
+        finish();
+        filename = file_path;
+        memset(&sf_info, 0, sizeof(sf_info));
+        pending_gain = 1.0f;
+        pending_gains.clear();
+        original_stats = AudioStats();
+        saved_outputs.clear();
+        active = true;
+        app_log.log("\n========================================\n"
+                    "Processing started for " + filename + ": " + timestamp() +
+                    "==========================================");
+    }
 
-    DIR *dir;
-    struct dirent *ent;
-    
-    if ((dir = opendir(input_dir_path.c_str())) != nullptr) {
-        while ((ent = readdir(dir)) != nullptr) {
-            string filename = ent->d_name;
-            if (filename == "." || filename == "..") {
-                continue;
+    // Ends the current file: writes its closing banner, unmaps the input and
+    // keeps the buffers for the next file unless they grew unusually large
+    void finish() {
+        if (!active) {
+            return;
+        }
+        active = false;
+        mapped.close();
+        audio_data.clear();
+        if (audio_data.capacityBytes() > KEEP_BUFFER_BYTES) {
+            audio_data.release();
+        }
+        if (file_bytes.capacityBytes() > KEEP_BUFFER_BYTES) {
+            file_bytes.release();
+        }
+        if (charged > 0) {
+            // Under --max-mem the buffers are not kept, so idle workers hold
+            // none of the budget a waiting one needs
+            audio_data.release();
+            file_bytes.release();
+            block_buffer.release();
+            target_block.release();
+            for (unique_ptr<OutputSlot>& slot : output_slots) {
+                slot->staging.release();
+                slot->record.releaseBuffer();
             }
+            memory_budget->release(charged);
+            charged = 0;
+        }
+        app_log.log("\n========================================\n"
+                    "Processing Ended for " + filename + ": " + timestamp() +
+                    "\n========================================");
+    }
+    
+    // Queues a line for the background log writer; never blocks on file I/O
+    void log(const string& message) {
+        app_log.log(message);
+    }
 
-            string full_input_path = input_dir_path + "/" + filename;
-            string full_output_path = output_dir_path + "/normalised_" + filename; 
-
-            struct stat file_sb;
-            if (stat(full_input_path.c_str(), &file_sb) == 0 && S_ISREG(file_sb.st_mode) && isAudioFile(filename)) {
-                pthread_mutex_lock(&global_queue_mutex); 
-                task_queue.push({full_input_path, full_output_path, filename, peak_level});
-                active_task_cnt++; 
-                pthread_mutex_unlock(&global_queue_mutex);
+    // Anonymous memory loadAudio will allocate for this file, from its
+    // headers: the whole file when io_uring reads it, plus the decoded floats
+    // when libsndfile decodes it. Mapped input needs none; its pages are page
+    // cache the kernel can drop. Rounded up past the buffers' own rounding.
+    // `info` receives the layout from the headers. SIZE_MAX if the file
+    // cannot be opened, which sends it down the streaming path to report
+    // the error there.
+    size_t loadBytes(SF_INFO& info) const {
+        size_t bytes = 0;
+        memset(&info, 0, sizeof(info));
+        if (use_mmap_input) {
+            if (use_uring) {
+                FileStamp stamp;
+                if (!statFile(filename, stamp)) {
+                    return SIZE_MAX;
+                }
+                bytes = roundToHugePage(stamp.size + (8u << 10)); // readFile pads by up to two 4 KB blocks
+            }
+            MappedWav probe;
+            if (probe.open(filename)) {
+                info.frames = probe.frames;
+                info.channels = probe.channels;
+                info.format = SF_FORMAT_WAV;
+                return bytes;
             }
         }
-        closedir(dir);
-    } else {
-        cerr << "Error: Could not open directory " << input_dir_path << endl;
-        perror("opendir");
-        return 1;
+        SNDFILE* infile = sf_open(filename.c_str(), SFM_READ, &info);
+        if (!infile) {
+            return SIZE_MAX;
+        }
+        sf_close(infile);
+        return bytes + roundToHugePage(info.frames * info.channels * sizeof(float));
     }
 
-    if (active_task_cnt == 0) {
-        cout << "No audio files found to process." << endl;
-        return 0;
+    // Scratch a file of layout `info` with `outputs` outputs needs on top of
+    // its samples, whichever path it takes: the block buffer (one block per
+    // pool worker when the file is split), the scaled copy for several
+    // targets, each output's PCM conversion block and io_uring staging or
+    // pack append buffer, and the blocks of a parallel FLAC first pass
+    static size_t workingBytes(const SF_INFO& info, size_t outputs) {
+        size_t block = STREAM_BLOCK_FRAMES * info.channels * sizeof(float);
+        size_t bytes = block * (splitAcrossWorkers(info.frames * info.channels) ? block_pool->size() : 1);
+        if (outputs > 1) {
+            bytes *= 2;
+        }
+        size_t per_output = block; // SampleWriter's pcm16 or pcm24 block, at most 4 bytes a sample
+        if (use_uring) {
+            per_output += UringSink::stagingBytes(URING_DEPTH);
+        }
+        if (use_pack) {
+            per_output += PACK_APPEND_BYTES + PACK_PAGE;
+        }
+        bytes += per_output * outputs;
+        if (splitDecode(info)) {
+            bytes += block * min<size_t>(decodeRangeCount(info), block_pool->size());
+        }
+        return bytes;
     }
 
-    for (int i = 0; i < num_threads; ++i) {
-        if (pthread_create(&threads[i], NULL, thread_function, NULL) != 0) {
-            cerr << "Error: Could not create thread " << i << endl;
-            return 1;
+    // Reserves this file's memory against --max-mem, waiting for other
+    // workers to free it: its samples and scratch when `load` and they fit in
+    // the budget, else the scratch of streaming it. True when the file is to
+    // be loaded, false when it is to be streamed. Scratch larger than the
+    // whole budget is charged as the whole budget, so such a file runs alone.
+    bool admit(size_t outputs, bool load) {
+        if (memory_budget == nullptr) {
+            return load;
         }
+        SF_INFO info;
+        size_t bytes = loadBytes(info);
+        size_t scratch = bytes == SIZE_MAX ? 0 : workingBytes(info, outputs);
+        if (load && bytes != SIZE_MAX && memory_budget->fits(bytes + scratch)) {
+            memory_budget->acquire(bytes + scratch);
+            charged = bytes + scratch;
+            return true;
+        }
+        charged = min(scratch, memory_budget->limitBytes());
+        memory_budget->acquire(charged);
+        return false;
     }
 
+    // Canonical WAV input: read whole through io_uring when enabled, else
+    // mapped. The header is checked before the read, so a file libsndfile
+    // has to decode is not read in full first.
+    bool openRaw() {
+        IoUring* ring = use_uring ? threadRing() : nullptr;
+        size_t size;
+        if (ring != nullptr && MappedWav::probeFile(filename) && UringReader(*ring).readFile(filename, file_bytes, size)) {
+            return mapped.openBuffer(file_bytes.data(), size);
+        }
+        return mapped.open(filename);
+    }
 
-    pthread_cond_broadcast(&new_task);
-    pthread_mutex_lock(&global_queue_mutex);
+    IoUring* slotRing(size_t slot) {
+        if (!use_uring) {
+            return nullptr;
+        }
+        if (slot == 0) {
+            return threadRing();
+        }
+        IoUring& ring = output_slots[slot]->ring;
+        return ring.isOpen() || ring.init(URING_DEPTH) ? &ring : nullptr;
+    }
 
-    while (active_task_cnt > 0) { 
-        pthread_cond_wait(&task_done, &global_queue_mutex);
+    // fsync of a file or directory by path
+    static bool syncPath(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = fsync(fd) == 0;
+        return close(fd) == 0 && ok;
     }
-    pthread_mutex_unlock(&global_queue_mutex);
 
-    pthread_mutex_lock(&global_queue_mutex);
-    stop_threads = true;
-    pthread_cond_broadcast(&new_task); 
-    pthread_mutex_unlock(&global_queue_mutex);
+    // Outputs are written under this name and renamed once complete, so an
+    // interrupted run never leaves a partial file at the output path
+    static string partPath(const string& output_filename) {
+        return output_filename + ".part";
+    }
 
-    for (int i = 0; i < num_threads; ++i) {
-        pthread_join(threads[i], NULL);
+    // Creates the output file in `slot`, through an io_uring sink when
+    // enabled, or starts its record in the output pack. The file goes to
+    // outputPathFor(requested).
+    SNDFILE* openOutput(const string& requested, SF_INFO& output_info, size_t slot = 0) {
+        while (output_slots.size() <= slot) {
+            output_slots.emplace_back(new OutputSlot());
+        }
+        const string& output_filename = output_slots[slot]->path = outputPathFor(requested, sf_info, output_info.format);
+        if (use_pack) {
+            int subtype = output_info.format & SF_FORMAT_SUBMASK;
+            uint16_t format = subtype == SF_FORMAT_PCM_16 ? PackPcm16 : subtype == SF_FORMAT_PCM_24 ? PackPcm24 : PackFloat32;
+            PackRecord& record = output_slots[slot]->record;
+            if (!output_pack.begin(record, output_info.samplerate, output_info.channels, format)) {
+                return nullptr;
+            }
+            SNDFILE* outfile = sf_open_virtual(&pack_vio, SFM_WRITE, &output_info, &record);
+            if (!outfile) {
+                output_pack.abandon(record);
+            }
+            return outfile;
+        }
+        string part = partPath(output_filename);
+        IoUring* ring = slotRing(slot);
+        if (ring == nullptr) {
+            return sf_open(part.c_str(), SFM_WRITE, &output_info);
+        }
+        unique_ptr<UringSink>& sink = output_slots[slot]->sink;
+        sink.reset(new UringSink(*ring, output_slots[slot]->staging));
+        if (!sink->open(part, URING_DEPTH)) {
+            sink.reset();
+            return nullptr;
+        }
+        SNDFILE* outfile = sf_open_virtual(&uring_vio, SFM_WRITE, &output_info, sink.get());
+        if (!outfile) {
+            sink.reset();
+            unlink(part.c_str());
+        }
+        return outfile;
+    }
+
+    // Closes the output, flushes it to disk and renames it into place, so a
+    // file that is there (and journaled) is complete. False if fewer than
+    // `written` of the input's frames made it or the io_uring sink reported
+    // a failed write, which leaves no file behind. A pack record is indexed
+    // under the output's path below the pack instead, or dropped.
+    bool closeOutput(SNDFILE* outfile, sf_count_t written, size_t slot = 0) {
+        sf_close(outfile);
+        const string& output_filename = output_slots[slot]->path;
+        bool complete = written == sf_info.frames;
+        if (!complete) {
+            log("Error: Wrote " + to_string(written) + " frames to " + output_filename + ", expected " +
+                to_string(sf_info.frames));
+        }
+        PackRecord& record = output_slots[slot]->record;
+        if (record.isOpen()) {
+            if (!complete) {
+                output_pack.abandon(record);
+                return false;
+            }
+            string name = output_filename.substr(min(output_filename.size(), output_pack.directory().size() + 1));
+            if (!output_pack.commit(record, name, original_stats.peak)) {
+                log("Error: Could not write " + output_filename + " to the pack");
+                return false;
+            }
+            saved_outputs.push_back(output_filename);
+            return true;
+        }
+        unique_ptr<UringSink>& sink = output_slots[slot]->sink;
+        string part = partPath(output_filename);
+        if (sink) {
+            bool ok = sink->finish();
+            sink.reset();
+            if (!ok) {
+                log("Error: Could not write " + output_filename);
+                unlink(part.c_str());
+                return false;
+            }
+        }
+        if (!complete) {
+            unlink(part.c_str());
+            return false;
+        }
+        if (!syncPath(part)) {
+            log("Error: Could not flush " + part + ": " + strerror(errno));
+            unlink(part.c_str());
+            return false;
+        }
+        if (rename(part.c_str(), output_filename.c_str()) != 0) {
+            log("Error: Could not rename " + part + " to " + output_filename + ": " + strerror(errno));
+            unlink(part.c_str());
+            return false;
+        }
+        // The rename itself is only durable once its directory is
+        size_t slash = output_filename.find_last_of('/');
+        if (!syncPath(slash == string::npos ? "." : output_filename.substr(0, slash))) {
+            log("Warning: Could not flush the directory of " + output_filename);
+        }
+        saved_outputs.push_back(output_filename);
+        return true;
+    }
+
+    // Loads audio data from the specified file. Canonical PCM16/PCM24/float
+    // WAV files are memory-mapped (or read with io_uring) instead; everything
+    // else goes through libsndfile.
+    bool loadAudio() {
+        if (use_mmap_input && openRaw()) {
+            static const int subtypes[] = {SF_FORMAT_PCM_16, SF_FORMAT_PCM_24, SF_FORMAT_FLOAT};
+            sf_info.frames = mapped.frames;
+            sf_info.channels = mapped.channels;
+            sf_info.samplerate = mapped.sample_rate;
+            sf_info.format = SF_FORMAT_WAV | subtypes[static_cast<int>(mapped.format)];
+            sf_info.sections = 1;
+            sf_info.seekable = 1;
+            selectChannelKernels();
+            return true;
+        }
+
+        SNDFILE* infile = sf_open(filename.c_str(), SFM_READ, &sf_info);
+        if (!infile) {
+            log("Error: Cannot open file " + filename);
+            log("libsndfile error: " + string(sf_strerror(nullptr)));
+            return false;
+        }
+
+        // Calculate total samples (frames * channels) and size the reused buffer
+        sf_count_t total_samples = sf_info.frames * sf_info.channels;
+        if (!audio_data.resize(total_samples)) {
+            log("Error: Cannot allocate " + to_string(total_samples) + " samples for " + filename);
+            sf_close(infile);
+            return false;
+        }
+
+        // Read audio frames into the vector; a large FLAC file in ranges, in parallel
+        sf_count_t read_count = -1;
+        if (splitDecode(sf_info)) {
+            float* samples = audio_data.data();
+            int channels = sf_info.channels;
+            auto range = [samples, channels](SNDFILE* in, size_t, sf_count_t first, sf_count_t count) {
+                return sf_readf_float(in, samples + first * channels, count) == count;
+            };
+            if (decodeRanges(filename, sf_info, range)) {
+                read_count = sf_info.frames;
+            } else {
+                log("Warning: Parallel decode of " + filename + " failed, decoding it in order");
+            }
+        }
+        if (read_count < 0) {
+            read_count = sf_readf_float(infile, audio_data.data(), sf_info.frames);
+        }
+        if (read_count != sf_info.frames) {
+            log("Warning: Read " + to_string(read_count) + " frames, expected " + to_string(sf_info.frames));
+            // The reused buffer is not zeroed; pad the missing frames with silence
+            sf_count_t kept = max<sf_count_t>(read_count, 0) * sf_info.channels;
+            fill(audio_data.data() + kept, audio_data.data() + total_samples, 0.0f);
+        }
+        sf_close(infile);
+        selectChannelKernels();
+        return true;
+    }
+
+    // Scales the loaded audio so its peak reaches target_peak. Returns the stats
+    // of the original signal, computed in the same pass that finds the peak,
+    // with the applied gain recorded so callers can derive the result's stats.
+    // With `in_place` false the sample buffer is left as it is, for
+    // saveTargets to write several gains of the same samples.
+    AudioStats normalizePeak(float target_peak = 1.0f, bool in_place = true) {
+        if (!hasSamples()) {
+            log("Error: No audio data loaded, cannot normalize.");
+            return AudioStats();
+        }
+
+        // Min, max, peak and RMS of the original data in a single vectorized
+        // pass, which also runs the loudness and true-peak meters if needed
+        AudioStats stats = measureLevels() ? measureSamples()
+                           : per_channel   ? scanChannels()
+                                           : AudioStats::fromSamples(scanSamples());
+        original_stats = stats;
+        float peak_magnitude = stats.peak;
+
+        if (peak_magnitude == 0.0f) {
+            log("Warning: Audio contains only silence.");
+            return stats;
+        }
+        if (loudness_mode && !isfinite(stats.loudness)) {
+            log("Warning: Audio is below the loudness gate, left unchanged.");
+            return stats;
+        }
+
+        if (unlinked_gain) {
+            stats.channel_gains = channelGains(stats, target_peak);
+            logChannelGains(stats.channel_gains);
+            if (mapped.isOpen() || !in_place) {
+                pending_gains = stats.channel_gains;
+            } else {
+                float* samples = audio_data.data();
+                int channels = sf_info.channels;
+                const float* gains = stats.channel_gains.data();
+                forEachFrameChunk(sf_info.frames, channels, [this, samples, channels, gains](size_t first, size_t count) {
+                    block_kernels.scale(samples + first * channels, count, channels, gains);
+                });
+            }
+            logTargetReached(target_peak);
+            return stats;
+        }
+
+        // Calculate the normalization factor and apply it to all samples
+        float normalization_factor = targetGain(stats, target_peak);
+        logGain(stats, normalization_factor);
+
+        if (mapped.isOpen() || !in_place) {
+            pending_gain = normalization_factor; // Mapped pages are read-only
+        } else {
+            float* samples = audio_data.data();
+            forEachChunk(audio_data.size(), [samples, normalization_factor](size_t first, size_t count) {
+                scaleSamples(samples + first, count, normalization_factor);
+            });
+        }
+        stats.gain = normalization_factor;
+
+        logTargetReached(target_peak);
+        return stats;
+    }
+
+    // Device offload (--gpu): a decoded float buffer whose peak-normalize
+    // needs nothing but the sample stats can have them computed, and the
+    // gain applied, by a backend working on the buffer directly
+    bool offloadable() const {
+        return !mapped.isOpen() && !audio_data.empty() && !measureLevels() && !per_channel;
+    }
+
+    float* samples() {
+        return audio_data.data();
+    }
+
+    size_t sampleCount() const {
+        return audio_data.size();
+    }
+
+    // normalizePeak for stats computed elsewhere: records and logs them
+    // likewise and returns them with the gain to apply, which is left to
+    // the caller
+    AudioStats adoptStats(const SampleStats& samples, float target_peak) {
+        AudioStats stats = AudioStats::fromSamples(samples);
+        original_stats = stats;
+        if (stats.peak == 0.0f) {
+            log("Warning: Audio contains only silence.");
+            return stats;
+        }
+        stats.gain = targetGain(stats, target_peak);
+        logGain(stats, stats.gain);
+        logTargetReached(target_peak);
+        return stats;
+    }
+
+    // Prints various statistics about the audio data to the log file
+    void printStats(const string& title) {
+        if (!hasSamples()) {
+            log("No audio data to print statistics for.");
+            return;
+        }
+
+        printStats(title, AudioStats::fromSamples(scanSamples()).scaled(pending_gain));
+    }
+
+    // Prints already computed statistics, e.g. the ones returned by normalizePeak
+    void printStats(const string& title, const AudioStats& stats) {
+        if (stats.sample_count == 0) {
+            log("No audio data to print statistics for.");
+            return;
+        }
+
+        log("\n--- " + title + " ---");
+        log("Min value: " + to_string(stats.min_val));
+        log("Max value: + " + to_string(stats.max_val));
+        log("Peak magnitude: " + to_string(stats.peak));
+        log("RMS: " + to_string(stats.rms));
+        // Avoiding division by zero
+        log("Peak-to-RMS ratio: " + to_string(stats.rms > 0 ? stats.peak / stats.rms : 0.0f));
+        if (!isnan(stats.loudness)) {
+            log("Integrated loudness: " + to_string(stats.loudness) + " LUFS");
+        }
+        if (!isnan(stats.true_peak)) {
+            log("True peak: " + to_string(20.0f * log10(stats.true_peak)) + " dBTP");
+        }
+        for (size_t c = 0; c < stats.channels.size(); ++c) {
+            const SampleStats& channel = stats.channels[c];
+            float rms = channel.count ? sqrt(channel.sum_squares / channel.count) : 0.0f;
+            log("Channel " + to_string(c + 1) + ": peak " + to_string(channel.peak) + ", RMS " + to_string(rms));
+        }
+    }
+
+    // Pass 1 of normalizeStreaming for a file splitDecode accepts: each range
+    // is read in STREAM_BLOCK_FRAMES blocks of its own and the partial stats
+    // are merged in range order. Leaves the totals untouched on failure.
+    bool rangeStats(SampleStats& original, vector<SampleStats>& channels) {
+        int n_channels = sf_info.channels;
+        size_t ranges = decodeRangeCount(sf_info);
+        vector<SampleStats> totals(ranges);
+        bool by_channel = per_channel;
+        vector<vector<SampleStats>> per_range(by_channel ? ranges : 0, vector<SampleStats>(n_channels));
+        const ChannelKernels& kernels = block_kernels;
+        auto range = [&](SNDFILE* in, size_t r, sf_count_t, sf_count_t count) {
+            vector<float> block(STREAM_BLOCK_FRAMES * n_channels);
+            while (count > 0) {
+                sf_count_t got = sf_readf_float(in, block.data(), min(count, STREAM_BLOCK_FRAMES));
+                if (got <= 0) {
+                    return false;
+                }
+                if (by_channel) {
+                    vector<SampleStats> part(n_channels);
+                    kernels.stats(reinterpret_cast<const uint8_t*>(block.data()), got, n_channels, part.data());
+                    for (int c = 0; c < n_channels; ++c) {
+                        mergeSampleStats(totals[r], part[c]);
+                        mergeSampleStats(per_range[r][c], part[c]);
+                    }
+                } else {
+                    mergeSampleStats(totals[r], computeSampleStats(block.data(), got * n_channels));
+                }
+                count -= got;
+            }
+            return true;
+        };
+        if (!decodeRanges(filename, sf_info, range)) {
+            log("Warning: Parallel decode of " + filename + " failed, decoding it in order");
+            return false;
+        }
+        for (size_t r = 0; r < ranges; ++r) {
+            mergeSampleStats(original, totals[r]);
+            for (size_t c = 0; c < channels.size(); ++c) {
+                mergeSampleStats(channels[c], per_range[r][c]);
+            }
+        }
+        return true;
+    }
+
+    // Normalizes the file without holding it in memory: the first pass reads
+    // fixed-size blocks to find the peak, the second pass reads them again,
+    // scales them and writes them out. Memory use is O(STREAM_BLOCK_FRAMES).
+    // With `known` stats (from the stats cache) the first pass is skipped.
+    // Further `more_targets` are written in the same second pass.
+    bool normalizeStreaming(const string& output_filename, float target_peak = 1.0f, const AudioStats* known = nullptr,
+                            const vector<OutputTarget>& more_targets = {}) {
+        SNDFILE* infile = sf_open(filename.c_str(), SFM_READ, &sf_info);
+        if (!infile) {
+            log("Error: Cannot open file " + filename);
+            log("libsndfile error: " + string(sf_strerror(nullptr)));
+            return false;
+        }
+        if (sf_info.frames == 0 || sf_info.channels == 0) {
+            log("Error: No audio data in " + filename + ", cannot normalize.");
+            sf_close(infile);
+            return false;
+        }
+
+        selectChannelKernels();
+        sf_count_t batch = batchFrames();
+        float* block = blockBuffer(batch);
+
+        // Pass 1: min, max and sum of squares of the original signal
+        sf_count_t frames_read;
+        AudioStats stats;
+        if (known != nullptr) {
+            stats = *known;
+            log("Using cached stats for " + filename);
+        } else {
+            SampleStats original;
+            vector<SampleStats> channels(per_channel ? sf_info.channels : 0);
+            unique_ptr<LevelMeters> meters;
+            if (measureLevels()) {
+                meters.reset(new LevelMeters(sf_info));
+            }
+            // The meters need the samples in order; plain stats can come from ranges
+            bool decoded = !meters && splitDecode(sf_info) && rangeStats(original, channels);
+            while (!decoded && (frames_read = sf_readf_float(infile, block, batch)) > 0) {
+                if (per_channel) {
+                    vector<SampleStats> part = parallelChannelStats(block_kernels, reinterpret_cast<const uint8_t*>(block),
+                                                                    sf_info.channels * sizeof(float), frames_read,
+                                                                    sf_info.channels);
+                    for (size_t c = 0; c < channels.size(); ++c) {
+                        mergeSampleStats(original, part[c]);
+                        mergeSampleStats(channels[c], part[c]);
+                    }
+                } else {
+                    auto scan = [block](size_t first, size_t count) { return computeSampleStats(block + first, count); };
+                    mergeSampleStats(original, parallelStats(frames_read * sf_info.channels, scan));
+                }
+                if (meters) {
+                    meters->process(block, frames_read);
+                }
+            }
+            if (original.count != (size_t)(sf_info.frames * sf_info.channels)) {
+                log("Warning: Read " + to_string(original.count / sf_info.channels) + " frames, expected " + to_string(sf_info.frames));
+            }
+            if (original.count == 0) {
+                log("Error: No audio data loaded, cannot normalize.");
+                sf_close(infile);
+                return false;
+            }
+            stats = per_channel ? AudioStats::fromChannels(channels) : AudioStats::fromSamples(original);
+            if (meters) {
+                meters->finish(stats);
+            }
+        }
+        original_stats = stats;
+        printStats("Original Stats for " + filename, stats);
+
+        float peak_magnitude = stats.peak;
+        float normalization_factor = 1.0f;
+        bool scaled = false;
+        if (peak_magnitude == 0.0f) {
+            log("Warning: Audio contains only silence.");
+        } else if (loudness_mode && !isfinite(stats.loudness)) {
+            log("Warning: Audio is below the loudness gate, left unchanged.");
+        } else if (unlinked_gain) {
+            stats.channel_gains = channelGains(stats, target_peak);
+            scaled = true;
+            logChannelGains(stats.channel_gains);
+        } else {
+            normalization_factor = targetGain(stats, target_peak);
+            stats.gain = normalization_factor;
+            scaled = true;
+            logGain(stats, normalization_factor);
+        }
+
+        // Pass 2: rewind (or reopen non-seekable input), scale and write block by block
+        if (known == nullptr && sf_seek(infile, 0, SEEK_SET) != 0) {
+            sf_close(infile);
+            infile = sf_open(filename.c_str(), SFM_READ, &sf_info);
+            if (!infile) {
+                log("Error: Cannot reopen file " + filename);
+                log("libsndfile error: " + string(sf_strerror(nullptr)));
+                return false;
+            }
+        }
+        if (!more_targets.empty()) {
+            vector<OutputTarget> targets(1, OutputTarget{output_filename, target_peak});
+            targets.insert(targets.end(), more_targets.begin(), more_targets.end());
+            bool saved = streamTargets(infile, targets, block, batch);
+            sf_close(infile);
+            return saved;
+        }
+
+        SF_INFO output_info = sf_info;
+        output_info.format = outputFormatFor(sf_info);
+        SNDFILE* outfile = openOutput(output_filename, output_info);
+        if (!outfile) {
+            log("Error: Cannot create output file " + output_slots[0]->path);
+            log("libsndfile error: " + string(sf_strerror(nullptr)));
+            sf_close(infile);
+            return false;
+        }
+
+        SampleWriter writer(outfile, output_info);
+        sf_count_t written = 0;
+        int channels = sf_info.channels;
+        const float* gains = stats.channel_gains.data();
+        while ((frames_read = sf_readf_float(infile, block, batch)) > 0) {
+            if (!stats.channel_gains.empty()) {
+                forEachFrameChunk(frames_read, channels, [this, block, channels, gains](size_t first, size_t count) {
+                    block_kernels.scale(block + first * channels, count, channels, gains);
+                });
+            } else {
+                forEachChunk(frames_read * sf_info.channels, [block, normalization_factor](size_t first, size_t count) {
+                    scaleSamples(block + first, count, normalization_factor);
+                });
+            }
+            written += writer.write(block, frames_read);
+        }
+        bool closed = closeOutput(outfile, written);
+        sf_close(infile);
+        if (!closed) {
+            return false;
+        }
+
+        if (scaled) {
+            logTargetReached(target_peak);
+        }
+        printStats("Normalized Stats for " + filename, stats.normalized());
+        log("Saved to: " + saved_outputs.back());
+        return true;
+    }
+
+
+    // Stats of the input before normalization (zeros until it was analysed)
+    const AudioStats& originalStats() const {
+        return original_stats;
+    }
+
+    // Where this file's outputs went, in target order; see outputPathFor
+    const vector<string>& savedOutputs() const {
+        return saved_outputs;
+    }
+
+    // Bytes held by the decoded samples; used to charge the pipeline's memory budget
+    size_t bufferBytes() const {
+        return mapped.isOpen() ? mapped.dataBytes() : audio_data.size() * sizeof(float);
+    }
+
+    bool saveAudio(const string& output_filename) {
+        SF_INFO output_info = sf_info; 
+        output_info.format = outputFormatFor(sf_info);
+
+
+        SNDFILE* outfile = openOutput(output_filename, output_info);
+        if (!outfile) {
+            log("Error: Cannot create output file " + output_slots[0]->path);
+            log("libsndfile error: " + string(sf_strerror(nullptr)));
+            return false;
+        }
+
+        SampleWriter writer(outfile, output_info);
+        sf_count_t written = 0;
+        if (mapped.isOpen()) {
+            // Convert and scale batch by batch straight from the mapping
+            sf_count_t batch = batchFrames();
+            float* block = blockBuffer(batch);
+            for (sf_count_t frame = 0; frame < sf_info.frames; frame += batch) {
+                sf_count_t frames = min(batch, sf_info.frames - frame);
+                convertSource(frame, frames, block, pending_gain, pending_gains);
+                written += writer.write(block, frames);
+            }
+        } else {
+            written = writer.write(audio_data.data(), sf_info.frames);
+        }
+
+        if (!closeOutput(outfile, written)) {
+            return false;
+        }
+        log("Saved to: " + saved_outputs.back());
+        return true;
+    }
+
+    // The outputs of a run with several targets, open at the same time
+    struct TargetOutputs {
+        vector<AudioStats> gains; // Original stats with each target's gain
+        vector<SNDFILE*> files;   // Null where the output could not be created
+        vector<unique_ptr<SampleWriter>> writers;
+        vector<sf_count_t> written;
+    };
+
+    void openTargets(const vector<OutputTarget>& targets, TargetOutputs& outputs) {
+        SF_INFO output_info = sf_info;
+        output_info.format = outputFormatFor(sf_info);
+        size_t n = targets.size();
+        outputs.gains.resize(n);
+        outputs.files.assign(n, nullptr);
+        outputs.writers.resize(n);
+        outputs.written.assign(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            outputs.files[k] = openOutput(targets[k].output_filepath, output_info, k);
+            if (!outputs.files[k]) {
+                log("Error: Cannot create output file " + output_slots[k]->path);
+                log("libsndfile error: " + string(sf_strerror(nullptr)));
+                continue;
+            }
+            outputs.gains[k] = withTargetGain(original_stats, targets[k].peak_level);
+            outputs.writers[k].reset(new SampleWriter(outputs.files[k], output_info));
+        }
+    }
+
+    // Closes every output; false unless all of them were written in full
+    bool closeTargets(const vector<OutputTarget>& targets, TargetOutputs& outputs) {
+        bool saved = true;
+        for (size_t k = 0; k < targets.size(); ++k) {
+            if (!outputs.files[k]) {
+                saved = false;
+                continue;
+            }
+            outputs.writers[k].reset();
+            if (closeOutput(outputs.files[k], outputs.written[k], k)) {
+                log("Saved to: " + saved_outputs.back());
+            } else {
+                saved = false;
+            }
+        }
+        return saved;
+    }
+
+    // Pass 2 of normalizeStreaming with several targets: each block is read
+    // once and scaled into target_block once per output
+    bool streamTargets(SNDFILE* infile, const vector<OutputTarget>& targets, float* block, sf_count_t batch) {
+        TargetOutputs outputs;
+        openTargets(targets, outputs);
+        int channels = sf_info.channels;
+        target_block.resize(batch * channels);
+        float* scaled = target_block.data();
+        sf_count_t frames_read;
+        while ((frames_read = sf_readf_float(infile, block, batch)) > 0) {
+            for (size_t k = 0; k < targets.size(); ++k) {
+                if (!outputs.writers[k]) {
+                    continue;
+                }
+                const AudioStats& gain = outputs.gains[k];
+                if (!gain.channel_gains.empty()) {
+                    const uint8_t* src = reinterpret_cast<const uint8_t*>(block);
+                    const float* gains = gain.channel_gains.data();
+                    forEachFrameChunk(frames_read, channels, [&](size_t first, size_t count) {
+                        block_kernels.convert(src + first * channels * sizeof(float), scaled + first * channels, count,
+                                              channels, gains);
+                    });
+                } else {
+                    float factor = gain.gain;
+                    forEachChunk(frames_read * channels, [block, scaled, factor](size_t first, size_t count) {
+                        scaleSamplesInto(block + first, scaled + first, count, factor);
+                    });
+                }
+                outputs.written[k] += outputs.writers[k]->write(scaled, frames_read);
+            }
+        }
+        bool saved = closeTargets(targets, outputs);
+        if (saved) {
+            for (size_t k = 0; k < targets.size(); ++k) {
+                printStats("Normalized Stats for " + filename + " at peak " + to_string(targets[k].peak_level),
+                           outputs.gains[k].normalized());
+            }
+        }
+        return saved;
+    }
+
+    // Writes one output per target, each at its own gain of the analysed
+    // signal (see normalizePeak's `in_place`), in a single pass: every batch
+    // of source frames is converted once per target while it is in cache.
+    // False unless every output was written.
+    bool saveTargets(const vector<OutputTarget>& targets) {
+        TargetOutputs outputs;
+        openTargets(targets, outputs);
+        sf_count_t batch = batchFrames();
+        float* block = blockBuffer(batch);
+        for (sf_count_t frame = 0; frame < sf_info.frames; frame += batch) {
+            sf_count_t frames = min(batch, sf_info.frames - frame);
+            for (size_t k = 0; k < targets.size(); ++k) {
+                if (outputs.writers[k]) {
+                    const AudioStats& gain = outputs.gains[k];
+                    convertSource(frame, frames, block, gain.gain, gain.channel_gains);
+                    outputs.written[k] += outputs.writers[k]->write(block, frames);
+                }
+            }
+        }
+        return closeTargets(targets, outputs);
+    }
+};
+
+// Major formats (SF_FORMAT_TYPEMASK values) this build of libsndfile reads
+const set<int>& readableFormats() {
+    static const set<int> formats = [] {
+        set<int> found;
+        int count = 0;
+        sf_command(nullptr, SFC_GET_FORMAT_MAJOR_COUNT, &count, sizeof(count));
+        for (int i = 0; i < count; ++i) {
+            SF_FORMAT_INFO info;
+            memset(&info, 0, sizeof(info));
+            info.format = i;
+            if (sf_command(nullptr, SFC_GET_FORMAT_MAJOR, &info, sizeof(info)) == 0) {
+                found.insert(info.format & SF_FORMAT_TYPEMASK);
+            }
+        }
+        return found;
+    }();
+    return formats;
+}
+
+// SF_FORMAT_MPEG, which <sndfile.h> only has from libsndfile 1.1.0 on. Older
+// libraries never report it as readable, so MP3 is simply not taken there.
+const int FORMAT_MPEG = 0x230000;
+
+// Container of a file from its first bytes, as an SF_FORMAT_* major format,
+// or 0 for anything without the signature of a common audio container
+int sniffFormat(const uint8_t* head, size_t n) {
+    auto at = [head, n](size_t offset, const char* magic) {
+        size_t len = strlen(magic);
+        return offset + len <= n && memcmp(head + offset, magic, len) == 0;
+    };
+    if ((at(0, "RIFF") || at(0, "RIFX")) && at(8, "WAVE")) {
+        return SF_FORMAT_WAV;
+    }
+    if (at(0, "RF64") && at(8, "WAVE")) {
+        return SF_FORMAT_RF64;
+    }
+    if (at(0, "riff\x2e\x91\xcf\x11")) {
+        return SF_FORMAT_W64;
+    }
+    if (at(0, "FORM") && (at(8, "AIFF") || at(8, "AIFC"))) {
+        return SF_FORMAT_AIFF;
+    }
+    if (at(0, "FORM") && (at(8, "8SVX") || at(8, "16SV"))) {
+        return SF_FORMAT_SVX;
+    }
+    if (at(0, ".snd") || at(0, "dns.")) {
+        return SF_FORMAT_AU;
+    }
+    if (at(0, "fLaC")) {
+        return SF_FORMAT_FLAC;
+    }
+    if (at(0, "OggS")) {
+        return SF_FORMAT_OGG; // Vorbis, Opus or FLAC inside
+    }
+    if (at(0, "caff")) {
+        return SF_FORMAT_CAF;
+    }
+    if (at(0, "NIST_1A")) {
+        return SF_FORMAT_NIST;
+    }
+    if (at(0, "Creative Voice File")) {
+        return SF_FORMAT_VOC;
+    }
+    if (at(0, "ID3")) {
+        return FORMAT_MPEG; // An ID3v2 tag, in practice always ahead of MP3 frames
+    }
+    // A bare MPEG audio frame header: 11 sync bits, then a valid version,
+    // layer, bitrate and sample rate
+    if (n >= 3 && head[0] == 0xFF && (head[1] & 0xE0) == 0xE0 && (head[1] & 0x18) != 0x08 &&
+        (head[1] & 0x06) != 0 && (head[2] & 0xF0) != 0xF0 && (head[2] & 0x0C) != 0x0C) {
+        return FORMAT_MPEG;
+    }
+    return 0;
+}
+
+// Whether `name` in the directory open as `dir_fd` is audio this libsndfile
+// can read. Decided by the file's signature, not its name, so FLAC, Ogg,
+// MP3, AIFF and the rest are found whatever they are called; costs one
+// 32-byte read per file during the scan.
+bool isAudioFile(int dir_fd, const string& name) {
+    int fd = openat(dir_fd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t head[32];
+    ssize_t n = pread(fd, head, sizeof(head), 0);
+    close(fd);
+    int format = n > 0 ? sniffFormat(head, n) : 0;
+    return format != 0 && readableFormats().count(format) != 0;
+}
+
+// Writes one status line to the console without interleaving across threads
+void console_line(const string& line, bool error = false) {
+    // Only a contended lock is timed
+    if (pthread_mutex_trylock(&log_mutex) != 0) {
+        uint64_t start = monotonicNs();
+        pthread_mutex_lock(&log_mutex);
+        console_waits.fetch_add(1, memory_order_relaxed);
+        console_wait_ns.fetch_add(monotonicNs() - start, memory_order_relaxed);
+    }
+    (error ? cerr : cout) << line << endl;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// Notes a finished output in the run journal, the stats cache and the
+// incremental manifest. The input is hashed at most once for the last two.
+void record_output(const AudioProcessor& processor, const AudioTask& task) {
+    if (journaling) {
+        run_journal.record(task.filename);
+    }
+    if (reporting) {
+        const AudioStats& original = processor.originalStats();
+        ostringstream fields;
+        fields.precision(9);
+        fields << original.peak << '\t' << original.rms << '\t' << gainText(original, task.peak_level) << '\t'
+               << original.sample_count;
+        node_report.record(task.filename, fields.str());
+    }
+    if (!incremental && !use_stats_cache) {
+        return;
+    }
+    FileStamp stamp;
+    uint64_t hash;
+    bool hashed = use_stats_cache ? stats_cache.hashOf(task.input_filepath, stamp, hash)
+                                  : statFile(task.input_filepath, stamp) && hashFile(task.input_filepath, hash);
+    const AudioStats& original = processor.originalStats();
+    if (hashed && use_stats_cache && original.sample_count > 0) {
+        stats_cache.store(hash, original.toCache());
+    }
+    if (incremental && !(hashed && output_manifest.record(task.filename, stamp, hash, processor.savedOutputs().front(),
+                                                          task.peak_level, original.peak, outputOptions()))) {
+        console_line("Warning: Could not record " + task.filename + " in the manifest", true);
+    }
+}
+
+// Stats of an input analysed by an earlier run, if the stats cache has them
+bool cached_stats(const AudioTask& task, AudioStats& stats) {
+    FileStamp stamp;
+    uint64_t hash;
+    CachedStats cached;
+    // Cached entries hold no loudness, true peak or per-channel stats
+    if (!use_stats_cache || measureLevels() || per_channel || !stats_cache.hashOf(task.input_filepath, stamp, hash) || !stats_cache.find(hash, cached)) {
+        return false;
+    }
+    stats = AudioStats::fromCache(cached);
+    return true;
+}
+
+// The per-file steps, shared by process_task and the pipeline stages
+
+// Waits for the --max-mem budget to cover the file. True when it is to be
+// loaded; false when it is to be streamed: with cached stats, under
+// --stream, or because loading it would need more than the whole budget.
+bool admit_step(AudioProcessor& processor, const AudioTask& task, bool cached) {
+    bool load = !cached && !task.streaming;
+    if (processor.admit(task.more_targets.size() + 1, load)) {
+        return true;
+    }
+    if (load) {
+        processor.log("Streaming " + task.input_filepath + ": loading it would need more than --max-mem");
+    }
+    return false;
+}
+
+bool load_step(AudioProcessor& processor, const AudioTask& task) {
+    bool loaded;
+    {
+        ScopedTimer timer(load_timer);
+        loaded = processor.loadAudio();
+    }
+    if (!loaded) {
+        console_line("Failed to load audio" + task.input_filepath, true);
+        return false;
+    }
+    return true;
+}
+
+// Logs the original and normalized stats of a file compute_step (or the
+// GPU batch) has normalized
+void print_step(AudioProcessor& processor, const AudioTask& task, const AudioStats& stats) {
+    bool several = !task.more_targets.empty();
+    ScopedTimer timer(print_stats_timer);
+    processor.printStats("Original Stats for " + task.filename, stats);
+    if (!several) {
+        processor.printStats("Normalized Stats for " + task.filename, stats.normalized());
+        return;
+    }
+    processor.printStats("Normalized Stats for " + task.filename + " at peak " + to_string(task.peak_level),
+                         stats.normalized());
+    for (const OutputTarget& target : task.more_targets) {
+        processor.printStats("Normalized Stats for " + task.filename + " at peak " + to_string(target.peak_level),
+                             withTargetGain(processor.originalStats(), target.peak_level).normalized());
+    }
+}
+
+void compute_step(AudioProcessor& processor, const AudioTask& task) {
+    // One analysis pass: the normalized stats are derived from the original ones
+    AudioStats stats;
+    {
+        ScopedTimer timer(normalize_timer);
+        stats = processor.normalizePeak(task.peak_level, task.more_targets.empty());
+    }
+    print_step(processor, task, stats);
+}
+
+// Every output of a task, its first one included
+vector<OutputTarget> task_targets(const AudioTask& task) {
+    vector<OutputTarget> targets(1, OutputTarget{task.output_filepath, task.peak_level});
+    targets.insert(targets.end(), task.more_targets.begin(), task.more_targets.end());
+    return targets;
+}
+
+void report_saved(const AudioProcessor& processor) {
+    for (const string& path : processor.savedOutputs()) {
+        console_line("Successfully processed and saved: " + path);
+    }
+}
+
+bool write_step(AudioProcessor& processor, const AudioTask& task) {
+    bool saved;
+    {
+        ScopedTimer timer(save_timer);
+        saved = task.more_targets.empty() ? processor.saveAudio(task.output_filepath)
+                                          : processor.saveTargets(task_targets(task));
+    }
+    if (saved) {
+        record_output(processor, task);
+        report_saved(processor);
+    } else {
+        console_line("Failed to save: " + task.output_filepath, true);
+    }
+    return saved;
+}
+
+// Streams the file; with `known` stats only the scale-and-write pass runs
+bool stream_step(AudioProcessor& processor, const AudioTask& task, const AudioStats* known = nullptr) {
+    bool streamed;
+    {
+        ScopedTimer timer(stream_timer);
+        streamed = processor.normalizeStreaming(task.output_filepath, task.peak_level, known, task.more_targets);
+    }
+    if (streamed) {
+        record_output(processor, task);
+        report_saved(processor);
+    } else {
+        console_line("Failed to stream: " + task.input_filepath, true);
+    }
+    return streamed;
+}
+
+// Processes one file on a pool worker. Each worker keeps one processor for
+// the whole run, so its buffers are reused from file to file. Returns true
+// when the output was written; `original` receives the input's stats and
+// `output` the path the output went to.
+bool process_task(const AudioTask& task, AudioStats* original = nullptr, string* output = nullptr) {
+    static thread_local AudioProcessor processor;
+    processor.reset(task.input_filepath);
+
+    bool ok = false;
+    AudioStats known;
+    bool cached = cached_stats(task, known);
+    if (!admit_step(processor, task, cached)) {
+        ok = stream_step(processor, task, cached ? &known : nullptr);
+    } else if (load_step(processor, task)) {
+        compute_step(processor, task);
+        ok = write_step(processor, task);
+    }
+    if (original != nullptr) {
+        *original = processor.originalStats();
+    }
+    if (output != nullptr && ok) {
+        *output = processor.savedOutputs().front();
+    }
+    processor.finish();
+    return ok;
+}
+
+struct PipelineItem {
+    AudioTask task;
+    unique_ptr<AudioProcessor> processor;
+    bool cached = false; // Stats came from the stats cache; stream with them
+    AudioStats cached_stats;
+};
+
+// Three-stage pipeline enabled with --pipeline: reader threads load files,
+// compute threads normalize them and writer threads save them. Readers and
+// writers mostly wait on the disk, so giving them their own threads keeps
+// the compute threads busy. The decoded and processed queues are each
+// bounded to half of the memory budget, which caps the audio in flight;
+// with --gpu the queue to the GPU thread takes its share out first.
+//
+// With --gpu, compute threads pass each file the device can take on to a
+// GPU thread instead, which gathers what has queued up into one batch (up
+// to the device buffer), normalizes it there and hands it to the writers.
+class AudioPipeline {
+private:
+    BoundedQueue<AudioTask> pending;
+    BoundedQueue<PipelineItem> decoded;
+    BoundedQueue<PipelineItem> to_gpu;
+    BoundedQueue<PipelineItem> processed;
+    int num_readers, num_compute, num_writers;
+    vector<vector<int>> compute_cpus;
+    vector<pthread_t> readers, computers, gpu_threads, writers;
+    atomic<int> next_cpu{0}; // Hands each compute thread its slot in compute_cpus
+    atomic<bool> gpu_usable{false}; // Cleared for good by the first device error
+
+    // Finished processors wait here for a reader to reuse them with their buffers
+    pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+    vector<unique_ptr<AudioProcessor>> spares;
+
+    unique_ptr<AudioProcessor> acquireProcessor(const string& path) {
+        unique_ptr<AudioProcessor> processor;
+        pthread_mutex_lock(&spare_mutex);
+        if (!spares.empty()) {
+            processor = std::move(spares.back());
+            spares.pop_back();
+        }
+        pthread_mutex_unlock(&spare_mutex);
+        if (!processor) {
+            processor.reset(new AudioProcessor());
+        }
+        processor->reset(path);
+        return processor;
+    }
+
+    void releaseProcessor(unique_ptr<AudioProcessor> processor) {
+        processor->finish();
+        pthread_mutex_lock(&spare_mutex);
+        spares.push_back(std::move(processor));
+        pthread_mutex_unlock(&spare_mutex);
+    }
+
+    template <void (AudioPipeline::*stage)()>
+    static void* runStage(void* self) {
+        (static_cast<AudioPipeline*>(self)->*stage)();
+        return nullptr;
+    }
+
+    template <void (AudioPipeline::*stage)()>
+    bool spawn(vector<pthread_t>& threads, int count) {
+        for (int i = 0; i < count; ++i) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, runStage<stage>, this) != 0) {
+                return false;
+            }
+            threads.push_back(thread);
+        }
+        return true;
+    }
+
+    void readLoop() {
+        AudioTask task;
+        while (pending.pop(task)) {
+            unique_ptr<AudioProcessor> processor = acquireProcessor(task.input_filepath);
+            PipelineItem item;
+            item.task = task;
+            item.cached = cached_stats(task, item.cached_stats);
+            if (!admit_step(*processor, task, item.cached)) {
+                item.task.streaming = true;
+            }
+            // Streaming and cached tasks do their own block I/O on a compute thread
+            if (!item.task.streaming && !load_step(*processor, task)) {
+                releaseProcessor(std::move(processor));
+                continue;
+            }
+            size_t bytes = processor->bufferBytes();
+            item.processor = std::move(processor);
+            decoded.push(std::move(item), bytes);
+        }
+    }
+
+    void computeLoop() {
+        int slot = next_cpu.fetch_add(1);
+        if (slot < (int)compute_cpus.size()) {
+            pinCurrentThread(compute_cpus[slot]);
+        }
+        PipelineItem item;
+        while (decoded.pop(item)) {
+            if (item.task.streaming || item.cached) {
+                stream_step(*item.processor, item.task, item.cached ? &item.cached_stats : nullptr);
+                releaseProcessor(std::move(item.processor));
+                continue;
+            }
+            if (gpu_usable && offloadable(item)) {
+                size_t bytes = item.processor->bufferBytes();
+                to_gpu.push(std::move(item), bytes);
+                continue;
+            }
+            compute_step(*item.processor, item.task);
+            size_t bytes = item.processor->bufferBytes();
+            processed.push(std::move(item), bytes);
+        }
+    }
+
+    // Single-target files whose buffer fits the device on its own
+    static bool offloadable(const PipelineItem& item) {
+        return item.task.more_targets.empty() && item.processor->offloadable() &&
+               GpuOffload::footprint(item.processor->sampleCount()) <= gpu_offload->capacitySamples();
+    }
+
+    void gpuLoop() {
+        vector<PipelineItem> batch;
+        size_t batch_samples = 0;
+        PipelineItem item;
+        while (to_gpu.pop(item)) {
+            do {
+                size_t samples = GpuOffload::footprint(item.processor->sampleCount());
+                if (!batch.empty() && batch_samples + samples > gpu_offload->capacitySamples()) {
+                    runBatch(batch);
+                    batch_samples = 0;
+                }
+                batch_samples += samples;
+                batch.push_back(std::move(item));
+            } while (to_gpu.tryPop(item));
+            runBatch(batch);
+            batch_samples = 0;
+        }
+    }
+
+    // Normalizes a batch on the device and passes it on to the writers.
+    // After an OpenCL error the device is given up for the rest of the run:
+    // this batch is finished on the CPU (samples the device already scaled
+    // are kept) and compute threads stop sending files.
+    void runBatch(vector<PipelineItem>& batch) {
+        vector<GpuSegment> segments(batch.size());
+        vector<AudioStats> stats(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            segments[i].samples = batch[i].processor->samples();
+            segments[i].count = batch[i].processor->sampleCount();
+        }
+        bool analyzed = false, scaled = false;
+        if (gpu_usable) {
+            ScopedTimer timer(gpu_batch_timer);
+            analyzed = gpu_offload->analyze(segments);
+            for (size_t i = 0; analyzed && i < batch.size(); ++i) {
+                stats[i] = batch[i].processor->adoptStats(segments[i].stats, batch[i].task.peak_level);
+                segments[i].gain = stats[i].gain;
+            }
+            scaled = analyzed && gpu_offload->scale(segments);
+        }
+        if (!scaled && gpu_usable.exchange(false)) {
+            console_line("GPU offload failed: " + gpu_offload->error() + "; continuing on the CPU", true);
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            PipelineItem& item = batch[i];
+            if (!analyzed) {
+                compute_step(*item.processor, item.task);
+            } else {
+                GpuSegment& seg = segments[i];
+                if (!scaled) {
+                    scaleSamples(seg.samples + seg.written, seg.count - seg.written, seg.gain);
+                }
+                print_step(*item.processor, item.task, stats[i]);
+            }
+            size_t bytes = item.processor->bufferBytes();
+            processed.push(std::move(item), bytes);
+        }
+        batch.clear();
+    }
+
+    void writeLoop() {
+        PipelineItem item;
+        while (processed.pop(item)) {
+            write_step(*item.processor, item.task);
+            releaseProcessor(std::move(item.processor)); // Hand the buffer back before waiting for the next one
+        }
+    }
+
+    // What the queue to the GPU thread may hold out of the memory budget:
+    // one device batch, but never more than half the budget
+    static size_t gpuShare(size_t mem_budget) {
+        return gpu_offload ? min(gpu_offload->capacitySamples() * sizeof(float), mem_budget / 2) : 0;
+    }
+
+    static void joinAll(vector<pthread_t>& threads) {
+        for (pthread_t thread : threads) {
+            pthread_join(thread, NULL);
+        }
+        threads.clear();
+    }
+
+public:
+    AudioPipeline(int readers_cnt, int compute_cnt, int writers_cnt, size_t mem_budget, const vector<vector<int>>& cpus)
+        : pending(4096, SIZE_MAX), decoded(1024, (mem_budget - gpuShare(mem_budget)) / 2),
+          to_gpu(1024, gpuShare(mem_budget)), processed(1024, (mem_budget - gpuShare(mem_budget)) / 2),
+          num_readers(readers_cnt), num_compute(compute_cnt), num_writers(writers_cnt), compute_cpus(cpus),
+          gpu_usable(gpu_offload != nullptr) {}
+
+    ~AudioPipeline() {
+        finish();
+        pthread_mutex_destroy(&spare_mutex);
+    }
+
+    bool start() {
+        if (spawn<&AudioPipeline::writeLoop>(writers, num_writers) &&
+            spawn<&AudioPipeline::gpuLoop>(gpu_threads, gpu_offload ? 1 : 0) &&
+            spawn<&AudioPipeline::computeLoop>(computers, num_compute) &&
+            spawn<&AudioPipeline::readLoop>(readers, num_readers)) {
+            return true;
+        }
+        finish();
+        return false;
+    }
+
+    void submit(const AudioTask& task) {
+        pending.push(task);
+    }
+
+    // Closes each stage once the one feeding it has drained, then joins it
+    void finish() {
+        pending.close();
+        joinAll(readers);
+        decoded.close();
+        joinAll(computers);
+        to_gpu.close();
+        joinAll(gpu_threads);
+        processed.close();
+        joinAll(writers);
+    }
+};
+
+// Creates `path` and any missing parents, like mkdir -p
+bool make_dirs(const string& path) {
+    struct stat sb;
+    if (path.empty() || stat(path.c_str(), &sb) == 0) {
+        return path.empty() || S_ISDIR(sb.st_mode);
+    }
+    size_t slash = path.find_last_of('/');
+    if (slash != string::npos && slash > 0 && !make_dirs(path.substr(0, slash))) {
+        return false;
+    }
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// Deletes the partial outputs ("normalised_*.part") an interrupted run left
+// below `dir`, including those of inputs that have gone since; returns how
+// many
+int remove_stale_parts(const string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return 0;
+    }
+    int removed = 0;
+    while (dirent* ent = readdir(d)) {
+        string name = ent->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        string path = dir + "/" + name;
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (lstat(path.c_str(), &sb) != 0) {
+                continue;
+            }
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            removed += remove_stale_parts(path);
+        } else if (type == DT_REG && name.compare(0, 11, "normalised_") == 0 && name.size() > 16 &&
+                   name.compare(name.size() - 5, 5, ".part") == 0 && unlink(path.c_str()) == 0) {
+            ++removed;
+        }
+    }
+    closedir(d);
+    return removed;
+}
+
+// Shared by every directory scan of one run
+struct ScanContext {
+    string input_root;
+    string output_root;
+    float peak_level;
+    vector<OutputTarget> more_roots;          // Further targets: output root and peak of each
+    bool streaming;
+    ThreadPool* pool;                         // Runs the subdirectory scans
+    CompletionLatch* scans_done;              // Counts scans still running
+    function<void(const AudioTask&)> submit;  // Hands a file to the workers
+    vector<pair<dev_t, ino_t>> output_dirs;   // Output roots, skipped if inside the input tree
+    bool planning = false;                    // --plan: only collect the files, create no output directories
+
+    // Records `path` as an output directory, if it exists
+    void addOutputDir(const string& path) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0) {
+            output_dirs.push_back({sb.st_dev, sb.st_ino});
+        }
+    }
+
+    bool isOutputDir(const string& path) const {
+        struct stat sb;
+        if (output_dirs.empty() || stat(path.c_str(), &sb) != 0) {
+            return false;
+        }
+        return find(output_dirs.begin(), output_dirs.end(), make_pair(sb.st_dev, sb.st_ino)) != output_dirs.end();
+    }
+};
+
+// Creates the output directory for `rel` under every target's root; packed
+// outputs need none
+bool make_target_dirs(const ScanContext& ctx, const string& rel) {
+    if (use_pack) {
+        return true;
+    }
+    vector<string> roots(1, ctx.output_root);
+    for (const OutputTarget& root : ctx.more_roots) {
+        roots.push_back(root.output_filepath);
+    }
+    for (const string& root : roots) {
+        string dir = rel.empty() ? root : root + "/" + rel;
+        if (!make_dirs(dir)) {
+            console_line("Error: Could not create output directory " + dir + ": " + strerror(errno), true);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The task for input file `name` in input_root/rel, with its outputs under
+// the output root of each target
+AudioTask make_task(const ScanContext& ctx, const string& rel, const string& name) {
+    string in_dir = rel.empty() ? ctx.input_root : ctx.input_root + "/" + rel;
+    string out_dir = rel.empty() ? ctx.output_root : ctx.output_root + "/" + rel;
+    vector<OutputTarget> more;
+    for (const OutputTarget& root : ctx.more_roots) {
+        string dir = rel.empty() ? root.output_filepath : root.output_filepath + "/" + rel;
+        more.push_back(OutputTarget{dir + "/normalised_" + name, root.peak_level});
+    }
+    return {in_dir + "/" + name, out_dir + "/normalised_" + name, rel.empty() ? name : rel + "/" + name,
+            ctx.peak_level, ctx.streaming, more};
+}
+
+// Lists input_root/rel, submitting each audio file the moment it is seen and
+// each subdirectory as a separate scan on the pool, so wide trees are listed
+// in parallel while workers already process files. d_type saves a stat per
+// entry; only filesystems that report DT_UNKNOWN, and symlinks, are stat'ed.
+// Symlinked directories are not followed, which rules out cycles. Outputs go
+// to the same relative directory under output_root.
+bool scan_directory(const ScanContext& ctx, const string& rel) {
+    string in_dir = rel.empty() ? ctx.input_root : ctx.input_root + "/" + rel;
+    DIR* dir = opendir(in_dir.c_str());
+    if (dir == nullptr) {
+        console_line("Error: Could not open directory " + in_dir + ": " + strerror(errno), true);
+        return false;
+    }
+
+    bool out_ready = false;
+    while (dirent* ent = readdir(dir)) {
+        string name = ent->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        string child = rel.empty() ? name : rel + "/" + name;
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            struct stat sb;
+            if (stat((in_dir + "/" + name).c_str(), &sb) != 0) {
+                continue;
+            }
+            if (S_ISREG(sb.st_mode)) {
+                type = DT_REG;
+            } else if (S_ISDIR(sb.st_mode) && type == DT_UNKNOWN) {
+                type = DT_DIR; // A real directory on a filesystem without d_type, not a symlink
+            } else {
+                continue;
+            }
+        }
+
+        if (type == DT_DIR) {
+            // An output tree nested in the input would feed our own outputs back in
+            if (ctx.isOutputDir(in_dir + "/" + name)) {
+                continue;
+            }
+            ctx.scans_done->add();
+            const ScanContext* shared = &ctx;
+            ctx.pool->submit([shared, child]() {
+                scan_directory(*shared, child);
+                shared->scans_done->countDown();
+            });
+        } else if (type == DT_REG && isAudioFile(dirfd(dir), name)) {
+            // Only directories that hold audio get an output directory
+            if (!ctx.planning && !out_ready && !(out_ready = make_target_dirs(ctx, rel))) {
+                break;
+            }
+            ctx.submit(make_task(ctx, rel, name));
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+// A task with its input size, the cost estimate used for scheduling
+struct SizedTask {
+    AudioTask task;
+    uint64_t bytes;
+};
+
+// Longest-processing-time-first: sorts `tasks` by size, largest first, and
+// returns the byte load of the busiest of `workers` threads when each task
+// goes to the least loaded one, which is how idle workers pick them up.
+// Within 4/3 of the optimal makespan.
+uint64_t scheduleLargestFirst(vector<SizedTask>& tasks, int workers) {
+    stable_sort(tasks.begin(), tasks.end(),
+                [](const SizedTask& a, const SizedTask& b) { return a.bytes > b.bytes; });
+    priority_queue<uint64_t, vector<uint64_t>, greater<uint64_t>> loads;
+    for (int w = 0; w < workers; ++w) {
+        loads.push(0);
+    }
+    uint64_t busiest = 0;
+    for (const SizedTask& t : tasks) {
+        uint64_t load = loads.top() + t.bytes;
+        loads.pop();
+        loads.push(load);
+        busiest = max(busiest, load);
+    }
+    return busiest;
+}
+
+// Counters gathered from the pool, the logger and the console lock. `pool`
+// is null in pipeline mode.
+vector<MetricValue> collectCounters(const ThreadPool* pool, int files_submitted) {
+    vector<MetricValue> values = {
+        {"files_submitted_total", "Audio files handed to the workers", (double)files_submitted},
+        {"log_ring_full_waits_total", "log() calls that waited for the log writer to make room", (double)app_log.fullWaits()},
+        {"log_ring_full_wait_seconds_total", "Time log() spent waiting for the log writer", app_log.fullWaitNs() / 1e9},
+        {"console_lock_waits_total", "Contended acquisitions of the console mutex", (double)console_waits.load()},
+        {"console_lock_wait_seconds_total", "Time spent waiting for the console mutex", console_wait_ns.load() / 1e9},
+    };
+    if (memory_budget != nullptr) {
+        values.push_back({"memory_budget_waits_total", "Loads that waited for --max-mem to free up", (double)memory_budget->waits()});
+        values.push_back({"memory_budget_wait_seconds_total", "Time loads spent waiting for --max-mem", memory_budget->waitNs() / 1e9});
+        values.push_back({"memory_budget_peak_bytes", "Most memory reserved against --max-mem at once", (double)memory_budget->peakBytes()});
+    }
+    if (gpu_offload != nullptr) {
+        values.push_back({"gpu_batches_total", "Batches normalized on the --gpu device", (double)gpu_offload->batches()});
+        values.push_back({"gpu_files_total", "Files normalized on the --gpu device", (double)gpu_offload->segments()});
+        values.push_back({"gpu_bytes_total", "Sample bytes normalized on the --gpu device", (double)gpu_offload->bytes()});
+    }
+    if (pool != nullptr) {
+        values.push_back({"pool_steals_total", "Jobs a worker stole from another worker's deque", (double)pool->steals()});
+        values.push_back({"pool_parks_total", "Times a worker slept for lack of work", (double)pool->parks()});
+        values.push_back({"pool_parked_seconds_total", "Total time workers slept for lack of work", pool->parkedNs() / 1e9});
+    }
+    return values;
+}
+
+// Serve mode: one request line is "<input>\t<output>[\t<target_peak>]". The
+// file is queued on the pool and answered, in completion order, with
+// "ok\t<input>\t<output>\t<peak>\t<rms>\t<gain>\t<seconds>" (original peak
+// and RMS, applied gain; comma-separated per channel when unlinked) or
+// "error\t<input>\t<reason>".
+void serve_request(const shared_ptr<JobConnection>& conn, const string& line, float default_peak, bool streaming,
+                   ThreadPool& pool, CompletionLatch& jobs_done, atomic<int>& job_cnt) {
+    vector<string> fields;
+    size_t start = 0, tab;
+    while ((tab = line.find('\t', start)) != string::npos) {
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    fields.push_back(line.substr(start));
+
+    float peak = default_peak;
+    char* end = nullptr;
+    if (fields.size() == 3) {
+        peak = strtof(fields[2].c_str(), &end);
+    }
+    if (fields.size() < 2 || fields.size() > 3 || fields[0].empty() || fields[1].empty() ||
+        (end != nullptr && (*end != '\0' || !(peak > 0.0f)))) {
+        conn->reply("error\t" + fields[0] + "\texpected <input>\\t<output>[\\t<target_peak>]");
+        return;
+    }
+    size_t slash = fields[1].rfind('/');
+    if (slash != string::npos && slash > 0 && !make_dirs(fields[1].substr(0, slash))) {
+        conn->reply("error\t" + fields[0] + "\tcannot create the output directory");
+        return;
+    }
+
+    size_t name_at = fields[0].rfind('/');
+    AudioTask task{fields[0], fields[1], name_at == string::npos ? fields[0] : fields[0].substr(name_at + 1), peak,
+                   streaming};
+    job_cnt++;
+    jobs_done.add();
+    pool.submit([conn, task, &jobs_done]() {
+        uint64_t start_ns = monotonicNs();
+        AudioStats original;
+        string output;
+        if (process_task(task, &original, &output)) {
+            ostringstream out;
+            out.precision(9);
+            out << "ok\t" << task.input_filepath << '\t' << output << '\t' << original.peak << '\t'
+                << original.rms << '\t' << gainText(original, task.peak_level) << '\t'
+                << (monotonicNs() - start_ns) / 1e9;
+            conn->reply(out.str());
+        } else {
+            conn->reply("error\t" + task.input_filepath + "\tprocessing failed, see the log");
+        }
+        jobs_done.countDown();
+    });
+}
+
+// Target peaks from "1.0,0.5", each named by its parsed value so that "0.5"
+// and ".50" share an output directory; empty if an element is empty, not a
+// finite number > 0, or names the same directory as an earlier one
+vector<pair<string, float>> parse_peaks(const string& list) {
+    vector<pair<string, float>> peaks;
+    if (list.empty() || list.back() == ',') {
+        return {};
+    }
+    stringstream in(list);
+    string text;
+    while (getline(in, text, ',')) {
+        char* end = nullptr;
+        float peak = text.empty() ? 0.0f : strtof(text.c_str(), &end);
+        if (text.empty() || *end != '\0' || !isfinite(peak) || peak <= 0.0f) {
+            return {};
+        }
+        ostringstream name;
+        name << peak;
+        for (const auto& seen : peaks) {
+            if (seen.first == name.str()) {
+                return {};
+            }
+        }
+        peaks.emplace_back(name.str(), peak);
+    }
+    return peaks;
+}
+
+// Distributed runs over shared storage: --plan scans once and splits the
+// files across the nodes, each node runs its share with --node on its own
+// pool, and --collect merges what the nodes report. Plans and reports live
+// in the plan directory, next to the outputs by default.
+
+// Node names from "a,b,c"; empty if a name is empty, repeated, or not
+// usable as a file name
+vector<string> parse_nodes(const string& list) {
+    vector<string> nodes;
+    stringstream in(list);
+    string name;
+    while (getline(in, name, ',')) {
+        if (name.empty() || name[0] == '.' || name.find_first_of("/ \t") != string::npos ||
+            find(nodes.begin(), nodes.end(), name) != nodes.end()) {
+            return {};
+        }
+        nodes.push_back(name);
+    }
+    return nodes;
+}
+
+string plan_path(const string& dir, const string& node) {
+    return dir + "/" + node + ".plan";
+}
+
+string report_path(const string& dir, const string& node) {
+    return dir + "/" + node + ".report";
+}
+
+// Nodes that have a plan in `dir`
+vector<string> planned_nodes(const string& dir) {
+    vector<string> nodes;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* ent = readdir(d)) {
+            string name = ent->d_name;
+            if (name.size() > 5 && name.compare(name.size() - 5, 5, ".plan") == 0) {
+                nodes.push_back(name.substr(0, name.size() - 5));
+            }
+        }
+        closedir(d);
+    }
+    sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+// --plan: gives each task to its node on the ring and writes one plan per
+// node, largest files first. Plans and reports of an earlier plan are
+// removed, so --collect only ever sees this one.
+bool write_plans(const string& dir, const string& settings, const vector<string>& nodes, vector<SizedTask>& tasks) {
+    if (!make_dirs(dir)) {
+        cerr << "Error: Could not create the plan directory " << dir << ": " << strerror(errno) << endl;
+        return false;
+    }
+    for (const string& old : planned_nodes(dir)) {
+        unlink(plan_path(dir, old).c_str());
+        unlink(report_path(dir, old).c_str());
+    }
+    stable_sort(tasks.begin(), tasks.end(), [](const SizedTask& a, const SizedTask& b) { return a.bytes > b.bytes; });
+    ShardRing ring(nodes);
+    vector<ShardPlan> plans(nodes.size());
+    vector<uint64_t> bytes(nodes.size(), 0);
+    for (const SizedTask& t : tasks) {
+        size_t n = ring.owner(t.task.filename);
+        plans[n].entries.push_back({t.task.filename, t.bytes});
+        bytes[n] += t.bytes;
+    }
+    string all;
+    for (const string& node : nodes) {
+        all += (all.empty() ? "" : ",") + node;
+    }
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        plans[n].settings = settings;
+        plans[n].node = nodes[n];
+        plans[n].nodes = all;
+        if (!plans[n].save(plan_path(dir, nodes[n]))) {
+            cerr << "Error: Could not write the plan " << plan_path(dir, nodes[n]) << endl;
+            return false;
+        }
+        cout << "Plan for " << nodes[n] << ": " << plans[n].entries.size() << " files, " << bytes[n] / 1048576.0
+             << " MB" << endl;
+    }
+    cout << "Plans: " << dir << "; run each node with --node NAME and the same options" << endl;
+    return true;
+}
+
+// --collect: merges the reports of every planned node into
+// <dir>/report.tsv, one line per planned file (normalized with its stats,
+// kept, or missing), and prints a summary per node. Returns the exit
+// status, 1 while any planned file is missing.
+int collect_reports(const string& dir, const string& settings) {
+    vector<string> nodes = planned_nodes(dir);
+    if (nodes.empty()) {
+        cerr << "Error: No plans in " << dir << endl;
+        return 1;
+    }
+    vector<pair<string, string>> rows; // Name, rest of its report line
+    size_t planned = 0, normalized = 0, kept = 0, missing = 0;
+    double slowest = 0.0;
+    for (const string& node : nodes) {
+        ShardPlan plan;
+        if (!plan.load(plan_path(dir, node))) {
+            cerr << "Error: " << plan_path(dir, node) << " is not an audio_norm plan" << endl;
+            return 1;
+        }
+        if (plan.settings != settings) {
+            cerr << "Error: " << plan_path(dir, node) << " was planned with other settings (" << plan.settings
+                 << "); collect with the options of the --plan run" << endl;
+            return 1;
+        }
+        NodeReport report;
+        bool reported = report.load(report_path(dir, node));
+        size_t node_done = 0, node_kept = 0;
+        for (const PlanEntry& e : plan.entries) {
+            auto it = report.normalized.find(e.name);
+            if (it != report.normalized.end()) {
+                const ReportEntry& r = it->second;
+                rows.push_back({e.name, node + "\tnormalized\t" + r.peak + "\t" + r.rms + "\t" + r.gain + "\t" + r.samples});
+                node_done++;
+            } else if (report.kept.count(e.name)) {
+                rows.push_back({e.name, node + "\tkept\t\t\t\t"});
+                node_kept++;
+            } else {
+                rows.push_back({e.name, node + "\tmissing\t\t\t\t"});
+            }
+        }
+        size_t node_missing = plan.entries.size() - node_done - node_kept;
+        cout << "Node " << node << ": " << plan.entries.size() << " planned, " << node_done << " normalized, "
+             << node_kept << " kept, " << node_missing << " missing";
+        if (reported) {
+            cout << ", " << report.seconds << " s";
+        } else {
+            cout << ", no report yet";
+        }
+        cout << endl;
+        planned += plan.entries.size();
+        normalized += node_done;
+        kept += node_kept;
+        missing += node_missing;
+        slowest = max(slowest, report.seconds);
+    }
+    sort(rows.begin(), rows.end());
+
+    string path = dir + "/report.tsv", tmp = path + ".tmp";
+    bool ok;
+    {
+        ofstream out(tmp, ios::trunc);
+        out << "name\tnode\tstatus\tpeak\trms\tgain\tsamples\n";
+        for (const auto& row : rows) {
+            out << row.first << '\t' << row.second << "\n";
+        }
+        out.flush();
+        ok = static_cast<bool>(out);
+    }
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        cerr << "Error: Could not write " << path << endl;
+        return 1;
+    }
+    cout << "Total: " << planned << " planned, " << normalized << " normalized, " << kept << " kept, " << missing
+         << " missing over " << nodes.size() << " nodes; slowest node " << slowest << " s" << endl;
+    cout << "Report: " << path << endl;
+    if (missing > 0) {
+        cout << "Rerun the nodes with missing files with --resume" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+
+    // Split options ("--name") from the positional input_dir output_dir [target_peak]
+    vector<string> positional;
+    bool streaming = false;
+    int num_threads = 0; // 0 = one per available CPU
+    string log_path = "log.txt";
+    int log_flush_ms = 200;
+    PinMode pin_mode = PinMode::None;
+    bool use_pipeline = false;
+    int num_readers = 2;
+    int num_writers = 2;
+    size_t pipeline_mem_mb = 1024;
+    bool use_gpu = false;
+    size_t gpu_batch_mb = 256;
+    string format_name = "same";
+    string metrics_path;
+    bool metrics_json = true;
+    int metrics_port = 0;
+    string manifest_path;
+    string stats_cache_path;
+    bool largest_first = false; // --schedule lpt; fifo keeps the scan streaming into the workers
+    string serve_path;
+    size_t pack_shard_mb = 1024;
+    size_t max_mem_mb = 0;
+    bool resume = false;
+    bool use_journal = true;
+    string journal_path;
+    string plan_nodes;
+    string node_name;
+    bool collecting = false;
+    string plan_dir;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--stream") {
+            streaming = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+            if (num_threads < 1) {
+                cerr << "Error: --threads needs a positive number" << endl;
+                return 1;
+            }
+        } else if (arg == "--log" && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (arg == "--log-flush-ms" && i + 1 < argc) {
+            log_flush_ms = atoi(argv[++i]);
+        } else if (arg == "--no-mmap") {
+            use_mmap_input = false;
+        } else if (arg == "--io-uring") {
+            use_uring = true;
+        } else if (arg == "--format" && i + 1 < argc) {
+            format_name = argv[++i];
+            if (format_name == "same") {
+                output_subtype = 0;
+            } else if (format_name == "float") {
+                output_subtype = SF_FORMAT_FLOAT;
+            } else if (format_name == "pcm16") {
+                output_subtype = SF_FORMAT_PCM_16;
+            } else if (format_name == "pcm24") {
+                output_subtype = SF_FORMAT_PCM_24;
+            } else {
+                cerr << "Error: --format must be same, float, pcm16 or pcm24" << endl;
+                return 1;
+            }
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_path = argv[++i];
+        } else if (arg == "--metrics-format" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name != "json" && name != "prometheus") {
+                cerr << "Error: --metrics-format must be json or prometheus" << endl;
+                return 1;
+            }
+            metrics_json = name == "json";
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metrics_port = atoi(argv[++i]);
+        } else if (arg == "--incremental") {
+            incremental = true;
+        } else if (arg == "--manifest" && i + 1 < argc) {
+            manifest_path = argv[++i];
+            incremental = true;
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--journal" && i + 1 < argc) {
+            journal_path = argv[++i];
+        } else if (arg == "--no-journal") {
+            use_journal = false;
+        } else if (arg == "--stats-cache" && i + 1 < argc) {
+            stats_cache_path = argv[++i];
+            use_stats_cache = true;
+        } else if (arg == "--dither") {
+            use_dither = true;
+        } else if (arg == "--lufs" && i + 1 < argc) {
+            target_lufs = strtof(argv[++i], nullptr);
+            if (!isfinite(target_lufs) || target_lufs >= 0.0f || target_lufs < -70.0f) {
+                cerr << "Error: --lufs needs a loudness between -70 and 0, e.g. -23" << endl;
+                return 1;
+            }
+            loudness_mode = true;
+        } else if (arg == "--true-peak" && i + 1 < argc) {
+            float dbtp = strtof(argv[++i], nullptr);
+            if (!isfinite(dbtp) || dbtp > 0.0f) {
+                cerr << "Error: --true-peak needs a ceiling of at most 0 dBTP, e.g. -1" << endl;
+                return 1;
+            }
+            true_peak_ceiling = pow(10.0f, dbtp / 20.0f);
+        } else if (arg == "--channel-gain" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name != "linked" && name != "unlinked") {
+                cerr << "Error: --channel-gain must be linked or unlinked" << endl;
+                return 1;
+            }
+            per_channel = true;
+            unlinked_gain = name == "unlinked";
+        } else if (arg == "--pack") {
+            use_pack = true;
+        } else if (arg == "--pack-shard-mb" && i + 1 < argc) {
+            pack_shard_mb = max(1, atoi(argv[++i]));
+            use_pack = true;
+        } else if (arg == "--pipeline") {
+            use_pipeline = true;
+        } else if (arg == "--readers" && i + 1 < argc) {
+            num_readers = max(1, atoi(argv[++i]));
+        } else if (arg == "--writers" && i + 1 < argc) {
+            num_writers = max(1, atoi(argv[++i]));
+        } else if (arg == "--max-mem" && i + 1 < argc) {
+            max_mem_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--pipeline-mem" && i + 1 < argc) {
+            pipeline_mem_mb = max(1, atoi(argv[++i]));
+        } else if (arg == "--gpu") {
+            use_gpu = true;
+            use_pipeline = true;
+        } else if (arg == "--gpu-batch-mb" && i + 1 < argc) {
+            gpu_batch_mb = max(1, atoi(argv[++i]));
+            use_gpu = true;
+            use_pipeline = true;
+        } else if (arg == "--schedule" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name != "lpt" && name != "fifo") {
+                cerr << "Error: --schedule must be lpt or fifo" << endl;
+                return 1;
+            }
+            largest_first = name == "lpt";
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (arg == "--plan" && i + 1 < argc) {
+            plan_nodes = argv[++i];
+        } else if (arg == "--node" && i + 1 < argc) {
+            node_name = argv[++i];
+        } else if (arg == "--collect") {
+            collecting = true;
+        } else if (arg == "--plan-dir" && i + 1 < argc) {
+            plan_dir = argv[++i];
+        } else if (arg == "--pin" || arg == "--pin=cores") {
+            pin_mode = PinMode::Cores;
+        } else if (arg == "--pin=numa") {
+            pin_mode = PinMode::Numa;
+        } else if (arg.rfind("--", 0) == 0) {
+            cerr << "Error: Unknown option " << arg << endl;
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    bool serving = !serve_path.empty();
+    if (serving ? positional.size() > 1 : positional.size() < 2) {
+        cerr << "Usage: " << argv[0] << " [--stream] [--threads N] [--max-mem MB] [--pin[=cores|numa]] [--no-mmap] [--io-uring] [--format same|float|pcm16|pcm24] [--dither] [--lufs TARGET] [--true-peak DBTP] [--channel-gain linked|unlinked] [--pack [--pack-shard-mb MB]] [--incremental [--manifest FILE]] [--resume] [--journal FILE | --no-journal] [--stats-cache FILE] [--schedule fifo|lpt] [--metrics FILE [--metrics-format json|prometheus]] [--metrics-port PORT] [--log FILE] [--log-flush-ms MS] [--pipeline [--readers N] [--writers N] [--pipeline-mem MB]] [--gpu [--gpu-batch-mb MB]] [--plan NODE,NODE... | --node NAME | --collect] [--plan-dir DIR] <input_dir> <output_dir> [target_peak[,target_peak...]]" << endl;
+        cerr << "       " << argv[0] << " --serve SOCKET [options] [target_peak]" << endl;
+        return 1;
+    }
+    if (unlinked_gain && measureLevels()) {
+        cerr << "Error: --channel-gain unlinked works on peaks; it cannot be combined with --lufs or --true-peak" << endl;
+        return 1;
+    }
+    if (serving && (use_pipeline || incremental)) {
+        cerr << "Error: --serve cannot be combined with --pipeline or --incremental" << endl;
+        return 1;
+    }
+    if (use_pack && (serving || incremental || resume)) {
+        cerr << "Error: --pack cannot be combined with --serve, --incremental or --resume" << endl;
+        return 1;
+    }
+    if (resume && (serving || !use_journal)) {
+        cerr << "Error: --resume needs the journal of a directory run" << endl;
+        return 1;
+    }
+    bool planning = !plan_nodes.empty();
+    if (planning + !node_name.empty() + collecting > 1) {
+        cerr << "Error: --plan, --node and --collect are separate steps; give one of them" << endl;
+        return 1;
+    }
+    if ((planning || !node_name.empty() || collecting) && (serving || use_pack)) {
+        cerr << "Error: --plan, --node and --collect cannot be combined with --serve or --pack" << endl;
+        return 1;
+    }
+    if (planning && (incremental || resume)) {
+        cerr << "Error: --incremental and --resume apply to the nodes' runs, not to --plan" << endl;
+        return 1;
+    }
+    vector<string> nodes = parse_nodes(planning ? plan_nodes : node_name);
+    if ((planning && nodes.empty()) || (!node_name.empty() && nodes.size() != 1)) {
+        cerr << "Error: node names must be distinct, non-empty and usable as file names" << endl;
+        return 1;
+    }
+
+    if (num_threads == 0) {
+        num_threads = defaultWorkerCount();
+    }
+
+    string input_dir_path = serving ? "" : positional[0];
+    string output_dir_path = serving ? "" : positional[1];
+    size_t peak_arg = serving ? 0 : 2;
+    // One target peak, or a comma-separated list with one output directory
+    // per target (output_dir/<target>), all written from a single analysis
+    vector<string> peak_names;
+    vector<float> peak_levels;
+    if (positional.size() > peak_arg) {
+        for (const auto& peak : parse_peaks(positional[peak_arg])) {
+            peak_names.push_back(peak.first);
+            peak_levels.push_back(peak.second);
+        }
+        if (peak_levels.empty()) {
+            cerr << "Error: target peaks must be distinct numbers greater than 0, separated by commas" << endl;
+            return 1;
+        }
+    }
+    float peak_level = peak_levels.empty() ? 1.0f : peak_levels[0];
+    // output_dir itself, before it becomes output_dir/<target> with several
+    // targets: the pack holds every target's records, named <target>/..., and
+    // the journal covers all targets
+    string output_root = output_dir_path;
+    vector<OutputTarget> more_roots;
+    if (peak_levels.size() > 1) {
+        if (serving || incremental || loudness_mode) {
+            cerr << "Error: Several target peaks cannot be combined with --serve, --incremental or --lufs" << endl;
+            return 1;
+        }
+        for (size_t k = 1; k < peak_levels.size(); ++k) {
+            more_roots.push_back(OutputTarget{output_dir_path + "/" + peak_names[k], peak_levels[k]});
+        }
+        output_dir_path += "/" + peak_names[0];
+    }
+    // Checked before anything is written under output_dir: a journal, a
+    // resume's clean-up or a pack there would land in the input tree
+    if (!serving) {
+        ScanContext roots;
+        roots.addOutputDir(output_root);
+        roots.addOutputDir(output_dir_path);
+        for (const OutputTarget& root : more_roots) {
+            roots.addOutputDir(root.output_filepath);
+        }
+        if (roots.isOutputDir(input_dir_path)) {
+            cerr << "Error: output_dir must not be input_dir" << endl;
+            return 1;
+        }
+    }
+    // What a journal, a plan and a node report were written for: runs that
+    // share them must agree on these
+    string run_settings = "input=" + input_dir_path + ";peaks=" + (positional.size() > peak_arg ? positional[peak_arg] : "1") +
+                          ";stream=" + (streaming ? "1" : "0") + ";" + outputOptions();
+    if (plan_dir.empty()) {
+        plan_dir = output_root + "/.audio_norm_plan";
+    }
+    if (collecting) {
+        return collect_reports(plan_dir, run_settings);
+    }
+    // Nodes usually share the output tree, so each keeps its own journal and manifest
+    string node_suffix = node_name.empty() ? "" : "." + node_name;
+
+    if (serving) {
+        cout << "Serving normalization requests on: " << serve_path << endl;
+        cout << "Default target peak level: " << peak_level << endl;
+    } else {
+        cout << "Processing audio files from: " << input_dir_path << endl;
+        if (use_pack) {
+            cout << "Packing normalized audio into: " << output_root << " (shards of " << pack_shard_mb << " MB)" << endl;
+        } else {
+            cout << "Saving normalized files to: " << output_dir_path << endl;
+            for (const OutputTarget& root : more_roots) {
+                cout << "                       and: " << root.output_filepath << endl;
+            }
+        }
+        if (!more_roots.empty()) {
+            cout << "Target peak levels: " << positional[peak_arg] << " (one analysis, all outputs in one pass)" << endl;
+        } else if (!loudness_mode) {
+            cout << "Target peak level: " << peak_level << endl;
+        }
+    }
+    if (loudness_mode) {
+        cout << "Target loudness: " << target_lufs << " LUFS (EBU R128 gating)" << endl;
+    }
+    if (true_peak_ceiling > 0.0f) {
+        cout << "True-peak ceiling: " << 20.0f * log10(true_peak_ceiling) << " dBTP" << endl;
+    }
+    if (per_channel) {
+        cout << "Channel gain: " << (unlinked_gain ? "unlinked, one gain per channel" : "linked, per-channel stats")
+             << endl;
+    }
+    cout << "Sample kernels: " << activeKernelName() << endl;
+    cout << "Worker threads: " << num_threads;
+    if (pin_mode == PinMode::Cores) {
+        cout << " (pinned to physical cores)";
+    } else if (pin_mode == PinMode::Numa) {
+        cout << " (spread across NUMA nodes)";
+    }
+    cout << endl;
+    unique_ptr<MemoryBudget> budget;
+    if (max_mem_mb > 0) {
+        budget.reset(new MemoryBudget(max_mem_mb << 20));
+        memory_budget = budget.get();
+        cout << "Memory budget: " << max_mem_mb << " MB of decoded audio and scratch; larger files are streamed" << endl;
+    }
+    if (use_pipeline) {
+        cout << "Pipeline: " << num_readers << " readers, " << num_threads << " compute, "
+             << num_writers << " writers, " << pipeline_mem_mb << " MB in flight" << endl;
+    }
+    unique_ptr<GpuOffload> gpu;
+    if (use_gpu) {
+        gpu.reset(new GpuOffload());
+        if (gpu->init(gpu_batch_mb << 20)) {
+            gpu_offload = gpu.get();
+            // The device scales float buffers, so canonical WAV is decoded instead of mapped
+            use_mmap_input = false;
+            cout << "GPU: " << gpu->deviceName() << ", batches of up to " << (gpu->capacitySamples() * sizeof(float) >> 20)
+                 << " MB; inputs decoded to float, not mapped" << endl;
+        } else {
+            cout << "GPU: not available (" << gpu->error() << "), using the CPU kernels" << endl;
+            gpu.reset();
+        }
+    }
+    cout << "Output format: " << (format_name == "same" ? "same as input" : format_name) << (use_dither ? ", dithered" : "") << endl;
+    if (streaming) {
+        cout << "Streaming mode: " << STREAM_BLOCK_FRAMES << " frames per block" << endl;
+    }
+    if (use_uring) {
+        IoUring probe;
+        if (probe.init(1)) {
+            cout << "I/O: io_uring, " << URING_DEPTH << " requests in flight per thread" << endl;
+        } else {
+            cout << "I/O: io_uring is not available here, using blocking I/O" << endl;
+            use_uring = false;
+        }
+    }
+
+    // Check if input_dir_path is a directory
+    struct stat sb;
+    if (!serving && (stat(input_dir_path.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode))) {
+        cerr << "Error: Input path '" << input_dir_path << "' is not a valid directory." << endl;
+        return 1;
+    }
+    if (use_pack) {
+        if (!make_dirs(output_root)) {
+            cerr << "Error: Could not create the pack directory " << output_root << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        output_pack.open(output_root, (uint64_t)pack_shard_mb << 20);
+    }
+    // A pack's index is only written at the end, so packed runs keep no journal
+    journaling = use_journal && !serving && !use_pack && !planning;
+    if (journaling) {
+        if (journal_path.empty()) {
+            journal_path = output_root + "/.audio_norm_journal" + node_suffix;
+        }
+        const string& settings = run_settings;
+        if (resume) {
+            if (!run_journal.load(journal_path)) {
+                cerr << "Error: " << journal_path << " is not an audio_norm journal" << endl;
+                return 1;
+            }
+            if (!run_journal.settings().empty() && run_journal.settings() != settings) {
+                cerr << "Error: " << journal_path << " was written by a run with other settings (" << run_journal.settings()
+                     << "); run without --resume to start over" << endl;
+                return 1;
+            }
+        }
+        if (!make_dirs(output_root) || !run_journal.start(journal_path, settings, resume, log_flush_ms)) {
+            cerr << "Error: Could not write the journal " << journal_path << endl;
+            return 1;
+        }
+        if (resume) {
+            cout << "Resuming: " << run_journal.doneCount() << " files already done according to " << journal_path << endl;
+            // Other nodes may be writing into the same tree right now
+            int stale = node_name.empty() ? remove_stale_parts(output_root) : 0;
+            if (stale > 0) {
+                cout << "Removed " << stale << " partial outputs of the interrupted run" << endl;
+            }
+        }
+    }
+    ShardPlan node_plan;
+    if (!node_name.empty()) {
+        string path = plan_path(plan_dir, node_name);
+        if (!node_plan.load(path)) {
+            cerr << "Error: Could not read the plan " << path << endl;
+            return 1;
+        }
+        if (node_plan.settings != run_settings) {
+            cerr << "Error: " << path << " was planned with other settings (" << node_plan.settings
+                 << "); run the node with the options of the --plan run" << endl;
+            return 1;
+        }
+        if (!node_report.start(report_path(plan_dir, node_name), run_settings, log_flush_ms)) {
+            cerr << "Error: Could not write the report " << report_path(plan_dir, node_name) << endl;
+            return 1;
+        }
+        reporting = true;
+        cout << "Node " << node_name << ": " << node_plan.entries.size() << " files planned for it in " << path << endl;
+    }
+
+ 
+ 
+    if (incremental) {
+        if (manifest_path.empty()) {
+            manifest_path = output_dir_path + "/.audio_norm_manifest" + node_suffix;
+        }
+        if (!output_manifest.load(manifest_path)) {
+            cerr << "Error: " << manifest_path << " is not an audio_norm manifest" << endl;
+            return 1;
+        }
+        cout << "Incremental mode: manifest " << manifest_path << endl;
+    }
+    if (use_stats_cache) {
+        if (!stats_cache.load(stats_cache_path)) {
+            cerr << "Error: " << stats_cache_path << " is not an audio_norm stats cache" << endl;
+            return 1;
+        }
+        cout << "Stats cache: " << stats_cache_path << endl;
+    }
+
+    // The server stops on SIGINT / SIGTERM, taken with sigwait() by the main
+    // thread; blocking them first keeps every thread started below off them
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    if (serving) {
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+    }
+
+    // A --plan run only scans and writes the plans, so it needs neither
+    if (!planning && !app_log.open(log_path, log_flush_ms)) {
+        cerr << "Could not open the log file " << log_path << endl; // Output if log file fails
+    }
+
+    // Either the work-stealing pool runs whole files, or the pipeline splits
+    // them into read / compute / write stages
+    unique_ptr<ThreadPool> pool;
+    unique_ptr<AudioPipeline> pipeline;
+    vector<vector<int>> cpu_plan = workerCpuPlan(num_threads, pin_mode);
+    bool started = true;
+    if (planning) {
+        // Nothing is processed here; the scan gets a pool of its own below
+    } else if (use_pipeline) {
+        pipeline.reset(new AudioPipeline(num_readers, num_threads, num_writers, pipeline_mem_mb << 20, cpu_plan));
+        started = pipeline->start();
+    } else {
+        pool.reset(new ThreadPool(num_threads));
+        started = pool->start(cpu_plan);
+        block_pool = pool.get(); // Large files are also split across the workers
+    }
+    if (!started) {
+        cerr << "Error: Could not create worker threads" << endl;
+        return 1;
+    }
+
+    // Workers start on each file as soon as it is found
+    uint64_t run_start_ns = monotonicNs();
+    CompletionLatch tasks_done;
+    atomic<int> task_cnt{0};
+    atomic<int> skipped_cnt{0};
+    atomic<int> resumed_cnt{0};
+
+    // Declared after the pool so it stops before the pool goes away
+    MetricsServer metrics_server;
+    if (metrics_port > 0) {
+        auto render = [&](bool json) {
+            vector<MetricValue> values = collectCounters(pool.get(), task_cnt.load());
+            return json ? app_metrics.toJson(values) : app_metrics.toPrometheus(values);
+        };
+        if (metrics_server.start(metrics_port, render)) {
+            cout << "Metrics: http://127.0.0.1:" << metrics_port << "/metrics" << endl;
+        } else {
+            cerr << "Could not listen on metrics port " << metrics_port << endl;
+        }
+    }
+
+    auto dispatch = [&](const AudioTask& task, uint64_t bytes) {
+        if (pipeline) {
+            pipeline->submit(task);
+            return;
+        }
+        tasks_done.add();
+        auto job = [task, &tasks_done]() {
+            process_task(task);
+            tasks_done.countDown();
+        };
+        if (bytes >= PRIORITY_FILE_BYTES) {
+            pool->submitPriority(job);
+        } else {
+            pool->submit(job);
+        }
+    };
+
+    // Called from the scan threads. With --schedule fifo (the default) each
+    // task is dispatched as soon as it is found; with lpt tasks are collected
+    // until the scan ends and then dispatched largest first, and a --plan run
+    // collects them the same way to split them across the nodes.
+    vector<SizedTask> pending_tasks;
+    pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+    auto submit = [&](const AudioTask& task) {
+        if (resume && run_journal.isDone(task.filename)) {
+            resumed_cnt++;
+            if (reporting) {
+                node_report.keep(task.filename);
+            }
+            return;
+        }
+        if (incremental && output_manifest.upToDate(task.filename, task.input_filepath, existingOutputPath(task.output_filepath),
+                                                    task.peak_level, outputOptions())) {
+            skipped_cnt++;
+            if (reporting) {
+                node_report.keep(task.filename);
+            }
+            return;
+        }
+        task_cnt++;
+        FileStamp stamp;
+        uint64_t bytes = statFile(task.input_filepath, stamp) ? stamp.size : 0;
+        // A plan needs every task, so planning always collects them
+        if (!largest_first && !planning) {
+            dispatch(task, bytes);
+            return;
+        }
+        pthread_mutex_lock(&pending_mutex);
+        pending_tasks.push_back({task, bytes});
+        pthread_mutex_unlock(&pending_mutex);
+    };
+
+    if (serving) {
+        // Requests run on the same warm pool and thread_local processors
+        // until a stop signal; queued files still finish before exit
+        JobServer server;
+        auto on_line = [&](const shared_ptr<JobConnection>& conn, const string& line) {
+            serve_request(conn, line, peak_level, streaming, *pool, tasks_done, task_cnt);
+        };
+        if (!server.start(serve_path, on_line)) {
+            cerr << "Error: Could not listen on " << serve_path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        cout << "Ready" << endl;
+        int sig;
+        sigwait(&stop_signals, &sig);
+        cout << "Stopping, finishing queued files" << endl;
+        server.stop();
+    } else {
+        // The top directory is listed here; subdirectories are scanned on the
+        // pool (a separate one in pipeline mode, whose threads are all busy,
+        // and for a --plan run, which starts no workers)
+        unique_ptr<ThreadPool> scan_pool;
+        if (!pool && !reporting) {
+            scan_pool.reset(new ThreadPool(num_readers));
+            scan_pool->start();
+        }
+        CompletionLatch scans_done;
+        ScanContext scan{input_dir_path, output_dir_path, peak_level, more_roots, streaming,
+                         pool ? pool.get() : scan_pool.get(), &scans_done, submit, {}};
+        scan.planning = planning;
+        // Created up front so it can be recognized if it lies inside the input;
+        // a --plan run leaves creating it to the nodes
+        if (!planning && !make_dirs(output_dir_path)) {
+            cerr << "Error: Could not create " << output_dir_path << endl;
+            return 1;
+        }
+        scan.addOutputDir(output_dir_path);
+        for (const OutputTarget& root : more_roots) {
+            scan.addOutputDir(root.output_filepath);
+        }
+        if (reporting) {
+            // A node takes its files from the plan instead of scanning
+            set<string> ready;
+            for (const PlanEntry& e : node_plan.entries) {
+                size_t slash = e.name.rfind('/');
+                string rel = slash == string::npos ? "" : e.name.substr(0, slash);
+                if (ready.insert(rel).second && !make_target_dirs(scan, rel)) {
+                    return 1;
+                }
+                submit(make_task(scan, rel, slash == string::npos ? e.name : e.name.substr(slash + 1)));
+            }
+        } else if (!scan_directory(scan, "")) {
+            return 1;
+        }
+        scans_done.wait();
+        if (scan_pool) {
+            scan_pool->shutdown();
+        }
+
+        if (planning) {
+            if (!write_plans(plan_dir, run_settings, nodes, pending_tasks)) {
+                return 1;
+            }
+            pending_tasks.clear();
+        }
+        if (!pending_tasks.empty()) {
+            uint64_t total = 0;
+            for (const SizedTask& t : pending_tasks) {
+                total += t.bytes;
+            }
+            uint64_t busiest = scheduleLargestFirst(pending_tasks, num_threads);
+            cout << "Schedule: " << pending_tasks.size() << " files largest first, predicted makespan "
+                 << busiest / 1048576.0 << " MB on the busiest of " << num_threads << " workers (ideal "
+                 << total / 1048576.0 / num_threads << " MB)" << endl;
+            for (const SizedTask& t : pending_tasks) {
+                dispatch(t.task, t.bytes);
+            }
+        }
+    }
+    pthread_mutex_destroy(&pending_mutex);
+
+    // Wait for every submitted file, then join the workers
+    if (pipeline) {
+        pipeline->finish();
+    } else if (pool) {
+        tasks_done.wait();
+        block_pool = nullptr;
+        pool->shutdown();
+    }
+    metrics_server.stop();
+
+    if (incremental) {
+        cout << "Up to date, skipped: " << skipped_cnt << " files" << endl;
+        if (output_manifest.isDirty() && !output_manifest.save(manifest_path)) {
+            cerr << "Error: Could not write the manifest " << manifest_path << endl;
+        }
+    }
+    if (reporting) {
+        node_report.finish((monotonicNs() - run_start_ns) / 1e9);
+        cout << "Report: " << report_path(plan_dir, node_name) << endl;
+    }
+    if (journaling) {
+        run_journal.close();
+        if (resume) {
+            cout << "Resumed, skipped: " << resumed_cnt << " files finished by the earlier run" << endl;
+        }
+    }
+    if (use_pack) {
+        if (output_pack.finish()) {
+            cout << "Pack: " << output_pack.recordCount() << " files in " << output_pack.shardCount() << " shards, index "
+                 << output_root << "/pack.idx" << endl;
+        } else {
+            cerr << "Error: Could not write the pack index " << output_root << "/pack.idx" << endl;
+        }
+    }
+    if (use_stats_cache && stats_cache.isDirty() && !stats_cache.save(stats_cache_path)) {
+        cerr << "Error: Could not write the stats cache " << stats_cache_path << endl;
+    }
+    if (!serving && task_cnt == 0 && skipped_cnt == 0 && resumed_cnt == 0) {
+        cout << "No audio files found to process." << endl;
+    }
+    app_log.close();
+
+    if (!metrics_path.empty()) {
+        vector<MetricValue> values = collectCounters(pool.get(), task_cnt.load());
+        ofstream metrics_out(metrics_path);
+        metrics_out << (metrics_json ? app_metrics.toJson(values) : app_metrics.toPrometheus(values));
+        if (!metrics_out) {
+            cerr << "Could not write metrics to " << metrics_path << endl;
+        }
     }
 
-    pthread_mutex_destroy(&global_queue_mutex);
-    pthread_cond_destroy(&new_task);
-    pthread_cond_destroy(&task_done);
     pthread_mutex_destroy(&log_mutex);
 
     return 0;
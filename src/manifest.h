@@ -0,0 +1,294 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size and modification time of a file, as recorded by the manifest
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && mtime_ns == other.mtime_ns;
+    }
+    bool operator!=(const FileStamp& other) const {
+        return !(*this == other);
+    }
+};
+
+inline bool statFile(const std::string& path, FileStamp& stamp) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        return false;
+    }
+    stamp.size = sb.st_size;
+    stamp.mtime_ns = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    return true;
+}
+
+namespace content_hash {
+
+const uint64_t P1 = 0x9E3779B185EBCA87ull;
+const uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t P3 = 0x165667B19E3779F9ull;
+const uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t mixRound(uint64_t acc, uint64_t lane) {
+    return rotl(acc + lane * P2, 31) * P1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t lane) {
+    return (acc ^ mixRound(0, lane)) * P1 + P4;
+}
+
+} // namespace content_hash
+
+// XXH64 of `n` bytes: four independent lanes over 32-byte stripes keep it
+// at memory speed, so hashing a file costs about as much as reading it.
+inline uint64_t hashBytes(const uint8_t* p, size_t n, uint64_t seed = 0) {
+    using namespace content_hash;
+    const uint8_t* end = p + n;
+    uint64_t h;
+    if (n >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = mixRound(v1, read64(p));
+            v2 = mixRound(v2, read64(p + 8));
+            v3 = mixRound(v3, read64(p + 16));
+            v4 = mixRound(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + P5;
+    }
+    h += n;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ mixRound(0, read64(p)), 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        h = rotl(h ^ (v * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h = rotl(h ^ (*p * P5), 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hash of a whole file's contents, read through a temporary mapping
+inline bool hashFile(const std::string& path, uint64_t& hash) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = sb.st_size;
+    if (size == 0) {
+        close(fd);
+        hash = hashBytes(nullptr, 0);
+        return true;
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    hash = hashBytes(static_cast<const uint8_t*>(data), size);
+    munmap(data, size);
+    return true;
+}
+
+// What incremental mode knows about one processed input
+struct ManifestEntry {
+    FileStamp input;
+    uint64_t content_hash = 0;
+    float target_peak = 0.0f;
+    float measured_peak = 0.0f; // Peak of the input before normalization
+    std::string options;        // Other settings that change the output bytes
+    FileStamp output;
+};
+
+// Record of the inputs an earlier run already normalized, kept as a
+// tab-separated text file next to the outputs. An input is up to date when
+// its output is still exactly what the run wrote and either its size and
+// mtime are unchanged or, when they moved (touch, copy), its content hash
+// still matches. Keys are paths relative to the input root. Thread-safe.
+class Manifest {
+private:
+    static constexpr const char* HEADER = "# audio_norm manifest v1";
+
+    std::unordered_map<std::string, ManifestEntry> entries;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    bool dirty = false;
+
+public:
+    Manifest() = default;
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    ~Manifest() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Reads `path` if it exists; a missing file is an empty manifest.
+    // Returns false only for a file in an unknown format.
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            return true;
+        }
+        std::string line;
+        if (!std::getline(in, line) || line != HEADER) {
+            return false;
+        }
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string key, hash;
+            ManifestEntry e;
+            char* end = nullptr;
+            if (std::getline(fields, key, '\t') &&
+                fields >> e.input.size >> e.input.mtime_ns >> hash >> e.target_peak >> e.measured_peak >>
+                    e.output.size >> e.output.mtime_ns) {
+                // A damaged line is dropped; its input is just normalized again
+                e.content_hash = strtoull(hash.c_str(), &end, 16);
+                if (*end != '\0') {
+                    continue;
+                }
+                fields.ignore(1);
+                std::getline(fields, e.options);
+                entries[key] = e;
+            }
+        }
+        return true;
+    }
+
+    // Writes the manifest to a temporary file and renames it over `path`,
+    // so an interrupted save leaves the previous manifest intact
+    bool save(const std::string& path) {
+        pthread_mutex_lock(&mutex);
+        std::string tmp = path + ".tmp";
+        bool ok;
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out.precision(9);
+            out << HEADER << "\n";
+            char hash[17];
+            for (const auto& kv : entries) {
+                const ManifestEntry& e = kv.second;
+                snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(e.content_hash));
+                out << kv.first << '\t' << e.input.size << '\t' << e.input.mtime_ns << '\t' << hash << '\t'
+                    << e.target_peak << '\t' << e.measured_peak << '\t' << e.output.size << '\t'
+                    << e.output.mtime_ns << '\t' << e.options << "\n";
+            }
+            out.flush();
+            ok = static_cast<bool>(out);
+        }
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        if (ok) {
+            dirty = false;
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    bool isDirty() {
+        pthread_mutex_lock(&mutex);
+        bool d = dirty;
+        pthread_mutex_unlock(&mutex);
+        return d;
+    }
+
+    // True when `key` was already normalized to `target_peak` with `options`
+    // and neither its input nor its output has changed since
+    bool upToDate(const std::string& key, const std::string& input_path, const std::string& output_path,
+                  float target_peak, const std::string& options) {
+        pthread_mutex_lock(&mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        ManifestEntry e = it->second;
+        pthread_mutex_unlock(&mutex);
+
+        FileStamp input, output;
+        if (e.target_peak != target_peak || e.options != options || !statFile(input_path, input) ||
+            !statFile(output_path, output) || output != e.output || input.size != e.input.size) {
+            return false;
+        }
+        if (input == e.input) {
+            return true;
+        }
+        // Same size, new mtime: the content decides, and a match refreshes the stamp
+        uint64_t hash;
+        if (!hashFile(input_path, hash) || hash != e.content_hash) {
+            return false;
+        }
+        pthread_mutex_lock(&mutex);
+        entries[key].input = input;
+        dirty = true;
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+
+    // Records a finished output. `input` and `content_hash` describe the input
+    // as it was processed; the output is stat'ed here.
+    bool record(const std::string& key, const FileStamp& input, uint64_t content_hash, const std::string& output_path,
+                float target_peak, float measured_peak, const std::string& options) {
+        if (key.find_first_of("\t\n") != std::string::npos) {
+            return false; // Would break the line format
+        }
+        ManifestEntry e;
+        if (!statFile(output_path, e.output)) {
+            return false;
+        }
+        e.input = input;
+        e.content_hash = content_hash;
+        e.target_peak = target_peak;
+        e.measured_peak = measured_peak;
+        e.options = options;
+        pthread_mutex_lock(&mutex);
+        entries[key] = e;
+        dirty = true;
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+};
+
+#endif // MANIFEST_H
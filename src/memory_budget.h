@@ -0,0 +1,100 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+
+// Global byte budget that workers reserve against before allocating a
+// whole-file buffer (--max-mem). acquire() blocks until the bytes are free,
+// so memory in use never exceeds the limit however many workers run; a
+// request larger than the whole budget could never be granted, and callers
+// check fits() first and take a path that needs less. Thread-safe.
+class MemoryBudget {
+private:
+    size_t limit;
+    size_t used = 0;
+    size_t peak = 0;
+    uint64_t wait_count = 0;
+    uint64_t wait_ns = 0;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t freed = PTHREAD_COND_INITIALIZER;
+
+    static uint64_t nowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+public:
+    explicit MemoryBudget(size_t limit_bytes) : limit(limit_bytes) {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    ~MemoryBudget() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&freed);
+    }
+
+    size_t limitBytes() const {
+        return limit;
+    }
+
+    bool fits(size_t bytes) const {
+        return bytes <= limit;
+    }
+
+    // Blocks until `bytes` (at most the limit) are free and takes them. The
+    // caller must hold no reservation of its own while it waits.
+    void acquire(size_t bytes) {
+        pthread_mutex_lock(&mutex);
+        if (used + bytes > limit) {
+            uint64_t start = nowNs();
+            while (used + bytes > limit) {
+                pthread_cond_wait(&freed, &mutex);
+            }
+            wait_count++;
+            wait_ns += nowNs() - start;
+        }
+        used += bytes;
+        if (used > peak) {
+            peak = used;
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void release(size_t bytes) {
+        pthread_mutex_lock(&mutex);
+        used -= bytes;
+        // Waiters want different amounts; each rechecks its own
+        pthread_cond_broadcast(&freed);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // Largest amount reserved at once so far
+    size_t peakBytes() {
+        pthread_mutex_lock(&mutex);
+        size_t p = peak;
+        pthread_mutex_unlock(&mutex);
+        return p;
+    }
+
+    // acquire() calls that had to wait, and for how long in total
+    uint64_t waits() {
+        pthread_mutex_lock(&mutex);
+        uint64_t w = wait_count;
+        pthread_mutex_unlock(&mutex);
+        return w;
+    }
+
+    uint64_t waitNs() {
+        pthread_mutex_lock(&mutex);
+        uint64_t ns = wait_ns;
+        pthread_mutex_unlock(&mutex);
+        return ns;
+    }
+};
+
+#endif // MEMORY_BUDGET_H
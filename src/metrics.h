@@ -0,0 +1,269 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+inline uint64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Lock-free latency histogram with power-of-two nanosecond buckets: bucket b
+// holds durations in [2^b, 2^(b+1)) ns. record() is a handful of relaxed
+// atomic adds, cheap enough to leave on for every file.
+class Histogram {
+public:
+    static const int BUCKETS = 64;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total_count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+
+public:
+    void record(uint64_t ns) {
+        int b = ns ? 63 - __builtin_clzll(ns) : 0;
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = max_ns.load(std::memory_order_relaxed);
+        while (ns > seen && !max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return total_count.load(std::memory_order_relaxed); }
+    uint64_t sumNs() const { return total_ns.load(std::memory_order_relaxed); }
+    uint64_t maxNs() const { return max_ns.load(std::memory_order_relaxed); }
+    uint64_t bucket(int b) const { return buckets[b].load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding quantile q (0..1), in nanoseconds
+    uint64_t quantileNs(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * n));
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += bucket(b);
+            if (seen >= rank && seen > 0) {
+                return b < 63 ? std::min<uint64_t>(2ull << b, maxNs()) : maxNs();
+            }
+        }
+        return maxNs();
+    }
+};
+
+// Records the lifetime of the scope into a histogram
+class ScopedTimer {
+private:
+    Histogram& histogram;
+    uint64_t start;
+
+public:
+    explicit ScopedTimer(Histogram& h) : histogram(h), start(monotonicNs()) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        histogram.record(monotonicNs() - start);
+    }
+};
+
+// A point-in-time value exported next to the histograms (counters read from
+// the pool, the logger, ...)
+struct MetricValue {
+    std::string name;
+    std::string help;
+    double value;
+};
+
+// Named histograms plus rendering. Histograms are registered up front and
+// live as long as the registry, so hot paths keep plain references to them.
+class MetricsRegistry {
+private:
+    struct Entry {
+        std::string name;
+        std::string help;
+        Histogram histogram;
+    };
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::string prefix;
+
+public:
+    explicit MetricsRegistry(const std::string& name_prefix) : prefix(name_prefix) {}
+
+    // Not thread-safe: register everything before the workers start
+    Histogram& histogram(const std::string& name, const std::string& help) {
+        entries.emplace_back(new Entry{name, help, {}});
+        return entries.back()->histogram;
+    }
+
+    std::string toJson(const std::vector<MetricValue>& values) const {
+        std::ostringstream js;
+        js.precision(9);
+        js << "{\n  \"histograms\": {";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Histogram& h = entries[i]->histogram;
+            js << (i ? "," : "") << "\n    \"" << entries[i]->name << "\": {\"count\": " << h.count()
+               << ", \"sum_s\": " << h.sumNs() / 1e9
+               << ", \"mean_s\": " << (h.count() ? h.sumNs() / 1e9 / h.count() : 0.0)
+               << ", \"p50_s\": " << h.quantileNs(0.5) / 1e9
+               << ", \"p90_s\": " << h.quantileNs(0.9) / 1e9
+               << ", \"p99_s\": " << h.quantileNs(0.99) / 1e9
+               << ", \"max_s\": " << h.maxNs() / 1e9 << "}";
+        }
+        js << "\n  },\n  \"counters\": {";
+        for (size_t i = 0; i < values.size(); ++i) {
+            js << (i ? "," : "") << "\n    \"" << values[i].name << "\": " << values[i].value;
+        }
+        js << "\n  }\n}\n";
+        return js.str();
+    }
+
+    // Prometheus text exposition format; durations are in seconds
+    std::string toPrometheus(const std::vector<MetricValue>& values) const {
+        std::ostringstream out;
+        out.precision(9);
+        for (const auto& entry : entries) {
+            const Histogram& h = entry->histogram;
+            std::string name = prefix + entry->name + "_seconds";
+            out << "# HELP " << name << " " << entry->help << "\n# TYPE " << name << " histogram\n";
+            // 1 us .. ~69 s covers every stage; smaller buckets fold into the first bound
+            uint64_t cumulative = 0;
+            for (int b = 0; b < Histogram::BUCKETS; ++b) {
+                cumulative += h.bucket(b);
+                if (b >= 9 && b <= 35) {
+                    out << name << "_bucket{le=\"" << (2ull << b) / 1e9 << "\"} " << cumulative << "\n";
+                }
+            }
+            out << name << "_bucket{le=\"+Inf\"} " << h.count() << "\n";
+            out << name << "_sum " << h.sumNs() / 1e9 << "\n";
+            out << name << "_count " << h.count() << "\n";
+        }
+        for (const auto& v : values) {
+            std::string name = prefix + v.name;
+            out << "# HELP " << name << " " << v.help << "\n# TYPE " << name << " counter\n";
+            out << name << " " << v.value << "\n";
+        }
+        return out.str();
+    }
+};
+
+// Minimal HTTP endpoint for watching long runs: GET /metrics returns the
+// Prometheus text, GET /metrics.json the JSON. Listens on 127.0.0.1 only and
+// serves one connection at a time from its own thread.
+class MetricsServer {
+private:
+    int listen_fd = -1;
+    pthread_t thread;
+    bool running = false;
+    std::atomic<bool> stopping{false};
+    std::function<std::string(bool json)> render;
+
+    static void* serverMain(void* arg) {
+        static_cast<MetricsServer*>(arg)->serve();
+        return nullptr;
+    }
+
+    void serve() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            pollfd pfd = {listen_fd, POLLIN, 0};
+            // Wake up regularly to notice stop()
+            if (poll(&pfd, 1, 200) <= 0) {
+                continue;
+            }
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            timeval timeout = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            char request[1024];
+            ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+            if (n > 0) {
+                request[n] = '\0';
+                bool json = strncmp(request, "GET /metrics.json", 17) == 0;
+                bool known = json || strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0;
+                std::string body = known ? render(json) : "not found\n";
+                std::string head = std::string("HTTP/1.0 ") + (known ? "200 OK" : "404 Not Found") +
+                                   "\r\nContent-Type: " + (json ? "application/json" : "text/plain; version=0.0.4") +
+                                   "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+                std::string response = head + body;
+                for (size_t sent = 0; sent < response.size();) {
+                    ssize_t w = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                    if (w <= 0) {
+                        break;
+                    }
+                    sent += w;
+                }
+            }
+            close(fd);
+        }
+    }
+
+public:
+    MetricsServer() = default;
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    ~MetricsServer() {
+        stop();
+    }
+
+    bool start(int port, std::function<std::string(bool json)> renderer) {
+        render = std::move(renderer);
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 8) != 0 ||
+            pthread_create(&thread, NULL, serverMain, this) != 0) {
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        running = true;
+        return true;
+    }
+
+    void stop() {
+        if (!running) {
+            return;
+        }
+        stopping.store(true, std::memory_order_release);
+        pthread_join(thread, NULL);
+        close(listen_fd);
+        listen_fd = -1;
+        running = false;
+    }
+};
+
+#endif // METRICS_H
@@ -0,0 +1,109 @@
+#ifndef RUN_JOURNAL_H
+#define RUN_JOURNAL_H
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_set>
+#include <unistd.h>
+#include "async_logger.h"
+
+// Append-only record of the inputs a directory run has finished, so a run
+// that died partway can be resumed without redoing them. Entries go through
+// an AsyncLogger and reach the file in batches every flush interval; a
+// crash loses at most the last batch, and those files are simply done
+// again. Outputs are renamed into place before their entry is queued, so
+// an entry never refers to a partial file.
+//
+// Format: a header line, "S\t<settings>" for the run that created the
+// journal, then one "D\t<input path relative to input_dir>" per file.
+class RunJournal {
+private:
+    static constexpr const char* HEADER = "# audio_norm journal v1";
+
+    AsyncLogger writer;
+    std::unordered_set<std::string> done;
+    std::string run_settings;
+    size_t complete_bytes = 0; // Of the loaded file, up to its last newline
+
+public:
+    RunJournal() = default;
+    RunJournal(const RunJournal&) = delete;
+    RunJournal& operator=(const RunJournal&) = delete;
+
+    // Reads the journal of an earlier run; a missing file is an empty
+    // journal. Returns false only for a file in an unknown format. A last
+    // line without its newline was cut off by the crash and is ignored.
+    bool load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return true;
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t start = 0;
+        bool first = true;
+        for (size_t end; (end = text.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string line = text.substr(start, end - start);
+            complete_bytes = end + 1;
+            if (first) {
+                if (line != HEADER) {
+                    return false;
+                }
+                first = false;
+            } else if (line.compare(0, 2, "S\t") == 0) {
+                run_settings = line.substr(2);
+            } else if (line.compare(0, 2, "D\t") == 0) {
+                done.insert(line.substr(2));
+            }
+        }
+        return !first || text.empty();
+    }
+
+    // Settings of the run that wrote the loaded journal, empty if none
+    const std::string& settings() const {
+        return run_settings;
+    }
+
+    // Starts recording to `path`. A fresh run truncates it and writes the
+    // header; a resumed one appends to the loaded entries, after dropping a
+    // cut-off last line.
+    bool start(const std::string& path, const std::string& settings, bool resume, int flush_ms) {
+        if (resume && !run_settings.empty() && truncate(path.c_str(), complete_bytes) != 0) {
+            return false;
+        }
+        if (!resume || run_settings.empty()) {
+            std::ofstream out(path, std::ios::trunc);
+            out << HEADER << "\nS\t" << settings << "\n";
+            out.flush();
+            if (!out) {
+                return false;
+            }
+            run_settings = settings;
+        }
+        return writer.open(path, flush_ms);
+    }
+
+    // True if a resumed run already finished `name`; read-only once started
+    bool isDone(const std::string& name) const {
+        return done.count(name) != 0;
+    }
+
+    size_t doneCount() const {
+        return done.size();
+    }
+
+    // Queues `name` as finished; names that would break the line format are
+    // left out and redone by a resumed run
+    void record(const std::string& name) {
+        if (name.find('\n') == std::string::npos) {
+            writer.log("D\t" + name);
+        }
+    }
+
+    // Writes out the queued entries and closes the file
+    void close() {
+        writer.close();
+    }
+};
+
+#endif // RUN_JOURNAL_H
@@ -0,0 +1,94 @@
+#ifndef SAMPLE_BUFFER_H
+#define SAMPLE_BUFFER_H
+
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Growable float buffer for decoded audio, meant to be kept and reused across
+// files. Storage comes straight from anonymous mmap, so resize() never zeroes
+// or copies samples it does not have to, and shrinking keeps the pages. Large
+// buffers are 2 MB aligned and advised for transparent huge pages, which cuts
+// the page faults and TLB misses of touching a multi-megabyte file.
+class SampleBuffer {
+private:
+    static const size_t HUGE_PAGE = 2u << 20;
+
+    float* samples = nullptr;
+    size_t count = 0;
+    size_t capacity_bytes = 0;
+
+    static size_t roundUp(size_t bytes, size_t unit) {
+        return (bytes + unit - 1) / unit * unit;
+    }
+
+public:
+    SampleBuffer() = default;
+    SampleBuffer(const SampleBuffer&) = delete;
+    SampleBuffer& operator=(const SampleBuffer&) = delete;
+
+    ~SampleBuffer() {
+        release();
+    }
+
+    float* data() { return samples; }
+    const float* data() const { return samples; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacityBytes() const { return capacity_bytes; }
+
+    // Sets the size to `n` samples. Existing samples up to min(size, n) are
+    // kept; new ones are left uninitialized. Returns false if the memory
+    // could not be mapped, leaving the buffer unchanged.
+    bool resize(size_t n) {
+        size_t bytes = n * sizeof(float);
+        if (bytes > capacity_bytes) {
+            size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            bool huge = bytes >= HUGE_PAGE;
+            size_t wanted = roundUp(bytes, huge ? HUGE_PAGE : page);
+            // Over-map by one huge page so the start can be aligned to it
+            size_t mapped = huge ? wanted + HUGE_PAGE : wanted;
+            void* region = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED) {
+                return false;
+            }
+            char* base = static_cast<char*>(region);
+            if (huge) {
+                char* aligned = reinterpret_cast<char*>(roundUp(reinterpret_cast<size_t>(base), HUGE_PAGE));
+                if (aligned > base) {
+                    munmap(base, aligned - base);
+                }
+                munmap(aligned + wanted, base + mapped - (aligned + wanted));
+                base = aligned;
+#ifdef MADV_HUGEPAGE
+                madvise(base, wanted, MADV_HUGEPAGE);
+#endif
+            }
+            if (count > 0) {
+                memcpy(base, samples, count * sizeof(float));
+            }
+            release();
+            samples = reinterpret_cast<float*>(base);
+            capacity_bytes = wanted;
+        }
+        count = n;
+        return true;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    // Returns the memory to the kernel
+    void release() {
+        if (samples != nullptr) {
+            munmap(samples, capacity_bytes);
+        }
+        samples = nullptr;
+        count = 0;
+        capacity_bytes = 0;
+    }
+};
+
+#endif // SAMPLE_BUFFER_H
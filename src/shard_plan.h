@@ -0,0 +1,229 @@
+#ifndef SHARD_PLAN_H
+#define SHARD_PLAN_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "async_logger.h"
+#include "manifest.h"
+
+// Consistent hashing of input paths onto cluster nodes. Every node owns
+// VNODES points on a 64-bit ring and a path belongs to the first point at or
+// after its hash, so adding or removing one of N nodes moves only about 1/N
+// of the files. Each node therefore keeps seeing mostly the same files from
+// run to run, and its --incremental manifest and stats cache stay useful.
+class ShardRing {
+private:
+    static const int VNODES = 128;
+
+    std::vector<std::string> names;
+    std::vector<std::pair<uint64_t, size_t>> points; // Sorted by hash
+
+    static uint64_t hashOf(const std::string& s) {
+        return hashBytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+    }
+
+public:
+    explicit ShardRing(const std::vector<std::string>& nodes) : names(nodes) {
+        for (size_t n = 0; n < names.size(); ++n) {
+            for (int v = 0; v < VNODES; ++v) {
+                points.push_back({hashOf(names[n] + "#" + std::to_string(v)), n});
+            }
+        }
+        std::sort(points.begin(), points.end());
+    }
+
+    // Index into the node list of the node that owns `key`
+    size_t owner(const std::string& key) const {
+        auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(hashOf(key), size_t(0)));
+        return it == points.end() ? points.front().second : it->second;
+    }
+
+    const std::string& node(size_t index) const {
+        return names[index];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+};
+
+struct PlanEntry {
+    std::string name; // Input path relative to input_dir
+    uint64_t bytes;
+};
+
+// The work manifest of one node, written by the coordinator (--plan) and
+// read by the node (--node). Format: a header line, "S\t<settings>" of the
+// coordinator's run, "N\t<node>\t<all nodes, comma-separated>", then one
+// "F\t<bytes>\t<name>" per file, largest first.
+class ShardPlan {
+private:
+    static constexpr const char* HEADER = "# audio_norm plan v1";
+
+public:
+    std::string settings;
+    std::string node;
+    std::string nodes;
+    std::vector<PlanEntry> entries;
+
+    // Atomically, through a temporary file
+    bool save(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        bool ok;
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << HEADER << "\nS\t" << settings << "\nN\t" << node << '\t' << nodes << "\n";
+            for (const PlanEntry& e : entries) {
+                out << "F\t" << e.bytes << '\t' << e.name << "\n";
+            }
+            out.flush();
+            ok = static_cast<bool>(out);
+        }
+        return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != HEADER) {
+            return false;
+        }
+        entries.clear();
+        while (std::getline(in, line)) {
+            if (line.compare(0, 2, "S\t") == 0) {
+                settings = line.substr(2);
+            } else if (line.compare(0, 2, "N\t") == 0) {
+                size_t tab = line.find('\t', 2);
+                node = line.substr(2, tab == std::string::npos ? std::string::npos : tab - 2);
+                nodes = tab == std::string::npos ? "" : line.substr(tab + 1);
+            } else if (line.compare(0, 2, "F\t") == 0) {
+                size_t tab = line.find('\t', 2);
+                if (tab == std::string::npos || !isdigit(static_cast<unsigned char>(line[2]))) {
+                    return false;
+                }
+                char* end = nullptr;
+                uint64_t bytes = strtoull(line.c_str() + 2, &end, 10);
+                if (end != line.c_str() + tab) {
+                    return false;
+                }
+                entries.push_back({line.substr(tab + 1), bytes});
+            }
+        }
+        return true;
+    }
+};
+
+// One file as a node's report gives it
+struct ReportEntry {
+    std::string peak, rms, gain; // As written, so the merged report keeps every digit
+    std::string samples;
+};
+
+// What a node did with its plan, appended as files finish so a crashed
+// node leaves a usable partial report. Format: a header line,
+// "S\t<settings>", then per file either
+// "R\t<name>\t<peak>\t<rms>\t<gain>\t<samples>" (normalized by this run,
+// original peak and RMS, gain applied) or "K\t<name>" (kept: up to date or
+// finished by an earlier run), and "T\t<seconds>" at the end of each run.
+// A report covers every run of a node on one plan: later runs append, and
+// a name normalized again replaces its entry. A new plan starts afresh.
+class NodeReport {
+private:
+    static constexpr const char* HEADER = "# audio_norm report v1";
+
+    AsyncLogger writer;
+
+public:
+    std::string settings;
+    std::map<std::string, ReportEntry> normalized;
+    std::set<std::string> kept;
+    double seconds = 0.0;
+
+    NodeReport() = default;
+    NodeReport(const NodeReport&) = delete;
+    NodeReport& operator=(const NodeReport&) = delete;
+
+    // Starts writing `path`, after what earlier runs wrote minus a line one
+    // was killed writing, or with a fresh header
+    bool start(const std::string& path, const std::string& run_settings, int flush_ms) {
+        std::ifstream in(path, std::ios::binary);
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t end = text.rfind('\n');
+        if (end != std::string::npos && text.compare(0, strlen(HEADER), HEADER) == 0) {
+            if (truncate(path.c_str(), end + 1) != 0) {
+                return false;
+            }
+        } else {
+            std::ofstream out(path, std::ios::trunc);
+            out << HEADER << "\nS\t" << run_settings << "\n";
+            out.flush();
+            if (!out) {
+                return false;
+            }
+        }
+        return writer.open(path, flush_ms);
+    }
+
+    void record(const std::string& name, const std::string& fields) {
+        if (name.find('\n') == std::string::npos) {
+            writer.log("R\t" + name + "\t" + fields);
+        }
+    }
+
+    void keep(const std::string& name) {
+        if (name.find('\n') == std::string::npos) {
+            writer.log("K\t" + name);
+        }
+    }
+
+    void finish(double run_seconds) {
+        writer.log("T\t" + std::to_string(run_seconds));
+        writer.close();
+    }
+
+    // Reads a report for --collect; false if it is not one
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != HEADER) {
+            return false;
+        }
+        while (std::getline(in, line)) {
+            if (in.eof()) {
+                break; // No newline: cut off by a node that is still running or was killed
+            }
+            std::vector<std::string> f;
+            size_t start = 0, tab;
+            while ((tab = line.find('\t', start)) != std::string::npos) {
+                f.push_back(line.substr(start, tab - start));
+                start = tab + 1;
+            }
+            f.push_back(line.substr(start));
+            if (f[0] == "S" && f.size() >= 2) {
+                settings = line.substr(2);
+            } else if (f[0] == "R" && f.size() == 6) {
+                normalized[f[1]] = ReportEntry{f[2], f[3], f[4], f[5]};
+                kept.erase(f[1]);
+            } else if (f[0] == "K" && f.size() == 2 && normalized.count(f[1]) == 0) {
+                kept.insert(f[1]); // A resumed run keeps what its earlier part normalized
+            } else if (f[0] == "T" && f.size() == 2) {
+                seconds += atof(f[1].c_str());
+            }
+        }
+        return true;
+    }
+};
+
+#endif // SHARD_PLAN_H
@@ -0,0 +1,176 @@
+#ifndef STATS_CACHE_H
+#define STATS_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <pthread.h>
+#include "manifest.h"
+
+// Analysis results of one input, independent of the target peak
+struct CachedStats {
+    float min_val = 0.0f;
+    float max_val = 0.0f;
+    float peak = 0.0f;
+    float rms = 0.0f;
+    uint64_t sample_count = 0;
+};
+
+// Persistent per-file stats keyed by content hash, so renormalizing the same
+// audio to another target skips the analysis pass. A second index maps each
+// input path to the stamp (size, mtime) it had when it was last hashed, so
+// unchanged files are not re-read just to find their hash. Thread-safe.
+class StatsCache {
+private:
+    static constexpr const char* HEADER = "# audio_norm stats cache v1";
+
+    struct PathEntry {
+        FileStamp stamp;
+        uint64_t hash;
+    };
+
+    std::unordered_map<uint64_t, CachedStats> stats;
+    std::unordered_map<std::string, PathEntry> paths;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    bool dirty = false;
+
+public:
+    StatsCache() = default;
+    StatsCache(const StatsCache&) = delete;
+    StatsCache& operator=(const StatsCache&) = delete;
+
+    ~StatsCache() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Reads `path` if it exists; a missing file is an empty cache. Returns
+    // false only for a file in an unknown format.
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            return true;
+        }
+        std::string line;
+        if (!std::getline(in, line) || line != HEADER) {
+            return false;
+        }
+        // "S <hash> <min> <max> <peak> <rms> <count>" or "P <hash> <size> <mtime>\t<path>"
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string kind, hash;
+            char* end = nullptr;
+            if (!(fields >> kind >> hash)) {
+                continue;
+            }
+            uint64_t h = strtoull(hash.c_str(), &end, 16);
+            if (*end != '\0') {
+                continue; // Damaged: that file is just analyzed again
+            }
+            if (kind == "S") {
+                CachedStats s;
+                if (fields >> s.min_val >> s.max_val >> s.peak >> s.rms >> s.sample_count) {
+                    stats[h] = s;
+                }
+            } else if (kind == "P") {
+                PathEntry p;
+                std::string file;
+                p.hash = h;
+                if (fields >> p.stamp.size >> p.stamp.mtime_ns && fields.ignore(1) && std::getline(fields, file)) {
+                    paths[file] = p;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Writes to a temporary file renamed over `path`
+    bool save(const std::string& path) {
+        pthread_mutex_lock(&mutex);
+        std::string tmp = path + ".tmp";
+        bool ok;
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out.precision(9);
+            out << HEADER << "\n";
+            char hash[17];
+            for (const auto& kv : stats) {
+                const CachedStats& s = kv.second;
+                snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(kv.first));
+                out << "S " << hash << ' ' << s.min_val << ' ' << s.max_val << ' ' << s.peak << ' ' << s.rms << ' '
+                    << s.sample_count << "\n";
+            }
+            for (const auto& kv : paths) {
+                snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(kv.second.hash));
+                out << "P " << hash << ' ' << kv.second.stamp.size << ' ' << kv.second.stamp.mtime_ns << '\t'
+                    << kv.first << "\n";
+            }
+            out.flush();
+            ok = static_cast<bool>(out);
+        }
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        if (ok) {
+            dirty = false;
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    bool isDirty() {
+        pthread_mutex_lock(&mutex);
+        bool d = dirty;
+        pthread_mutex_unlock(&mutex);
+        return d;
+    }
+
+    // Content hash and current stamp of `path`; the file is only read when
+    // its stamp differs from the one recorded with the last known hash
+    bool hashOf(const std::string& path, FileStamp& stamp, uint64_t& hash) {
+        if (!statFile(path, stamp)) {
+            return false;
+        }
+        pthread_mutex_lock(&mutex);
+        auto it = paths.find(path);
+        bool known = it != paths.end() && it->second.stamp == stamp;
+        if (known) {
+            hash = it->second.hash;
+        }
+        pthread_mutex_unlock(&mutex);
+        if (known) {
+            return true;
+        }
+        if (!hashFile(path, hash)) {
+            return false;
+        }
+        if (path.find_first_of("\t\n") == std::string::npos) {
+            pthread_mutex_lock(&mutex);
+            paths[path] = PathEntry{stamp, hash};
+            dirty = true;
+            pthread_mutex_unlock(&mutex);
+        }
+        return true;
+    }
+
+    bool find(uint64_t hash, CachedStats& out) {
+        pthread_mutex_lock(&mutex);
+        auto it = stats.find(hash);
+        bool hit = it != stats.end();
+        if (hit) {
+            out = it->second;
+        }
+        pthread_mutex_unlock(&mutex);
+        return hit;
+    }
+
+    void store(uint64_t hash, const CachedStats& s) {
+        pthread_mutex_lock(&mutex);
+        stats[hash] = s;
+        dirty = true;
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+#endif // STATS_CACHE_H
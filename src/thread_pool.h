@@ -0,0 +1,517 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+// Counts outstanding work and lets one or more threads block until it reaches
+// zero. Unlike std::latch the count may grow while waiting, which the
+// directory scan needs since it keeps submitting after workers have started.
+class CompletionLatch {
+private:
+    std::atomic<int64_t> count{0};
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t zero = PTHREAD_COND_INITIALIZER;
+
+public:
+    CompletionLatch() = default;
+    CompletionLatch(const CompletionLatch&) = delete;
+    CompletionLatch& operator=(const CompletionLatch&) = delete;
+
+    ~CompletionLatch() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&zero);
+    }
+
+    void add(int64_t n = 1) {
+        count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void countDown() {
+        int64_t current = count.load(std::memory_order_relaxed);
+        while (current > 1) {
+            if (count.compare_exchange_weak(current, current - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // The final decrement happens under the mutex: a waiter cannot see
+        // zero (and destroy the latch) until we are done touching it.
+        pthread_mutex_lock(&mutex);
+        if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pthread_cond_broadcast(&zero);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void wait() {
+        pthread_mutex_lock(&mutex);
+        while (count.load(std::memory_order_acquire) > 0) {
+            pthread_cond_wait(&zero, &mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    int64_t pending() const {
+        return count.load(std::memory_order_acquire);
+    }
+};
+
+struct PoolJob {
+    std::function<void()> fn;
+    PoolJob* next = nullptr; // Link used while the job sits in an inbox
+};
+
+// Chase-Lev work-stealing deque. The owning worker pushes and pops at the
+// bottom without contention; other workers steal from the top. The
+// bottom/top handshake uses seq_cst operations rather than standalone fences
+// (same cost on x86, and visible to ThreadSanitizer).
+class WorkStealingDeque {
+private:
+    struct Ring {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<PoolJob*>[]> slots;
+
+        explicit Ring(int64_t cap) : capacity(cap), mask(cap - 1), slots(new std::atomic<PoolJob*>[cap]) {}
+
+        PoolJob* get(int64_t i) const { return slots[i & mask].load(std::memory_order_acquire); }
+        void put(int64_t i, PoolJob* job) { slots[i & mask].store(job, std::memory_order_release); }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Ring*> ring;
+    // Rings replaced by a resize stay alive until the deque dies, since a thief
+    // may still be reading from one. Only the owner touches this list.
+    std::vector<std::unique_ptr<Ring>> rings;
+
+public:
+    explicit WorkStealingDeque(int64_t initial_capacity = 256) {
+        rings.emplace_back(new Ring(initial_capacity));
+        ring.store(rings.back().get(), std::memory_order_relaxed);
+    }
+
+    // Owner only
+    void push(PoolJob* job) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Ring* r = ring.load(std::memory_order_relaxed);
+        if (b - t > r->capacity - 1) {
+            Ring* bigger = new Ring(r->capacity * 2);
+            for (int64_t i = t; i < b; ++i) {
+                bigger->put(i, r->get(i));
+            }
+            rings.emplace_back(bigger);
+            ring.store(bigger, std::memory_order_release);
+            r = bigger;
+        }
+        r->put(b, job);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only; returns nullptr when empty
+    PoolJob* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring* r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_seq_cst);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        PoolJob* job = r->get(b);
+        if (t == b) {
+            // Last element: race any thief for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                job = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread; returns nullptr when empty or when it lost a race
+    PoolJob* steal() {
+        int64_t t = top.load(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b) {
+            return nullptr;
+        }
+        Ring* r = ring.load(std::memory_order_acquire);
+        PoolJob* job = r->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return job;
+    }
+
+    bool empty() const {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+};
+
+// Fixed-size pool of pthreads with one work-stealing deque per worker.
+// Jobs submitted from outside the pool land in a worker's lock-free inbox
+// (round robin); jobs submitted from inside a worker go straight onto its
+// own deque. Idle workers steal before parking on a condition variable, so
+// the mutex is only touched when a worker actually goes to sleep.
+// submitPriority() jobs wait in one shared FIFO that every worker checks
+// first, taking one job at a time, and parallelFor() splits one job over
+// the pool with the caller helping.
+class ThreadPool {
+private:
+    struct alignas(64) Worker {
+        pthread_t thread;
+        WorkStealingDeque deque;
+        std::atomic<PoolJob*> inbox{nullptr};
+        ThreadPool* pool = nullptr;
+        int index = 0;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<uint64_t> next_inbox{0};
+    // Priority jobs, oldest first. Each worker takes one per findJob, so
+    // several large jobs start on several workers at once instead of
+    // queueing behind each other on whichever worker looked first.
+    pthread_mutex_t priority_mutex = PTHREAD_MUTEX_INITIALIZER;
+    PoolJob* priority_head = nullptr;
+    PoolJob* priority_tail = nullptr;
+    std::atomic<size_t> priority_pending{0}; // Lets findJob skip the mutex
+    std::atomic<bool> stopping{false};
+
+    // Parking: a worker sleeps only while wake_epoch is unchanged
+    std::atomic<uint64_t> wake_epoch{0};
+    std::atomic<int> sleepers{0};
+    pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+
+    // Statistics, only touched off the fast path
+    std::atomic<uint64_t> steal_count{0};
+    std::atomic<uint64_t> park_count{0};
+    std::atomic<uint64_t> parked_ns{0};
+
+    static inline thread_local Worker* current = nullptr;
+
+    static void* workerMain(void* arg) {
+        Worker* self = static_cast<Worker*>(arg);
+        current = self;
+        self->pool->runWorker(self);
+        current = nullptr;
+        return nullptr;
+    }
+
+    // Moves everything from `from`'s inbox onto self's deque. Taking the whole
+    // list with one exchange is safe for any number of consumers, so an idle
+    // worker may also empty a busy worker's inbox. The inbox is a LIFO stack;
+    // pushing it as-is leaves the oldest job at the bottom, where pop() looks.
+    bool drainInbox(Worker* self, std::atomic<PoolJob*>& inbox) {
+        if (inbox.load(std::memory_order_relaxed) == nullptr) {
+            return false;
+        }
+        PoolJob* list = inbox.exchange(nullptr, std::memory_order_acquire);
+        if (list == nullptr) {
+            return false;
+        }
+        while (list != nullptr) {
+            PoolJob* next = list->next;
+            self->deque.push(list);
+            list = next;
+        }
+        return true;
+    }
+
+    PoolJob* popPriority() {
+        if (priority_pending.load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        pthread_mutex_lock(&priority_mutex);
+        PoolJob* job = priority_head;
+        if (job != nullptr) {
+            priority_head = job->next;
+            if (priority_head == nullptr) {
+                priority_tail = nullptr;
+            }
+            priority_pending.fetch_sub(1, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&priority_mutex);
+        return job;
+    }
+
+    PoolJob* findJob(Worker* self, uint64_t& rng) {
+        if (PoolJob* job = popPriority()) {
+            return job;
+        }
+        if (PoolJob* job = self->deque.pop()) {
+            return job;
+        }
+        if (drainInbox(self, self->inbox)) {
+            if (PoolJob* job = self->deque.pop()) {
+                return job;
+            }
+        }
+        // Steal from a random victim first so thieves spread out
+        size_t n = workers.size();
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t start = rng % n;
+        for (size_t k = 0; k < n; ++k) {
+            Worker* victim = workers[(start + k) % n].get();
+            if (victim == self) {
+                continue;
+            }
+            if (PoolJob* job = victim->deque.steal()) {
+                steal_count.fetch_add(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        // Nothing to steal: adopt jobs parked in a busy worker's inbox
+        for (size_t k = 0; k < n; ++k) {
+            Worker* victim = workers[(start + k) % n].get();
+            if (victim != self && drainInbox(self, victim->inbox)) {
+                if (PoolJob* job = self->deque.pop()) {
+                    return job;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool hasVisibleWork() const {
+        if (priority_pending.load(std::memory_order_acquire) != 0) {
+            return true;
+        }
+        for (const auto& w : workers) {
+            if (!w->deque.empty() || w->inbox.load(std::memory_order_acquire) != nullptr) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runWorker(Worker* self) {
+        uint64_t rng = 0x9E3779B97F4A7C15ull * (self->index + 1);
+        int idle_rounds = 0;
+        while (true) {
+            PoolJob* job = findJob(self, rng);
+            if (job != nullptr) {
+                idle_rounds = 0;
+                job->fn();
+                delete job;
+                continue;
+            }
+            if (stopping.load(std::memory_order_acquire) && !hasVisibleWork()) {
+                break;
+            }
+            if (++idle_rounds < 64) {
+                sched_yield();
+                continue;
+            }
+            idle_rounds = 0;
+            park();
+        }
+    }
+
+    void park() {
+        uint64_t epoch = wake_epoch.load(std::memory_order_seq_cst);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        // Re-check after announcing ourselves: a submitter either sees
+        // sleepers > 0 or we see its job here.
+        if (hasVisibleWork() || stopping.load(std::memory_order_seq_cst)) {
+            sleepers.fetch_sub(1, std::memory_order_seq_cst);
+            return;
+        }
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&park_mutex);
+        while (wake_epoch.load(std::memory_order_seq_cst) == epoch && !stopping.load(std::memory_order_seq_cst)) {
+            pthread_cond_wait(&park_cond, &park_mutex);
+        }
+        pthread_mutex_unlock(&park_mutex);
+        sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        park_count.fetch_add(1, std::memory_order_relaxed);
+        parked_ns.fetch_add((end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec, std::memory_order_relaxed);
+    }
+
+    void wake(bool all) {
+        wake_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_seq_cst) > 0) {
+            pthread_mutex_lock(&park_mutex);
+            if (all) {
+                pthread_cond_broadcast(&park_cond);
+            } else {
+                pthread_cond_signal(&park_cond);
+            }
+            pthread_mutex_unlock(&park_mutex);
+        }
+    }
+
+    static void pushInbox(std::atomic<PoolJob*>& inbox, PoolJob* job) {
+        PoolJob* head = inbox.load(std::memory_order_relaxed);
+        do {
+            job->next = head;
+        } while (!inbox.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Shared by a parallelFor call and its helper jobs; helper jobs that only
+    // start after the call returned find nothing left and drop their reference
+    struct ParallelForState {
+        std::function<void(size_t)> fn;
+        size_t count;
+        std::atomic<size_t> next{0};
+        CompletionLatch done;
+
+        void runAvailable() {
+            size_t i;
+            while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+                fn(i);
+                done.countDown();
+            }
+        }
+    };
+
+public:
+    explicit ThreadPool(int num_threads) {
+        if (num_threads < 1) {
+            num_threads = 1;
+        }
+        for (int i = 0; i < num_threads; ++i) {
+            workers.emplace_back(new Worker());
+            workers.back()->pool = this;
+            workers.back()->index = i;
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs whatever is still queued, then joins the workers
+    ~ThreadPool() {
+        shutdown();
+        pthread_mutex_destroy(&park_mutex);
+        pthread_mutex_destroy(&priority_mutex);
+        pthread_cond_destroy(&park_cond);
+    }
+
+    // Starts the worker threads. If `affinity` is non-empty, worker i is
+    // restricted to the CPUs in affinity[i]. Returns false (after stopping any
+    // workers already started) when a thread cannot be created.
+    bool start(const std::vector<std::vector<int>>& affinity = {}) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+#ifdef __linux__
+            if (i < affinity.size() && !affinity[i].empty()) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                for (int cpu : affinity[i]) {
+                    CPU_SET(cpu, &cpus);
+                }
+                pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            }
+#else
+            (void)affinity;
+#endif
+            int rc = pthread_create(&workers[i]->thread, &attr, workerMain, workers[i].get());
+            pthread_attr_destroy(&attr);
+            if (rc != 0) {
+                workers.resize(i);
+                shutdown();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void shutdown() {
+        if (stopping.exchange(true)) {
+            return;
+        }
+        wake(true);
+        for (auto& w : workers) {
+            pthread_join(w->thread, NULL);
+        }
+    }
+
+    void submit(std::function<void()> fn) {
+        PoolJob* job = new PoolJob{std::move(fn)};
+        if (current != nullptr && current->pool == this) {
+            current->deque.push(job);
+        } else {
+            Worker* target = workers[next_inbox.fetch_add(1, std::memory_order_relaxed) % workers.size()].get();
+            pushInbox(target->inbox, job);
+        }
+        wake(false);
+    }
+
+    // Like submit(), but the job runs before anything already queued on the
+    // worker that picks it up. Used to start the largest files first.
+    void submitPriority(std::function<void()> fn) {
+        PoolJob* job = new PoolJob{std::move(fn)};
+        pthread_mutex_lock(&priority_mutex);
+        if (priority_tail != nullptr) {
+            priority_tail->next = job;
+        } else {
+            priority_head = job;
+        }
+        priority_tail = job;
+        priority_pending.fetch_add(1, std::memory_order_release);
+        pthread_mutex_unlock(&priority_mutex);
+        wake(false);
+    }
+
+    // Calls fn(i) for every i in [0, count) on up to `max_threads` threads
+    // of the pool (0 = all) and returns when all calls have finished. The
+    // calling thread takes indices too, so it may be a worker of this pool.
+    void parallelFor(size_t count, std::function<void(size_t)> fn, int max_threads = 0) {
+        if (count == 0) {
+            return;
+        }
+        auto state = std::make_shared<ParallelForState>();
+        state->fn = std::move(fn);
+        state->count = count;
+        state->done.add(count);
+        size_t threads = max_threads > 0 ? std::min<size_t>(max_threads, workers.size()) : workers.size();
+        // The caller is one of the threads when it is a worker
+        size_t helpers = std::min(count, threads) - ((current != nullptr && current->pool == this) ? 1 : 0);
+        for (size_t h = 0; h < helpers; ++h) {
+            submitPriority([state]() { state->runAvailable(); });
+        }
+        state->runAvailable();
+        state->done.wait();
+    }
+
+    int size() const {
+        return static_cast<int>(workers.size());
+    }
+
+    // Jobs taken from another worker's deque
+    uint64_t steals() const {
+        return steal_count.load(std::memory_order_relaxed);
+    }
+
+    // Times a worker went to sleep for lack of work, and the total time slept
+    uint64_t parks() const {
+        return park_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t parkedNs() const {
+        return parked_ns.load(std::memory_order_relaxed);
+    }
+
+    // Index of the calling worker, or -1 when called from outside the pool
+    static int currentWorker() {
+        return current ? current->index : -1;
+    }
+};
+
+#endif // THREAD_POOL_H
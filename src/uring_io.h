@@ -0,0 +1,534 @@
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// io_uring through the raw system calls, so no liburing is needed. When the
+// kernel headers lack io_uring, IoUring::init() always fails and callers use
+// their blocking path.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define AUDIO_NORM_HAVE_URING 1
+#endif
+#endif
+#endif
+
+// Page-aligned byte buffer from anonymous mmap, suitable for O_DIRECT.
+// Like SampleBuffer it keeps its capacity and never zeroes.
+class IoBuffer {
+private:
+    uint8_t* bytes = nullptr;
+    size_t capacity = 0;
+
+public:
+    IoBuffer() = default;
+    IoBuffer(const IoBuffer&) = delete;
+    IoBuffer& operator=(const IoBuffer&) = delete;
+
+    ~IoBuffer() {
+        release();
+    }
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t capacityBytes() const { return capacity; }
+
+    // Makes room for `n` bytes; the contents are not kept
+    bool reserve(size_t n) {
+        if (n <= capacity) {
+            return true;
+        }
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t wanted = (n + page - 1) / page * page;
+        void* region = mmap(nullptr, wanted, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            return false;
+        }
+        release();
+        bytes = static_cast<uint8_t*>(region);
+        capacity = wanted;
+        return true;
+    }
+
+    void release() {
+        if (bytes != nullptr) {
+            munmap(bytes, capacity);
+        }
+        bytes = nullptr;
+        capacity = 0;
+    }
+};
+
+// One submission/completion ring. Not thread-safe: each thread owns its own.
+// Requests carry a caller-chosen tag that comes back with the completion.
+class IoUring {
+private:
+#ifdef AUDIO_NORM_HAVE_URING
+    int ring_fd = -1;
+    unsigned entries = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+#endif
+    unsigned queued = 0;    // Prepared, not yet handed to the kernel
+    unsigned submitted = 0; // Handed to the kernel, not yet completed
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        close();
+    }
+
+    bool isOpen() const {
+#ifdef AUDIO_NORM_HAVE_URING
+        return ring_fd >= 0;
+#else
+        return false;
+#endif
+    }
+
+    // Requests prepared or submitted whose completion was not taken yet
+    unsigned pending() const {
+        return queued + submitted;
+    }
+
+    // False when io_uring is unavailable (old kernel, seccomp, no headers)
+    bool init(unsigned depth) {
+#ifdef AUDIO_NORM_HAVE_URING
+        close();
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0) {
+            return false;
+        }
+        ring_fd = fd;
+        entries = params.sq_entries;
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = single ? sq_ring
+                         : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqe_mem = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_mem == MAP_FAILED) {
+            if (sqe_mem != MAP_FAILED) {
+                munmap(sqe_mem, sqes_size);
+            }
+            close();
+            return false;
+        }
+        char* sq = static_cast<char*>(sq_ring);
+        char* cq = static_cast<char*>(cq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(sqe_mem);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+#else
+        (void)depth;
+        return false;
+#endif
+    }
+
+    void close() {
+#ifdef AUDIO_NORM_HAVE_URING
+        if (sqes != nullptr) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED) {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if (ring_fd >= 0) {
+            ::close(ring_fd);
+        }
+        ring_fd = -1;
+        sqes = nullptr;
+        sq_ring = cq_ring = MAP_FAILED;
+#endif
+        queued = submitted = 0;
+    }
+
+    // Queues a read or write of `len` bytes at `offset`; false when the
+    // submission ring is full (take a completion first)
+    bool prepareRead(int fd, void* buf, unsigned len, uint64_t offset, uint64_t tag) {
+#ifdef AUDIO_NORM_HAVE_URING
+        return prepare(IORING_OP_READ, fd, buf, len, offset, tag);
+#else
+        (void)fd, (void)buf, (void)len, (void)offset, (void)tag;
+        return false;
+#endif
+    }
+
+    bool prepareWrite(int fd, const void* buf, unsigned len, uint64_t offset, uint64_t tag) {
+#ifdef AUDIO_NORM_HAVE_URING
+        return prepare(IORING_OP_WRITE, fd, const_cast<void*>(buf), len, offset, tag);
+#else
+        (void)fd, (void)buf, (void)len, (void)offset, (void)tag;
+        return false;
+#endif
+    }
+
+    // Submits everything queued and waits for one completion; false when
+    // nothing is pending or the ring failed. `result` is the byte count or
+    // a negative errno, as returned by read(2)/write(2).
+    bool complete(uint64_t& tag, int& result) {
+#ifdef AUDIO_NORM_HAVE_URING
+        while (true) {
+            unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes[head & *cq_mask];
+                tag = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                submitted--;
+                return true;
+            }
+            if (pending() == 0) {
+                return false;
+            }
+            // One system call both submits the batch and waits
+            int done = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, queued, 1, IORING_ENTER_GETEVENTS,
+                                                nullptr, 0));
+            if (done < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            queued -= done;
+            submitted += done;
+        }
+#else
+        (void)tag, (void)result;
+        return false;
+#endif
+    }
+
+    // Waits for every pending request; false if any of them failed
+    bool drain() {
+        bool ok = true;
+        uint64_t tag;
+        int result;
+        while (pending() > 0) {
+            if (!complete(tag, result)) {
+                return false;
+            }
+            ok = ok && result >= 0;
+        }
+        return ok;
+    }
+
+private:
+#ifdef AUDIO_NORM_HAVE_URING
+    bool prepare(uint8_t opcode, int fd, void* buf, unsigned len, uint64_t offset, uint64_t tag) {
+        // Bounding what is in flight also keeps the completion ring from overflowing
+        unsigned tail = *sq_tail;
+        if (pending() >= entries || tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries) {
+            return false;
+        }
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buf);
+        sqe.len = len;
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+        return true;
+    }
+#endif
+};
+
+// Reads whole files with many chunk reads in flight, so one thread keeps a
+// fast device busy. Files are opened with O_DIRECT where the filesystem
+// allows it, which skips the page cache copy; reads then go straight into
+// the aligned buffer.
+class UringReader {
+private:
+    static const size_t CHUNK = 1u << 20;
+    static const size_t ALIGN = 4096; // Covers the logical block size of common devices
+
+    IoUring& ring;
+
+    bool readAll(int fd, uint8_t* dst, size_t size, bool direct) {
+        size_t next = 0;
+        bool ok = true;
+        while (ok && (next < size || ring.pending() > 0)) {
+            while (ok && next < size) {
+                size_t len = std::min(CHUNK, size - next);
+                if (direct) {
+                    len = (len + ALIGN - 1) / ALIGN * ALIGN;
+                }
+                if (!ring.prepareRead(fd, dst + next, static_cast<unsigned>(len), next, next)) {
+                    break;
+                }
+                next += std::min(len, size - next);
+            }
+            uint64_t offset;
+            int result;
+            if (!ring.complete(offset, result)) {
+                return false;
+            }
+            // Bytes asked for by the request: up to the end of its chunk
+            size_t expected = std::min((offset / CHUNK + 1) * CHUNK, size) - offset;
+            if (result < 0) {
+                ok = false;
+            } else if (static_cast<size_t>(result) < expected) {
+                // Short read before the end: ask again for the rest
+                size_t at = offset + result;
+                size_t rest = expected - result;
+                ok = result > 0 && ring.prepareRead(fd, dst + at, static_cast<unsigned>(rest), at, at);
+            }
+        }
+        return ring.drain() && ok;
+    }
+
+public:
+    explicit UringReader(IoUring& r) : ring(r) {}
+
+    // Reads all of `path` into `buffer`; `size` receives the byte count
+    bool readFile(const std::string& path, IoBuffer& buffer, size_t& size) {
+        bool direct = true;
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd < 0) {
+            direct = false;
+            fd = open(path.c_str(), O_RDONLY);
+        }
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        size = st.st_size;
+        bool ok = buffer.reserve((size + ALIGN - 1) / ALIGN * ALIGN + ALIGN) && readAll(fd, buffer.data(), size, direct);
+        if (!ok && direct) {
+            // Some filesystems accept O_DIRECT at open but reject the reads
+            close(fd);
+            fd = open(path.c_str(), O_RDONLY);
+            ok = fd >= 0 && readAll(fd, buffer.data(), size, false);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ok;
+    }
+};
+
+// Write side for libsndfile's virtual I/O: bytes are gathered into blocks
+// and each full block becomes an asynchronous positional write, with up to
+// `slots` of them in flight. Sequential output never waits on the device
+// until finish(). A seek (libsndfile rewrites the header at the end) first
+// waits for outstanding writes so overlapping ranges land in order.
+class UringSink {
+private:
+    static const size_t BLOCK = 512u << 10;
+
+    struct Slot {
+        uint64_t offset = 0; // File offset of the block
+        size_t used = 0;
+        size_t written = 0; // Bytes the kernel confirmed so far
+    };
+
+    IoUring& ring;
+    IoBuffer& staging;
+    std::vector<Slot> slots;
+    std::vector<int> free_slots;
+    int fd = -1;
+    int current = -1; // Slot being filled, or -1
+    uint64_t pos = 0;
+    uint64_t length = 0;
+    bool failed = false;
+
+    uint8_t* slotData(int s) { return staging.data() + static_cast<size_t>(s) * BLOCK; }
+
+    void submitSlot(int s) {
+        Slot& slot = slots[s];
+        if (!ring.prepareWrite(fd, slotData(s) + slot.written, static_cast<unsigned>(slot.used - slot.written),
+                               slot.offset + slot.written, static_cast<uint64_t>(s))) {
+            failed = true;
+            free_slots.push_back(s);
+        }
+    }
+
+    // Takes one completion, resubmitting the rest of a short write
+    bool reapOne() {
+        uint64_t tag;
+        int result;
+        if (!ring.complete(tag, result)) {
+            failed = true;
+            return false;
+        }
+        int s = static_cast<int>(tag);
+        Slot& slot = slots[s];
+        if (result <= 0) {
+            failed = true;
+            free_slots.push_back(s);
+        } else if (slot.written + result < slot.used) {
+            slot.written += result;
+            submitSlot(s);
+        } else {
+            free_slots.push_back(s);
+        }
+        return true;
+    }
+
+    void flushCurrent() {
+        if (current >= 0) {
+            if (slots[current].used > 0) {
+                submitSlot(current);
+            } else {
+                free_slots.push_back(current);
+            }
+            current = -1;
+        }
+    }
+
+    void drainAll() {
+        while (ring.pending() > 0 && reapOne()) {
+        }
+    }
+
+public:
+    UringSink(IoUring& r, IoBuffer& buffer) : ring(r), staging(buffer) {}
+
+    // Staging open() reserves for `depth` blocks in flight
+    static size_t stagingBytes(unsigned depth) {
+        return std::max(2u, depth) * BLOCK;
+    }
+    UringSink(const UringSink&) = delete;
+    UringSink& operator=(const UringSink&) = delete;
+
+    ~UringSink() {
+        finish();
+    }
+
+    bool open(const std::string& path, unsigned depth) {
+        unsigned count = std::max(2u, depth);
+        if (!staging.reserve(count * BLOCK)) {
+            return false;
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        slots.assign(count, Slot());
+        free_slots.clear();
+        for (int s = static_cast<int>(count) - 1; s >= 0; --s) {
+            free_slots.push_back(s);
+        }
+        current = -1;
+        pos = length = 0;
+        failed = false;
+        return true;
+    }
+
+    int64_t write(const void* data, int64_t count) {
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        int64_t left = count;
+        while (left > 0 && !failed) {
+            if (current < 0) {
+                while (free_slots.empty() && reapOne()) {
+                }
+                if (failed) {
+                    break;
+                }
+                current = free_slots.back();
+                free_slots.pop_back();
+                slots[current] = Slot();
+                slots[current].offset = pos;
+            }
+            Slot& slot = slots[current];
+            size_t n = std::min<size_t>(BLOCK - slot.used, left);
+            memcpy(slotData(current) + slot.used, src, n);
+            slot.used += n;
+            src += n;
+            left -= n;
+            pos += n;
+            length = std::max(length, pos);
+            if (slot.used == BLOCK) {
+                flushCurrent();
+            }
+        }
+        return failed ? -1 : count;
+    }
+
+    int64_t seek(int64_t offset, int whence) {
+        int64_t target = whence == SEEK_SET ? offset : whence == SEEK_CUR ? static_cast<int64_t>(pos) + offset
+                                                                            : static_cast<int64_t>(length) + offset;
+        if (target < 0) {
+            return -1;
+        }
+        if (static_cast<uint64_t>(target) != pos) {
+            flushCurrent();
+            drainAll();
+            pos = target;
+        }
+        return target;
+    }
+
+    int64_t tell() const { return pos; }
+    int64_t size() const { return length; }
+
+    // Writes what is left, waits for every write and closes the file;
+    // false if any write failed
+    bool finish() {
+        if (fd < 0) {
+            return !failed;
+        }
+        flushCurrent();
+        drainAll();
+        if (::close(fd) != 0) {
+            failed = true;
+        }
+        fd = -1;
+        return !failed;
+    }
+};
+
+#endif // URING_IO_H
@@ -0,0 +1,213 @@
+#ifndef WAV_MMAP_H
+#define WAV_MMAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Sample encodings the mapped reader understands
+enum class WavSampleFormat {
+    Pcm16,
+    Pcm24,
+    Float32
+};
+
+inline size_t wavBytesPerSample(WavSampleFormat format) {
+    switch (format) {
+        case WavSampleFormat::Pcm16: return 2;
+        case WavSampleFormat::Pcm24: return 3;
+        case WavSampleFormat::Float32: return 4;
+    }
+    return 0;
+}
+
+// Read-only mapping of an uncompressed little-endian WAV file. open()
+// accepts plain or WAVE_FORMAT_EXTENSIBLE PCM16, PCM24 and float32; for
+// anything else it returns false and the caller falls back to libsndfile.
+// Samples are read straight from the mapped pages, without copying.
+// openBuffer() parses a file the caller already read into memory instead.
+class MappedWav {
+private:
+    void* mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+
+    static uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    static uint32_t le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+    // Finds the fmt and data chunks of the `size` file bytes at `base`, of
+    // which only the first `readable` need to be in memory: the chunk
+    // headers and fmt must lie within them, sizes are checked against `size`
+    bool parse(const uint8_t* base, size_t size, size_t readable) {
+        const uint8_t* end = base + size;
+        const uint8_t* read_end = base + readable;
+        if (readable < 44 || memcmp(base, "RIFF", 4) != 0 || memcmp(base + 8, "WAVE", 4) != 0) {
+            return false;
+        }
+
+        bool have_fmt = false;
+        int format_tag = 0, bits = 0, block_align = 0;
+        const uint8_t* data = nullptr;
+        size_t data_size = 0;
+        for (const uint8_t* p = base + 12; p + 8 <= read_end;) {
+            uint32_t chunk_size = le32(p + 4);
+            const uint8_t* body = p + 8;
+            size_t available = end - body;
+            if (memcmp(p, "fmt ", 4) == 0 && chunk_size >= 16 && chunk_size <= available &&
+                chunk_size <= (size_t)(read_end - body)) {
+                format_tag = le16(body);
+                channels = le16(body + 2);
+                sample_rate = le32(body + 4);
+                block_align = le16(body + 12);
+                bits = le16(body + 14);
+                // WAVE_FORMAT_EXTENSIBLE: the real tag is the first two bytes of the sub-format GUID
+                if (format_tag == 0xFFFE && chunk_size >= 40) {
+                    format_tag = le16(body + 24);
+                }
+                have_fmt = true;
+            } else if (memcmp(p, "data", 4) == 0) {
+                data = body;
+                // Streaming writers may leave the size as 0 or 0xFFFFFFFF
+                data_size = (chunk_size == 0 || chunk_size > available) ? available : chunk_size;
+                break;
+            }
+            if (chunk_size > available) {
+                break;
+            }
+            p = body + chunk_size + (chunk_size & 1);
+        }
+
+        if (!have_fmt || data == nullptr || channels < 1) {
+            return false;
+        }
+        if (format_tag == 1 && bits == 16) {
+            format = WavSampleFormat::Pcm16;
+        } else if (format_tag == 1 && bits == 24) {
+            format = WavSampleFormat::Pcm24;
+        } else if (format_tag == 3 && bits == 32) {
+            format = WavSampleFormat::Float32;
+        } else {
+            return false;
+        }
+        if ((size_t)block_align != channels * wavBytesPerSample(format)) {
+            return false;
+        }
+
+        samples = data;
+        frames = data_size / block_align;
+        return true;
+    }
+
+public:
+    const uint8_t* samples = nullptr; // Interleaved sample bytes
+    size_t frames = 0;
+    int channels = 0;
+    int sample_rate = 0;
+    WavSampleFormat format = WavSampleFormat::Pcm16;
+
+    MappedWav() = default;
+    MappedWav(const MappedWav&) = delete;
+    MappedWav& operator=(const MappedWav&) = delete;
+
+    ~MappedWav() {
+        close();
+    }
+
+    bool isOpen() const {
+        return samples != nullptr;
+    }
+
+    size_t sampleCount() const {
+        return frames * channels;
+    }
+
+    size_t dataBytes() const {
+        return sampleCount() * wavBytesPerSample(format);
+    }
+
+    void close() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, mapping_size);
+        }
+        mapping = MAP_FAILED;
+        mapping_size = 0;
+        samples = nullptr;
+        frames = 0;
+    }
+
+    bool open(const std::string& path) {
+        close();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        (void)path;
+        return false; // Samples are used in place, so the host must be little-endian
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < 44) {
+            ::close(fd);
+            return false;
+        }
+        mapping_size = st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        if (!parse(static_cast<const uint8_t*>(mapping), mapping_size, mapping_size)) {
+            close();
+            return false;
+        }
+        madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    // Same as open() on `size` bytes of a whole file already in memory. The
+    // bytes are not copied and must stay valid until close().
+    bool openBuffer(const uint8_t* data, size_t size) {
+        close();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        (void)data;
+        (void)size;
+        return false;
+#else
+        if (!parse(data, size, size)) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    // Whether open() would accept the file, from its first HEADER_PROBE
+    // bytes, without mapping or reading the rest. Also false when the fmt or
+    // data chunk header lies further in; open() may still take such a file.
+    static const size_t HEADER_PROBE = 4096;
+
+    static bool probeFile(const std::string& path) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        (void)path;
+        return false;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        uint8_t head[HEADER_PROBE];
+        ssize_t n = fstat(fd, &st) == 0 ? pread(fd, head, sizeof(head), 0) : -1;
+        ::close(fd);
+        MappedWav probe;
+        return n > 0 && probe.parse(head, st.st_size, std::min<size_t>(n, st.st_size));
+#endif
+    }
+};
+
+#endif // WAV_MMAP_H